@@ -16,12 +16,33 @@ bin/test_load_store
 
 bin/test_callp
 bin/test_calln
+bin/test_batch
+bin/test_async
+bin/test_tiered
+bin/test_dualmap
+bin/test_patch_threads
+bin/test_codeheap
+bin/test_hugepages
+bin/test_cache
+bin/test_dedupe
+bin/test_replay
+bin/test_trace
+bin/test_perf
+bin/test_unwind
+bin/test_framepointer
+bin/test_interp
+bin/test_ra_fast
 
 bin/test_fib
 bin/test_call_stub
 bin/test_loop   # this tries to confuse opt_jump_be
+bin/test_diamonds
+bin/test_live_loop
 
 bin/test_mem_opt
+bin/test_reuse
+bin/test_renames
+bin/test_reassoc_chain
 
 cat << END | bin/bjit
     x := 0/0; y := x/1u;
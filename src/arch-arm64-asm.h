@@ -64,6 +64,13 @@ static uint8_t REG(int r)
     return 0;
 }
 
+// DWARF register numbers for unwind tables
+static uint8_t DWARF(int r)
+{
+    if(R2Mask(r) & regs::mask_float) return 64 + REG(r);
+    return REG(r);
+}
+
 // return the 4-bit Condition Code part of conditional ops
 uint8_t _CC(uint8_t opcode)
 {
@@ -96,12 +103,19 @@ struct AsmArm64
 {
     std::vector<uint8_t>   & out;
 
-    AsmArm64(std::vector<uint8_t> & out, unsigned nBlocks) : out(out)
+    // the buffers live in scratch, so Proc can recycle them
+    AsmArm64(std::vector<uint8_t> & out, unsigned nBlocks, impl::Scratch & s)
+        : out(out), rodata64(s.rodata64), rodata32(s.rodata32),
+        blockOffsets(s.blockOffsets), relocations(s.blockRelocs)
     {
+        rodata64.clear();
+        rodata32.clear();
+        relocations.clear();
+        
         rodata32_index = nBlocks++;
         rodata64_index = nBlocks++;
         //rodata128_index = nBlocks++;
-        blockOffsets.resize(nBlocks);
+        blockOffsets.assign(nBlocks, 0);
     }
 
     // separate .rodata for 128/64/32 bit constants
@@ -110,22 +124,16 @@ struct AsmArm64
     std::vector<__m128>     rodata128;
     uint32_t                rodata128_index;    // index into blockOffsets
 */    
-    std::vector<uint64_t>   rodata64;
+    std::vector<uint64_t>   & rodata64;
     uint32_t                rodata64_index;     // index into blockOffsets
     
-    std::vector<uint64_t>   rodata32;
+    std::vector<uint64_t>   & rodata32;
     uint32_t                rodata32_index;     // index into blockOffsets
 
     // stores byteOffsets to each basic block for relocation
-    std::vector<uint32_t>   blockOffsets;
-
-    struct Reloc
-    {
-        uint32_t    codeOffset;
-        uint32_t    blockIndex;
-    };
+    std::vector<uint32_t>   & blockOffsets;
 
-    std::vector<Reloc>      relocations;
+    std::vector<impl::BlockReloc>   & relocations;
 
     void emit(uint8_t byte) { out.push_back(byte); }
     void emit32(uint32_t data)
@@ -28,15 +28,22 @@ void Module::arch_compileStub(uintptr_t address)
     }
 }
 
+// these use atomic stores (of aligned data), so that another thread
+// running the code sees either the old or the new target, see dualMap
 void Module::arch_patchStub(void * ptr, uintptr_t address)
 {
     // should be aligned
-    ((uint64_t*)ptr)[1] = address;
+    __atomic_store_n(((uint64_t*)ptr) + 1, address, __ATOMIC_RELEASE);
+}
+
+uintptr_t Module::arch_readStub(void * ptr)
+{
+    return ((uint64_t*)ptr)[1];
 }
 
 void Module::arch_patchNear(void * ptr, int32_t delta)
 {
-    auto & code = *(uint32_t*) ptr;
+    auto code = *(uint32_t*) ptr;
     
     // everything here except ADR has imm26
     if((code & 0xfc000000) != 0x10000000)
@@ -51,6 +58,8 @@ void Module::arch_patchNear(void * ptr, int32_t delta)
         code &=~ (0x7ffff << 5);
         code |= (offset & 0x7ffff) << 5;
     }
+
+    __atomic_store_n((uint32_t*) ptr, code, __ATOMIC_RELEASE);
 }
 
 namespace bjit
@@ -79,10 +88,11 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
     
     for(auto & b : blocks) { b.flags.codeDone = false; }
 
-    AsmArm64 a64(out, blocks.size());
+    AsmArm64 a64(out, blocks.size(), scratch);
 
     // figure out what we need to save
-    std::vector<int>    savedRegs;
+    auto & savedRegs = scratch.savedRegs;
+    savedRegs.clear();
     for(int i = 0; regs::calleeSaved[i] != regs::none; ++i)
     {
         if(usedRegs & R2Mask(regs::calleeSaved[i]))
@@ -106,12 +116,33 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
     if(nSlots & 1) frameBytes += 8;
 
     // if we don't need to save anything, skip the stack frame
+    // unless setFramePointer() wants a frame chain in every proc
     bool needFrame = frameBytes || savedRegs.size()
-        || (usedRegs & R2Mask(regs::lr));
+        || (usedRegs & R2Mask(regs::lr)) || framePointer;
+
+    // record stack frame changes for unwind tables,
+    // the CFA is initially sp and the return address is in lr
+    auto unwindOp = [&](uint8_t op, uint8_t reg, int32_t offset)
+    {
+        unwind.emplace_back(impl::UnwindOp{
+            (uint32_t) out.size(), op, reg, offset});
+    };
+
+    // setEntryCounter(), x16 and x17 are scratch registers
+    if(entryCounter)
+    {
+        a64.MOVri(regs::x16, (uintptr_t) entryCounter);
+        a64._mem(0xB9400000, regs::x17, regs::x16, 0, 2);   // LDR w17, [x16]
+        a64._rri12(0x11000000, regs::x17, regs::x17, 1);    // ADD w17, w17, 1
+        a64._mem(0xB9000000, regs::x17, regs::x16, 0, 2);   // STR w17, [x16]
+    }
 
     if(needFrame)
     {
         a64.emit32(0xA9807BFD | ((0x7f & -nPush) << 15));
+        unwindOp(impl::UnwindOp::setCFA, 0, 8*nPush);
+        unwindOp(impl::UnwindOp::saveReg, DWARF(regs::fp), -8*nPush);
+        unwindOp(impl::UnwindOp::saveReg, DWARF(regs::lr), 8-8*nPush);
     
         // mov fp, sp
         a64.emit32(0x910003fd);
@@ -123,6 +154,9 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
             else if(R2Mask(savedRegs[i]) & regs::mask_float)
                 a64._mem(0xFD000000, savedRegs[i], regs::sp, 16 + 8*i, 3);
             else BJIT_ASSERT(false);
+
+            unwindOp(impl::UnwindOp::saveReg,
+                DWARF(savedRegs[i]), 16 + 8*i - 8*nPush);
         }
         
         if(frameBytes)
@@ -130,15 +164,23 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
             // FIXME: we could usually fit immediate here :)
             a64.MOVri(regs::x16, frameBytes);
             a64.emit32(0xCB3063FF); // SUB sp,sp,x16
+            unwindOp(impl::UnwindOp::setCFA, 0, 8*nPush + frameBytes);
         }
     }
 
+    // call unwindOp(restore) after the final jump
     auto restoreFrame = [&]()
     {
         if(!needFrame) return;
 
+        unwindOp(impl::UnwindOp::remember, 0, 0);
+
         // mov sp, fp
-        if(frameBytes) a64.emit32(0x910003BF);
+        if(frameBytes)
+        {
+            a64.emit32(0x910003BF);
+            unwindOp(impl::UnwindOp::setCFA, 0, 8*nPush);
+        }
         
         for(int i = 0; i < savedRegs.size(); ++i)
         {
@@ -150,10 +192,12 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
         }
         
         a64.emit32(0xA8C07BFD | ((0x7f & nPush) << 15));
+        unwindOp(impl::UnwindOp::setCFA, 0, 0);
     };
 
     // block todo-stack
-    std::vector<unsigned>   todo;
+    auto & todo = scratch.emitTodo;
+    todo.clear();
     
     // schedule entry-point
     todo.push_back(0);
@@ -285,6 +329,7 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
                 // BR
                 restoreFrame();
                 a64.emit32(0xD61F0000 | (REG(ops[i.in[0]].reg)<<5));
+                if(needFrame) unwindOp(impl::UnwindOp::restore, 0, 0);
                 break;
 
             case ops::icalln:
@@ -302,6 +347,7 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
                 nearReloc.emplace_back(
                     NearReloc{(uint32_t)out.size(), (uint32_t) i.imm32});
                 a64.emit32(0x14000000 | (0x3ffffff & -(out.size() >> 2)));
+                if(needFrame) unwindOp(impl::UnwindOp::restore, 0, 0);
                 break;
 
             case ops::lnp:
@@ -516,6 +562,7 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
             case ops::dret:
                 restoreFrame();
                 a64.emit32(0xD65F03C0);
+                if(needFrame) unwindOp(impl::UnwindOp::restore, 0, 0);
                 break;
 
             case ops::iadd:
@@ -124,6 +124,9 @@ namespace bjit
             |R2Mask(v14)
             |R2Mask(v15);
             
+        // Reserved by Proc::setFramePointer(), fp is never allocated
+        static const RegMask mask_frame = 0;
+
         // Caller saved (lost on function call)
         //
         // NOTE: We treat all xmm registers as volatile when calling functions.
@@ -47,6 +47,16 @@ static uint8_t REG(int r)
     return 0;
 }
 
+// DWARF register numbers for unwind tables, these don't follow encoding
+static uint8_t DWARF(int r)
+{
+    static const uint8_t dwarfInt[] = { 0, 2, 1, 3, 7, 6, 4, 5 };
+
+    if(R2Mask(r) & regs::mask_float) return 17 + REG(r);
+    if(REG(r) < 8) return dwarfInt[REG(r)];
+    return REG(r);
+}
+
 // return the 4-bit Condition Code part of conditional ops
 uint8_t _CC(uint8_t opcode)
 {
@@ -77,35 +87,38 @@ struct AsmX64
 {
     std::vector<uint8_t>   & out;
 
-    AsmX64(std::vector<uint8_t> & out, unsigned nBlocks) : out(out)
+    // the buffers live in scratch, so Proc can recycle them
+    AsmX64(std::vector<uint8_t> & out, unsigned nBlocks, impl::Scratch & s)
+        : out(out), rodata128(s.rodata128), rodata64(s.rodata64),
+        rodata32(s.rodata32), blockOffsets(s.blockOffsets),
+        relocations(s.blockRelocs)
     {
+        rodata128.clear();
+        rodata64.clear();
+        rodata32.clear();
+        relocations.clear();
+        
         rodata32_index = nBlocks++;
         rodata64_index = nBlocks++;
         rodata128_index = nBlocks++;
-        blockOffsets.resize(nBlocks);
+        blockOffsets.assign(nBlocks, 0);
     }
 
     // separate .rodata for 128/64/32 bit constants
     // we will place the most aligned block first
-    std::vector<__m128>     rodata128;
+    std::vector<uint64_t>   & rodata128;        // pairs of 64-bit
     uint32_t                rodata128_index;    // index into blockOffsets
     
-    std::vector<uint64_t>   rodata64;
+    std::vector<uint64_t>   & rodata64;
     uint32_t                rodata64_index;     // index into blockOffsets
     
-    std::vector<uint64_t>   rodata32;
+    std::vector<uint64_t>   & rodata32;
     uint32_t                rodata32_index;     // index into blockOffsets
 
     // stores byteOffsets to each basic block for relocation
-    std::vector<uint32_t>   blockOffsets;
+    std::vector<uint32_t>   & blockOffsets;
 
-    struct Reloc
-    {
-        uint32_t    codeOffset;
-        uint32_t    blockIndex;
-    };
-
-    std::vector<Reloc>      relocations;
+    std::vector<impl::BlockReloc>   & relocations;
 
     void emit(uint8_t byte) { out.push_back(byte); }
     void emit32(uint32_t data)
@@ -168,14 +181,22 @@ struct AsmX64
 
     uint32_t data128(__m128 data)
     {
-        unsigned index = rodata128.size();
+        uint64_t bits[2];
+        memcpy(bits, &data, sizeof(__m128));
+        
+        unsigned index = rodata128.size() / 2;
         // try to find an existing constant with same value
-        for(unsigned i = 0; i < rodata128.size(); ++i)
+        for(unsigned i = 0; i < rodata128.size() / 2; ++i)
         {
-            if(!memcmp(&rodata128[i],&data,sizeof(__m128))) { index = i; break; }
+            if(rodata128[2*i] == bits[0]
+            && rodata128[2*i+1] == bits[1]) { index = i; break; }
         }
         
-        if(index == rodata128.size()) rodata128.push_back(data);
+        if(index == rodata128.size() / 2)
+        {
+            rodata128.push_back(bits[0]);
+            rodata128.push_back(bits[1]);
+        }
         addReloc(rodata128_index);
         return index*sizeof(__m128);
     }
@@ -462,6 +483,9 @@ struct AsmX64
 #define _INC(r0)            a64._RR(1, 0, REG(r0), 0xFF)
 #define _DEC(r0)            a64._RR(1, 1, REG(r0), 0xFF)
 
+// 32-bit increment in memory
+#define _INCm32(ptr, off)   a64._RM(0, 0, REG(ptr), off, 0xFF)
+
 // these do either imm8, imm32 or RIP-relative .rodata64
 #define _ADDri(r0,v)        a64._XXriX(0, REG(r0), v)
 #define _SUBri(r0,v)        a64._XXriX(5, REG(r0), v)
@@ -39,31 +39,40 @@ namespace bjit
 
 void Module::arch_compileStub(uintptr_t address)
 {
-    // MOVABS + indirect jump, always use RAX as the register
-    bytes.push_back(0x48);  // REX.W ..
-    bytes.push_back(0xB8);  // MOVABS RAX, imm64
+    // indirect jump through the address that follows, which is 8-byte
+    // aligned so that patchStub() can replace it with a single store
+    BJIT_ASSERT(!(bytes.size() & 0x7));
+    bytes.push_back(0xFF);  // JMP [RIP+2]
+    bytes.push_back(0x25);
+    bytes.push_back(0x02);
+    bytes.push_back(0x00);
+    bytes.push_back(0x00);
+    bytes.push_back(0x00);
+    bytes.push_back(0xCC);  // pad with INT3, never reached
+    bytes.push_back(0xCC);
     for(int i = 0; i < 8; ++i)
     {
         bytes.push_back(address & 0xff);
         address >>= 8;
     }
-    bytes.push_back(0xFF);  // indirect jump
-    bytes.push_back(0xE0);  // r=4, rm=RAX
 }
 
+// these use atomic stores (of aligned data), so that another thread
+// running the code sees either the old or the new target, see dualMap
 void Module::arch_patchStub(void * ptr, uintptr_t address)
 {
-    for(int i = 0; i < 8; ++i)
-    {
-        (2+(uint8_t*)ptr)[i] = (address & 0xff);
-        address >>= 8;
-    }
+    __atomic_store_n((uint64_t*)(8+(uint8_t*)ptr), address, __ATOMIC_RELEASE);
+}
+
+uintptr_t Module::arch_readStub(void * ptr)
+{
+    return *(uint64_t*)(8+(uint8_t*)ptr);
 }
 
 void Module::arch_patchNear(void * ptr, int32_t delta)
 {
     auto addr = (uint32_t*) ptr;
-    *addr += delta;
+    __atomic_store_n(addr, *addr + delta, __ATOMIC_RELEASE);
 }
 
 void Proc::arch_emit(std::vector<uint8_t> & out)
@@ -73,12 +82,47 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
     
     for(auto & b : blocks) { b.flags.codeDone = false; }
 
-    AsmX64 a64(out, blocks.size());
+    AsmX64 a64(out, blocks.size(), scratch);
 
-    std::vector<int>    savedRegs;
+    auto & savedRegs = scratch.savedRegs;
+    savedRegs.clear();
 
-    // push callee-saved registers, goes first
+    // record stack frame changes for unwind tables,
+    // the CFA is initially rsp + 8 (the return address)
+    int cfa = 8;
+    auto unwindOp = [&](uint8_t op, uint8_t reg, int32_t offset)
+    {
+        unwind.emplace_back(impl::UnwindOp{
+            (uint32_t) out.size(), op, reg, offset});
+    };
+    auto unwindCFA = [&](int delta)
+    {
+        cfa += delta;
+        unwindOp(impl::UnwindOp::setCFA, 0, cfa);
+    };
+
+    // setEntryCounter(), r11 is free at entry with both calling conventions
+    if(entryCounter)
+    {
+        _MOVri(regs::r11, (uintptr_t) entryCounter);
+        _INCm32(regs::r11, 0);
+    }
+
+    // standard frame chain for setFramePointer(), goes first
     int nPush = 0;
+    if(framePointer)
+    {
+        // opt-ra should not have allocated it
+        BJIT_ASSERT(!(usedRegs & regs::mask_frame));
+
+        _PUSH(regs::rbp);
+        unwindCFA(8);
+        unwindOp(impl::UnwindOp::saveReg, DWARF(regs::rbp), -cfa);
+        _MOVrr(regs::rbp, regs::rsp);
+        nPush += 1;
+    }
+
+    // push callee-saved registers
     for(int i = 0; regs::calleeSaved[i] != regs::none; ++i)
     {
         if(usedRegs & R2Mask(regs::calleeSaved[i]))
@@ -92,11 +136,13 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
                     savedRegs.back() = regs::none;
                     savedRegs.push_back(regs::calleeSaved[i]);
                     _SUBri(regs::rsp, 16+8);
+                    unwindCFA(16+8);
                     ++nPush;
                 }
                 else
                 {
                     _SUBri(regs::rsp, 16);
+                    unwindCFA(16);
                 }
                 _store_f128(savedRegs.back(), regs::rsp, 0);
                 nPush += 2; // takes two slots
@@ -104,6 +150,9 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
             else
             {
                 _PUSH(savedRegs.back());
+                unwindCFA(8);
+                unwindOp(impl::UnwindOp::saveReg,
+                    DWARF(savedRegs.back()), -cfa);
                 nPush += 1;
             }
         }
@@ -118,10 +167,40 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
     if(!((nPush+nSlots) & 1)) frameOffset += 8;
     // add user-requested frame on top
     int frameBytes = 8*nSlots + frameOffset;
-    if(frameBytes) { _SUBri(regs::rsp, frameBytes); }
+    if(frameBytes) { _SUBri(regs::rsp, frameBytes); unwindCFA(frameBytes); }
+
+    // undo the above before returns and tail-calls,
+    // call unwindOp(restore) after the final jump
+    auto restoreFrame = [&]()
+    {
+        int cfaBody = cfa;
+        unwindOp(impl::UnwindOp::remember, 0, 0);
+
+        if(frameBytes) { _ADDri(regs::rsp, frameBytes); unwindCFA(-frameBytes); }
+        for(int r = savedRegs.size(); r--;)
+        {
+            if(R2Mask(savedRegs[r]) & regs::mask_float)
+            {
+                _load_f128(savedRegs[r], regs::rsp, 0);
+                // we might have used regs:none for alignment
+                if(r && savedRegs[r-1] == regs::none)
+                {
+                    _ADDri(regs::rsp, 16+8); --r;
+                    unwindCFA(-16-8);
+                }
+                else { _ADDri(regs::rsp, 16); unwindCFA(-16); }
+            }
+            else { _POP(savedRegs[r]); unwindCFA(-8); }
+        }
+        if(framePointer) { _POP(regs::rbp); unwindCFA(-8); }
+
+        // the code after this has the full frame again
+        cfa = cfaBody;
+    };
 
     // block todo-stack
-    std::vector<unsigned>   todo;
+    auto & todo = scratch.emitTodo;
+    todo.clear();
     
     // schedule entry-point
     todo.push_back(0);
@@ -265,7 +344,8 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
                 // "home locations" for registers
                 _SUBri(regs::rsp, 4 * sizeof(uint64_t));
 #endif
-                // RIP-relative call
+                // RIP-relative call, rel32 aligned for patchNear()
+                while((out.size() + 1) & 3) a64.emit(0x90);
                 a64.emit(0xE8);
                 nearReloc.emplace_back(
                     NearReloc{(uint32_t)out.size(), (uint32_t) i.imm32});
@@ -455,66 +535,27 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
             case ops::iret:
             case ops::fret:
             case ops::dret:
-                if(frameBytes) { _ADDri(regs::rsp, frameBytes); }
-                for(int r = savedRegs.size(); r--;)
-                {
-                    if(R2Mask(savedRegs[r]) & regs::mask_float)
-                    {
-                    
-                        _load_f128(savedRegs[r], regs::rsp, 0);
-                        // we might have used regs:none for alignment
-                        if(r && savedRegs[r-1] == regs::none)
-                        {
-                            _ADDri(regs::rsp, 16+8); --r;
-                        }
-                        else _ADDri(regs::rsp, 16);
-                    }
-                    else _POP(savedRegs[r]);
-                }
+                restoreFrame();
                 a64.emit(0xC3);
+                unwindOp(impl::UnwindOp::restore, 0, 0);
                 break;
                 
             case ops::tcallp:
-                if(frameBytes) { _ADDri(regs::rsp, frameBytes); }
-                for(int r = savedRegs.size(); r--;)
-                {
-                    if(R2Mask(savedRegs[r]) & regs::mask_float)
-                    {
-                        _load_f128(savedRegs[r], regs::rsp, 0);
-                        // we might have used regs:none for alignment
-                        if(r && savedRegs[r-1] == regs::none)
-                        {
-                            _ADDri(regs::rsp, 16+8); --r;
-                        }
-                        else _ADDri(regs::rsp, 16);
-                    }
-                    else _POP(savedRegs[r]);
-                }
+                restoreFrame();
                 // indirect jump
                 a64._RR(0, 4, REG(ops[i.in[0]].reg), 0xFF);
+                unwindOp(impl::UnwindOp::restore, 0, 0);
                 break;
                 
             case ops::tcalln:
-                if(frameBytes) { _ADDri(regs::rsp, frameBytes); }
-                for(int r = savedRegs.size(); r--;)
-                {
-                    if(R2Mask(savedRegs[r]) & regs::mask_float)
-                    {
-                        _load_f128(savedRegs[r], regs::rsp, 0);
-                        // we might have used regs:none for alignment
-                        if(r && savedRegs[r-1] == regs::none)
-                        {
-                            _ADDri(regs::rsp, 16+8); --r;
-                        }
-                        else _ADDri(regs::rsp, 16);
-                    }
-                    else _POP(savedRegs[r]);
-                }
-                // near jump
+                restoreFrame();
+                // near jump, rel32 aligned for patchNear()
+                while((out.size() + 1) & 3) a64.emit(0x90);
                 a64.emit(0xE9);
                 nearReloc.emplace_back(
                     NearReloc{(uint32_t)out.size(), (uint32_t) i.imm32});
                 a64.emit32(-4-out.size());
+                unwindOp(impl::UnwindOp::restore, 0, 0);
                 break;
 
             case ops::iadd:
@@ -967,9 +1008,12 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
             case ops::lnp:
                 {
                     // force 32-bit offset
+                    auto start = out.size();
                     _LEAri(i.reg, RIP, 1<<31);
                     // pop the disp32 field
                     a64.out.resize(a64.out.size() - 4);
+                    // align disp32 for patchNear() with NOPs in front
+                    out.insert(out.begin() + start, -out.size() & 3, 0x90);
                     // add reloc
                     nearReloc.emplace_back(
                         NearReloc{(uint32_t)out.size(), (uint32_t) i.imm32});
@@ -1189,12 +1233,10 @@ void Proc::arch_emit(std::vector<uint8_t> & out)
 
     // emit 128-bit point constants
     a64.blockOffsets[a64.rodata128_index] = out.size();
-    for(__m128 & bits : a64.rodata128)
+    for(uint64_t bits : a64.rodata128)
     {
-        a64.emit32(((uint32_t*)&bits)[0]);
-        a64.emit32(((uint32_t*)&bits)[1]);
-        a64.emit32(((uint32_t*)&bits)[2]);
-        a64.emit32(((uint32_t*)&bits)[3]);
+        a64.emit32(bits);
+        a64.emit32(bits>>32);
     }
 
     // emit 64-bit point constants
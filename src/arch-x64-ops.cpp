@@ -14,7 +14,7 @@ RegMask Op::regsMask()
         case _f32: return regs::mask_float;
         case _f64: return regs::mask_float;
 
-        default: BJIT_LOG("%s\n", strOpcode());
+        default: BJIT_TRACE(opt, error, "bad type for %s", strOpcode());
     }
     // silence warning if assert is nop
     BJIT_ASSERT(false); return 0;
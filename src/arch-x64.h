@@ -138,6 +138,9 @@ namespace bjit
             |R2Mask(xmm15)
             ;
 
+        // Reserved by Proc::setFramePointer()
+        static const RegMask mask_frame = R2Mask(rbp);
+
         // Caller saved (lost on function call)
         //
         // NOTE: We treat all xmm registers as volatile when calling functions.
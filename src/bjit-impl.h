@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <type_traits>
+
 #include "hash.h"
 #include "ir-ops.h"
 
@@ -30,6 +32,202 @@ namespace bjit
     
     namespace impl
     {
+        // Storage that grows one fixed-size page at a time and never moves
+        // existing elements, so references stay valid across push_back()
+        // without having to reserve for the worst case up front.
+        template <typename T, unsigned pageShift>
+        struct PagedVector
+        {
+            static const unsigned pageSize = 1u << pageShift;
+            static const unsigned pageMask = pageSize - 1;
+
+            T & operator[](unsigned i)
+            { return pages[i >> pageShift][i & pageMask]; }
+
+            T const & operator[](unsigned i) const
+            { return pages[i >> pageShift][i & pageMask]; }
+
+            size_t size() const { return nElems; }
+
+            void resize(size_t n)
+            {
+                while(nElems > n)
+                {
+                    pages[--nElems >> pageShift].pop_back();
+                }
+
+                while(nElems < n)
+                {
+                    auto page = nElems >> pageShift;
+                    if(page == pages.size())
+                    {
+                        // never grow a page past this, so it never moves
+                        pages.emplace_back();
+                        pages.back().reserve(pageSize);
+                    }
+                    pages[page].emplace_back();
+                    ++nElems;
+                }
+            }
+
+            // returns the index of an element, or size() if not found
+            size_t indexOf(T const & e) const
+            {
+                for(size_t p = 0; p < pages.size(); ++p)
+                {
+                    if(!pages[p].size()) break;
+                    if(&e < pages[p].data()
+                    || &e >= pages[p].data() + pages[p].size()) continue;
+                    return (p << pageShift) + (&e - pages[p].data());
+                }
+                return nElems;
+            }
+
+            template <typename V, typename E>
+            struct Iterator
+            {
+                V       *v;
+                size_t  i;
+
+                E & operator*() const { return (*v)[i]; }
+                Iterator & operator++() { ++i; return *this; }
+                bool operator!=(Iterator const & o) const { return i != o.i; }
+            };
+
+            typedef Iterator<PagedVector, T>                iterator;
+            typedef Iterator<PagedVector const, T const>    const_iterator;
+
+            iterator begin() { return iterator{this, 0}; }
+            iterator end() { return iterator{this, nElems}; }
+
+            const_iterator begin() const { return const_iterator{this, 0}; }
+            const_iterator end() const { return const_iterator{this, nElems}; }
+
+        private:
+            std::vector<std::vector<T>> pages;
+            size_t                      nElems = 0;
+        };
+
+        // Per-Proc memory for all the small per-block vectors.
+        //
+        // Allocations are rounded to powers of two and bumped from
+        // large chunks, while freed blocks go into per-size free lists
+        // which is good enough for vectors that mostly just grow.
+        // Everything is released at once when the arena is destroyed.
+        struct Arena
+        {
+            static const unsigned chunkSize = 0x10000;
+            static const unsigned minShift = 4;     // 16 bytes
+            static const unsigned nClasses = 28;
+
+            Arena() { for(auto & f : freeList) f = 0; }
+            ~Arena() { for(auto p : chunks) ::operator delete(p); }
+
+            Arena(Arena const &) = delete;
+            Arena & operator=(Arena const &) = delete;
+
+            void * alloc(size_t bytes)
+            {
+                unsigned c = sizeClass(bytes);
+                if(freeList[c])
+                {
+                    auto p = freeList[c];
+                    freeList[c] = p->next;
+                    return p;
+                }
+
+                size_t size = size_t(1) << (c + minShift);
+
+                // big things get a chunk of their own
+                if(size > (chunkSize >> 2))
+                {
+                    chunks.push_back(::operator new(size));
+                    return chunks.back();
+                }
+
+                if(chunkUsed + size > chunkSize)
+                {
+                    chunks.push_back(::operator new(chunkSize));
+                    chunk = (char*) chunks.back();
+                    chunkUsed = 0;
+                }
+
+                auto p = chunk + chunkUsed;
+                chunkUsed += size;
+                return p;
+            }
+
+            void free(void * ptr, size_t bytes)
+            {
+                unsigned c = sizeClass(bytes);
+                auto p = (FreeBlock*) ptr;
+                p->next = freeList[c];
+                freeList[c] = p;
+            }
+
+        private:
+            struct FreeBlock { FreeBlock * next; };
+
+            FreeBlock           *freeList[nClasses];
+
+            std::vector<void*>  chunks;
+
+            char                *chunk = 0;             // current chunk
+            size_t              chunkUsed = chunkSize;  // force a new chunk
+
+            static unsigned sizeClass(size_t bytes)
+            {
+                unsigned c = 0;
+                while((size_t(1) << (c + minShift)) < bytes) ++c;
+                BJIT_ASSERT(c < nClasses);
+                return c;
+            }
+        };
+
+        // Allocator for std::vector that uses an Arena if there is one
+        // and the regular heap otherwise. The allocator travels with the
+        // memory on swap/move/copy so we can mix heap and arena vectors.
+        template <typename T>
+        struct ArenaAllocator
+        {
+            typedef T value_type;
+
+            typedef std::true_type  propagate_on_container_copy_assignment;
+            typedef std::true_type  propagate_on_container_move_assignment;
+            typedef std::true_type  propagate_on_container_swap;
+
+            Arena   *arena = 0;
+
+            ArenaAllocator() {}
+            ArenaAllocator(Arena * arena) : arena(arena) {}
+
+            template <typename U>
+            ArenaAllocator(ArenaAllocator<U> const & o) : arena(o.arena) {}
+
+            T * allocate(size_t n)
+            {
+                if(!arena) return (T*) ::operator new(n * sizeof(T));
+                return (T*) arena->alloc(n * sizeof(T));
+            }
+
+            void deallocate(T * ptr, size_t n)
+            {
+                if(!arena) ::operator delete(ptr);
+                else arena->free(ptr, n * sizeof(T));
+            }
+
+            template <typename U>
+            bool operator==(ArenaAllocator<U> const & o) const
+            { return arena == o.arena; }
+
+            template <typename U>
+            bool operator!=(ArenaAllocator<U> const & o) const
+            { return arena != o.arena; }
+        };
+
+        template <typename T>
+        using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
         struct Op
         {
             // input operands
@@ -215,7 +413,114 @@ namespace bjit
             { return hash64(op.i64 + op.opcode); }
         };
     
+        // Use lists for opt_reassoc(), which builds them when it starts
+        // and disables them again when it returns; no other pass keeps
+        // them up to date, so these are not general def-use chains.
+        //
+        // For every value, this is a doubly-linked list of the op inputs
+        // that refer to it. A use is (op << 2) | slot, so the links can
+        // live in parallel arrays and we don't need any new fields in Op.
+        //
+        // Inputs changed in place must be fixed with relink(), but ops can
+        // be turned into NOPs (or otherwise lose inputs) without telling
+        // us: uses are checked against the actual inputs when iterated
+        // and stale ones are dropped from the list then.
+        struct ReassocUses
+        {
+            // enum rather than static const, since resize() takes references
+            enum : uint32_t
+            {
+                noUse = ~0u,
+                isHead = 1u << 31   // prev is a value, rather than a use
+            };
+
+            void enable(PagedVector<Op, 8> & o)
+            {
+                ops = &o;
+                head.clear(); head.resize(o.size(), noUse);
+                next.clear(); next.resize(o.size() << 2, noUse);
+                prev.clear(); prev.resize(o.size() << 2, noUse);
+            }
+
+            void disable() { ops = 0; }
+            bool enabled() const { return ops != 0; }
+
+            void link(uint16_t op, unsigned slot, uint16_t val)
+            {
+                uint32_t u = (op << 2) | slot;
+                BJIT_ASSERT_MORE(prev[u] == noUse);
+                if(val == noVal) return;
+
+                next[u] = head[val];
+                prev[u] = isHead | val;
+                if(head[val] != noUse) prev[head[val]] = u;
+                head[val] = u;
+            }
+
+            void unlink(uint16_t op, unsigned slot)
+            {
+                uint32_t u = (op << 2) | slot;
+                if(prev[u] == noUse) return;
+
+                if(next[u] != noUse) prev[next[u]] = prev[u];
+                if(prev[u] & isHead) head[prev[u] & 0xffff] = next[u];
+                else next[prev[u]] = next[u];
+
+                next[u] = noUse;
+                prev[u] = noUse;
+            }
+
+            // after changing the inputs of op directly, fix its uses
+            void relink(uint16_t op)
+            {
+                auto & o = (*ops)[op];
+                for(int k = 0; k < 3; ++k)
+                {
+                    unlink(op, k);
+                    if(k < o.nInputs()) link(op, k, o.in[k]);
+                }
+            }
+
+            // calls f(op, slot) for every (non-stale) use of val
+            // f is allowed to change (or unlink) the use it's called for
+            template <typename F>
+            void forEach(uint16_t val, F && f)
+            {
+                uint32_t n;
+                for(uint32_t u = head[val]; u != noUse; u = n)
+                {
+                    n = next[u];
+
+                    auto & op = (*ops)[u >> 2];
+                    if((u & 3) >= op.nInputs() || op.in[u & 3] != val)
+                    {
+                        unlink(u >> 2, u & 3);
+                        continue;
+                    }
+
+                    f(uint16_t(u >> 2), unsigned(u & 3));
+                }
+            }
+
+        private:
+            PagedVector<Op, 8>      *ops = 0;   // non-null when enabled
+            
+            std::vector<uint32_t>   head;   // first use for each value
+            std::vector<uint32_t>   next;   // links for each use
+            std::vector<uint32_t>   prev;   // isHead|value for first use
+        };
+
         // Variable rename tracker
+        // Renames are kept as a list (for passes that want to walk them)
+        // and a dense src->dst table for lookups, so that renaming is
+        // constant time regardless of how many renames we have.
+        //
+        // The first rename for any given src wins and chains (a->b, b->c)
+        // are followed to the end, with path compression so that long
+        // chains are only walked once. Renames that would form a cycle
+        // are ignored, since they can't mean anything sensible anyway.
+        //
+        // If you edit the map directly, call rebuild() afterwards.
         struct Rename
         {
             struct Map {
@@ -224,25 +529,68 @@ namespace bjit
             };
             std::vector<Map>    map;
     
-            void add(uint16_t s, uint16_t d) { map.emplace_back(s,d); }
+            void add(uint16_t s, uint16_t d)
+            {
+                map.emplace_back(s,d);
+                link(s, d);
+            }
+            
+            void clear() { map.clear(); unlink(); }
+
+            void rebuild()
+            {
+                unlink();
+                for(auto & r : map) link(r.src, r.dst);
+            }
+
+            // find the final rename for a value
+            uint16_t operator()(uint16_t v)
+            {
+                uint16_t d = v;
+                while(d < table.size() && table[d] != noVal) d = table[d];
+
+                // compress the path so that we go straight to the end
+                while(v != d) { auto n = table[v]; table[v] = d; v = n; }
+                return d;
+            }
     
             Op & operator()(Op & op)
             {
-                int n = op.nInputs();
-                if(!n) return op;
-                for(auto & r : map)
+                if(!touched.size()) return op;
+                
+                switch(op.nInputs())
                 {
-                    switch(n)
-                    {
-                    case 3: if(op.in[2] == r.src) op.in[2] = r.dst;
-                    case 2: if(op.in[1] == r.src) op.in[1] = r.dst;
-                    case 1: if(op.in[0] == r.src) op.in[0] = r.dst;
-                    case 0: break;
-                    default: BJIT_ASSERT(false);
-                    }
+                case 3: op.in[2] = (*this)(op.in[2]);
+                case 2: op.in[1] = (*this)(op.in[1]);
+                case 1: op.in[0] = (*this)(op.in[0]);
+                case 0: break;
+                default: BJIT_ASSERT(false);
                 }
                 return op;
             }
+            
+        private:
+            // table[src] is dst or noVal, touched is the list of
+            // non-noVal entries so that we can clear them cheaply
+            std::vector<uint16_t>   table;
+            std::vector<uint16_t>   touched;
+
+            void link(uint16_t s, uint16_t d)
+            {
+                if(s == d) return;  // RA uses these for dead renames
+                if(s >= table.size()) table.resize(s + 1, noVal);
+                if(table[s] != noVal) return;
+                if((*this)(d) == s) return;
+                
+                table[s] = d;
+                touched.push_back(s);
+            }
+
+            void unlink()
+            {
+                for(auto t : touched) table[t] = noVal;
+                touched.clear();
+            }
         };
         
         // Use by Block to track actual phi-alternatives
@@ -265,17 +613,17 @@ namespace bjit
         // One basic block
         struct Block
         {
-            std::vector<uint16_t>   code;
-            std::vector<Phi>        args;
-            std::vector<PhiAlt>     alts;
+            ArenaVector<uint16_t>   code;
+            ArenaVector<Phi>        args;
+            ArenaVector<PhiAlt>     alts;
 
             void newAlt(uint16_t phi, uint16_t src, uint16_t val)
             {
                 alts.emplace_back(PhiAlt{phi, src, val});
             }
     
-            std::vector<uint16_t>   livein;
-            std::vector<uint16_t>   comeFrom;   // which blocks we come from?
+            ArenaVector<uint16_t>   livein;
+            ArenaVector<uint16_t>   comeFrom;   // which blocks we come from?
     
             // register state on input
             uint16_t    regsIn[regs::nregs];
@@ -283,12 +631,14 @@ namespace bjit
             // register state on output (used for shuffling)
             uint16_t    regsOut[regs::nregs];
     
-            // dominators
-            std::vector<uint16_t>   dom;
-            
+            // dominators, see rebuild_dom() and dominates()
             uint16_t    idom;   // immediate dominator
             uint16_t    pdom;   // immediate post-dominator
 
+            uint16_t    domDepth = 0;       // number of dominators (incl. self)
+            uint16_t    domPre = noVal;     // DFS numbering of dominator tree
+            uint16_t    domPost = noVal;    // noVal for blocks added since
+
             uint16_t    memtag; // memory version into the block
             uint16_t    memout; // memory version out of the block
 
@@ -298,10 +648,84 @@ namespace bjit
                 bool codeDone   : 1;    // backend uses this
             } flags = {};
     
-            Block()
+            Block(Arena * arena = 0)
+                : code(arena), args(arena), alts(arena)
+                , livein(arena), comeFrom(arena)
             {
                 for(int i = 0; i < regs::nregs; ++i) regsIn[i] = regsOut[i] = noVal;
             }
+
+            // reset to the state of a new block, but keep the memory
+            void clear()
+            {
+                code.clear(); args.clear(); alts.clear();
+                livein.clear(); comeFrom.clear();
+
+                domDepth = 0; domPre = domPost = noVal;
+
+                for(int i = 0; i < regs::nregs; ++i) regsIn[i] = regsOut[i] = noVal;
+                flags = {};
+            }
+        };
+
+        // used by the assemblers to relocate references to blocks
+        struct BlockReloc
+        {
+            uint32_t    codeOffset;     // where to add offset
+            uint32_t    blockIndex;     // which block offset to add
+        };
+
+        // Scratch space for passes, kept in Proc only so that Proc::reset()
+        // can recycle the memory; each pass clears what it uses on entry.
+        struct Scratch
+        {
+            // this gets swapped with block vectors, so share the arena
+            Scratch(Arena * arena) : codeOut(arena) {}
+
+            Rename                  rename, renameAlt;
+
+            std::vector<uint16_t>   domOrder;       // opt-dom.cpp
+            std::vector<uint16_t>   domNodes;       // opt-dom.cpp
+            std::vector<uint16_t>   domIdom;        // opt-dom.cpp
+            std::vector<uint32_t>   domStack;       // opt-dom.cpp
+            std::vector<uint16_t>   domCfg;         // opt-dom.cpp
+            std::vector<uint16_t>   domCfgNew;      // opt-dom.cpp
+
+            // opt-dce.cpp: live-in bitsets, liveWords per block
+            std::vector<uint64_t>   liveIn;
+            std::vector<uint64_t>   liveGen;
+            std::vector<uint64_t>   liveOut;
+            std::vector<uint16_t>   liveOrder;
+            std::vector<uint8_t>    liveQueued;
+            unsigned                liveWords = 0;
+            std::vector<uint32_t>   csePairs;       // opt-cse.cpp
+            std::vector<uint16_t>   csePreList;     // opt-cse.cpp
+            std::vector<uint32_t>   reassocOrder;   // opt-reassoc.cpp
+            std::vector<uint16_t>   reassocOps;     // opt-reassoc.cpp
+            std::vector<uint8_t>    reassocQueued;  // opt-reassoc.cpp
+            std::vector<uint32_t>   reassocCur;     // opt-reassoc.cpp
+            std::vector<uint32_t>   reassocNext;    // opt-reassoc.cpp
+            ReassocUses             reassocUses;    // opt-reassoc.cpp
+            std::vector<uint16_t>   sinkTmp0;       // opt-sink.cpp
+            std::vector<uint16_t>   sinkTmp1;       // opt-sink.cpp
+            std::vector<uint16_t>   hashOrder;      // ir-hash.cpp
+            std::vector<uint16_t>   hashBlockPos;   // ir-hash.cpp
+            std::vector<uint16_t>   hashOpPos;      // ir-hash.cpp
+            std::vector<uint64_t>   hashAlts;       // ir-hash.cpp
+
+            ArenaVector<uint16_t>   codeOut;        // opt-ra.cpp
+            std::vector<uint16_t>   newBlocks;      // opt-ra.cpp
+            std::vector<uint16_t>   slots;          // opt-ra.cpp
+            std::vector<bool>       sccUsed;        // opt-ra.cpp
+
+            // arch-XX-emit.cpp and arch-XX-asm.h
+            std::vector<int>        savedRegs;
+            std::vector<unsigned>   emitTodo;
+            std::vector<uint64_t>   rodata128;      // pairs of 64-bit
+            std::vector<uint64_t>   rodata64;
+            std::vector<uint64_t>   rodata32;
+            std::vector<uint32_t>   blockOffsets;
+            std::vector<BlockReloc> blockRelocs;
         };
     
         // used to communicate relocations from Proc to Module
@@ -310,5 +734,23 @@ namespace bjit
             uint32_t    codeOffset;     // where to add offset
             uint32_t    procIndex;    // which offset to add
         };
+
+        // How the stack frame changes, recorded by arch_emit() in code
+        // order for the unwind tables built by Module, see module-unwind.cpp
+        struct UnwindOp
+        {
+            enum
+            {
+                setCFA,     // CFA is now stack pointer + offset
+                saveReg,    // reg (DWARF number) saved at CFA + offset
+                remember,   // start of an epilogue, save the state
+                restore     // end of an epilogue, back to saved state
+            };
+
+            uint32_t    codeOffset;     // instruction after the change
+            uint8_t     op;
+            uint8_t     reg;
+            int32_t     offset;
+        };
     };
 };
\ No newline at end of file
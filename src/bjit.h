@@ -3,6 +3,11 @@
 
 #include <cstdint>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <string>
 
 // If BJIT_NO_ASSERT is defined, we disable ALL error checking.
 #ifdef BJIT_NO_ASSERT
@@ -23,15 +28,98 @@
 // This is used for some checks that are borderline paranoid
 #define BJIT_ASSERT_MORE(x)     BJIT_ASSERT(x)
 
+// This is used for debug() dumps and the *_debug spam in passes.
 #ifndef BJIT_LOG
 #  include <cstdio>
 #  define BJIT_LOG(...)     fprintf(stderr, __VA_ARGS__)
 #endif
 
+// Trace events, eg. BJIT_TRACE(opt, info, "cse") - see bjit::trace below.
+// Levels above BJIT_TRACE_LEVEL compile to nothing, -1 disables all.
+#ifndef BJIT_TRACE_LEVEL
+#  define BJIT_TRACE_LEVEL  2
+#endif
+#define BJIT_TRACE(cat, lvl, ...) \
+    do{ if(bjit::trace::lvl <= BJIT_TRACE_LEVEL \
+        && bjit::trace::enabled(bjit::trace::cat, bjit::trace::lvl)) \
+        bjit::trace::log(bjit::trace::cat, bjit::trace::lvl, __VA_ARGS__); \
+    }while(0)
+
 namespace bjit
 {
     struct too_many_ops {};
     struct internal_error {};
+
+    // trace.cpp
+    namespace trace
+    {
+        enum Category
+        {
+            opt     = 1<<0,     // optimization passes
+            ra      = 1<<1,     // register allocation
+            module  = 1<<2,     // loading and patching modules
+
+            all     = 0xff
+        };
+
+        enum Level { error, info, debug };
+
+        // Called for every event that passes the filter, messages are one
+        // line without the newline; calls are serialized by the caller.
+        typedef void (*Sink)(unsigned category, unsigned level,
+            const char * msg, void * user);
+
+        // null sink prints to stderr, which is also the default
+        void setSink(Sink sink, void * user = 0);
+
+        // which categories to trace and up to which level,
+        // the default is errors from all categories
+        void setFilter(unsigned categories, unsigned level = info);
+
+        // categories in the low bits, level above them
+        extern std::atomic<unsigned> filter;
+
+        static inline bool enabled(unsigned category, unsigned level)
+        {
+            unsigned f = filter.load(std::memory_order_relaxed);
+            return (f & category) && level <= (f >> 8);
+        }
+
+        // printf-style, usually through BJIT_TRACE
+        void log(unsigned category, unsigned level, const char * fmt, ...);
+
+        // Keeps the latest events in memory: setSink(Ring::sink, &ring)
+        struct Ring
+        {
+            struct Event
+            {
+                unsigned    category;
+                unsigned    level;
+                std::string msg;
+            };
+
+            Ring(unsigned size = 256) : events(size) {}
+
+            static void sink(unsigned category, unsigned level,
+                const char * msg, void * ring);
+
+            // copies out the events, oldest first
+            void get(std::vector<Event> & out);
+            void clear();
+
+            // total number of events seen, including dropped ones
+            unsigned getTotal()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return nTotal;
+            }
+
+        private:
+            std::mutex          mutex;
+            std::vector<Event>  events;
+            unsigned            nTotal = 0;
+        };
+    };
 };
 
 #include "bjit-impl.h"
@@ -43,8 +131,79 @@ namespace bjit
     struct Value { uint16_t index; };
     struct Label { uint16_t index; };
 
+    // Statistics collected by Proc::compile(), see Proc::getStats()
+    struct CompileStats
+    {
+        enum Pass
+        {
+            dce, fold, reassoc, cse, jump, sink, scc, ra, emit,
+
+            nPasses
+        };
+        static const char * passName(unsigned pass);
+
+        // wall-time of each pass, not including any nested passes
+        // (eg. jump threading does DCE), and number of times it ran
+        double      seconds[nPasses] = {};
+        unsigned    nRuns[nPasses] = {};
+
+        unsigned    nOptIter = 0;   // iterations of the opt() loop
+
+        unsigned    nOpsIn = 0;     // ops and blocks before compiling
+        unsigned    nBlocksIn = 0;
+        unsigned    nOpsOut = 0;    // ops and blocks in the final code
+        unsigned    nBlocksOut = 0;
+
+        unsigned    nSpills = 0;    // values spilled to the stack
+        unsigned    nReloads = 0;   // reloads from the stack
+        unsigned    nRenames = 0;   // register moves
+
+        unsigned    nBytes = 0;     // bytes of code emitted
+
+        // add another to this one, eg. to collect totals
+        void add(CompileStats const & s);
+    };
+
+    namespace impl
+    {
+        // Times a pass for CompileStats, not including the time spent
+        // in nested passes, which are timed separately; current points
+        // to the innermost timer, so we know where to add our time
+        struct PassTimer
+        {
+            typedef std::chrono::steady_clock clock;
+
+            PassTimer(CompileStats & stats, unsigned pass, PassTimer *& current)
+                : stats(stats), pass(pass), current(current)
+                , parent(current), t0(clock::now())
+            {
+                current = this;
+            }
+
+            ~PassTimer()
+            {
+                double t = std::chrono::duration<double>(clock::now() - t0).count();
+                stats.seconds[pass] += t - nested;
+                stats.nRuns[pass] += 1;
+
+                if(parent) parent->nested += t;
+                current = parent;
+            }
+
+        private:
+            CompileStats        & stats;
+            unsigned            pass;
+            PassTimer           *& current;
+            PassTimer           *parent;
+            clock::time_point   t0;
+            double              nested = 0;
+        };
+    };
+
     struct Proc
     {
+        friend struct Interp;   // reads the IR directly
+
         // These are used everywhere, so import them into Proc
         typedef impl::Op        Op;
         typedef impl::OpCSE     OpCSE;
@@ -60,30 +219,84 @@ namespace bjit
         //
         Proc(unsigned allocBytes, const char * args)
         {
-            // reserve space for maximum number of ops
-            // NOTE: opt-ra and opt-fold assume we don't realloc
-            ops.reserve(noVal);
-            currentBlock = newLabel().index;
-            emitLabel(Label{currentBlock});
+            init(allocBytes, args);
+        }
 
-            // front-ends can use the invariant this is always SSA value 0
-            alloc(allocBytes);
+        // Reset this Proc to the state Proc(allocBytes, args) would have,
+        // but keep all the memory (ops, blocks and scratch space for the
+        // compiler passes) from previous use, so that building and then
+        // compiling procedures in a loop with the same Proc will stop
+        // allocating once the buffers have grown large enough.
+        //
+        // Settings are not reset: setFramePointer(), setEntryCounter() and
+        // setOptSparse() stay as they were, so they only need to be set once.
+        void reset(unsigned allocBytes, const char * args)
+        {
+            clear();
+            init(allocBytes, args);
+        }
 
-            if(args) for(;*args;++args)
+        // ir-record.cpp: binary dump of the IR, eg. for benchmarks
+        //
+        // record() appends the current state of the proc (normally before
+        // compiling) to out as one record that starts with its total size
+        // as a 32-bit integer, so a file of records can be streamed
+        //
+        // replay() replaces the contents of the proc with a record, then it
+        // can be compiled as usual; returns false if the record isn't valid
+        // (or from another version), in which case the proc is left empty
+        //
+        // the record includes setFramePointer() and setOptSparse(), but not
+        // setEntryCounter() since that's an address: replay() keeps the
+        // current counter like reset() does
+        void record(std::vector<uint8_t> & out);
+        bool replay(const uint8_t * data, size_t size);
+
+    private:
+        // shared by reset() and replay()
+        void clear()
+        {
+            env.clear();
+            nearReloc.clear();
+            unwind.clear();
+
+            nArgsInt = nArgsFloat = nArgsTotal = 0;
+            nPassInt = nPassFloat = nPassTotal = 0;
+
+            raDone = false;
+            nSlots = 0;
+            liveOps = 0;
+            usedRegs = 0;
+
+            cseTable.clear();
+            todo.clear();
+            live.clear();
+
+            // keep the blocks around for newBlock() to recycle
+            for(auto & b : blocks)
             {
-                switch(*args)
-                {
-                case 'i': env.push_back(iarg()); break;
-                case 'f': env.push_back(farg()); break;
-                case 'd': env.push_back(darg()); break;
-                default: BJIT_ASSERT(false);
-                }
+                b.clear();
+                blockPool.emplace_back(std::move(b));
             }
+            blocks.clear();
+
+            ops.resize(0);
         }
 
+    public:
         // sanity.cpp: checks internal invariants
         void sanity();
 
+        // ir-hash.cpp: canonical hash of the IR as compiled at levelOpt
+        //
+        // only looks at reachable blocks and live ops, which are numbered
+        // by position, so procs that only differ in dead code (or in the
+        // order the blocks were created in) give the same hash
+        //
+        // if key is not null, it's filled with everything that was hashed,
+        // so procs with equal keys are the same even if the hashes collide
+        uint64_t hash(unsigned levelOpt = 2, std::vector<uint64_t> * key = 0);
+
         // debug.cpp
         void debug() const;
         void debugOp(uint16_t index) const;
@@ -92,7 +305,7 @@ namespace bjit
         // Compiles code into 'bytes' (does not truncate).
         //
         // Takes optimization level:
-        //  - 0: DCE only
+        //  - 0: DCE only, with a faster but simpler register allocator
         //  - 1: "safe" optimizations only (default)
         //  - 2: "unsafe" optimizations also (eg. fast-math, no div-by-zero)
         //
@@ -100,22 +313,58 @@ namespace bjit
         void compile(std::vector<uint8_t> & bytes, unsigned levelOpt)
         {
             bool unsafeOpt = levelOpt > 1;
+
+            stats = CompileStats();
+            stats.nOpsIn = ops.size();
+            stats.nBlocksIn = blocks.size();
             
             if(levelOpt) opt(unsafeOpt);
             
-            allocRegs(unsafeOpt);
-            arch_emit(bytes);
+            if(levelOpt) allocRegs(unsafeOpt); else allocRegsFast();
+
+            auto size0 = bytes.size();
+            {
+                impl::PassTimer timer(stats, CompileStats::emit, passTimer);
+                arch_emit(bytes);
+            }
+            stats.nBytes = bytes.size() - size0;
+            collectStats();
         }
 
+        // statistics from the last compile()
+        const CompileStats & getStats() const { return stats; }
+
+        // reserve the frame pointer (rbp on x64, x29 on arm64) and always
+        // build a standard frame chain, so profilers that walk the stack
+        // with frame pointers can see through the generated code
+        //
+        // this costs a register on x64 and a prologue for leaf procs,
+        // the setting is kept by reset() and saved by record()
+        void setFramePointer(bool enable) { framePointer = enable; }
+        bool getFramePointer() const { return framePointer; }
+
+        // add one to *counter in the prologue every time the proc is called,
+        // eg. to find hot procs, see Module::compileTiered(); the update is
+        // not atomic, so with many threads the count is only an estimate
+        //
+        // the address goes into the code, null (the default) disables this
+        // and like setFramePointer() the setting is kept by reset()
+        void setEntryCounter(uint32_t * counter) { entryCounter = counter; }
+        uint32_t * getEntryCounter() const { return entryCounter; }
+
+        // if false, then the optimizer revisits everything in every round
+        // (and always rebuilds dominators) rather than only what changed;
+        // this is slower, but must give exactly the same code, so it's
+        // only useful for benchmarks and debugging (default is true),
+        // kept by reset() and saved by record() like setFramePointer()
+        void setOptSparse(bool enable) { optSparse = enable; }
+
         std::vector<Value>  env;
 
         // generate a label
         Label newLabel()
         {
-            BJIT_ASSERT(blocks.size() < noVal);
-            uint16_t label = blocks.size();
-            
-            blocks.resize(label + 1);
+            uint16_t label = newBlock();
             
             blocks[label].args.reserve(env.size());
 
@@ -152,6 +401,11 @@ namespace bjit
             return nearReloc;
         }
 
+        std::vector<impl::UnwindOp> const & getUnwind()
+        {
+            return unwind;
+        }
+
         ///////////////////////////////
         // FRONT END OPCODE EMITTERS //
         ///////////////////////////////
@@ -416,6 +670,9 @@ namespace bjit
         // and possibly something else in the future
         std::vector<NearReloc>  nearReloc;
 
+        // stack frame changes from arch_emit, for Module::setUnwind()
+        std::vector<impl::UnwindOp> unwind;
+
         // used to encode indexType, indexTotal for incoming parameters
         int     nArgsInt    = 0;
         int     nArgsFloat  = 0;
@@ -432,25 +689,65 @@ namespace bjit
         int     liveOps = 0;    // collect count in DCE
         
         RegMask usedRegs = 0;   // for callee saved on prolog/epilog
+        bool    framePointer = false;   // see setFramePointer()
+        uint32_t    *entryCounter = 0;  // see setEntryCounter()
+        bool    optSparse = true;       // see setOptSparse()
+
+        CompileStats        stats;
+        impl::PassTimer     *passTimer = 0; // innermost running pass
 
         HashTable<OpCSE>        cseTable;
+
         
         std::vector<uint16_t>   todo;   // this is used for block todos
         std::vector<uint16_t>   live;   // live blocks, used for stuff
     
+        // per-block vectors allocate from here, so this must come first
+        // also keep it on the heap, so that blocks survive moving Proc
+        std::unique_ptr<impl::Arena>    arena { new impl::Arena };
+
         std::vector<Block>      blocks;
-        std::vector<Op>         ops;
+        std::vector<Block>      blockPool;  // cleared blocks from reset()
+
+        // scratch space for passes, see impl::Scratch
+        impl::Scratch           scratch { arena.get() };
+
+        // NOTE: opt-ra and opt-fold assume ops are never moved
+        // once added, so we store them in pages of 256 ops which
+        // keeps small procs small without ever reallocating
+        impl::PagedVector<Op, 8>    ops;
 
         uint16_t    getOpIndex(Op & op)
         {
             // this is somewhat ugly, but saves us a field in Op
-            auto i = (uintptr_t(&op) - uintptr_t(ops.data())) / sizeof(Op);
-            BJIT_ASSERT_MORE(i == (uint16_t) i);
+            auto i = ops.indexOf(op);
+            BJIT_ASSERT_MORE(i < ops.size());
             return (uint16_t) i;
         }
 
         uint16_t    currentBlock;
 
+        // shared by the constructor and reset()
+        void init(unsigned allocBytes, const char * args)
+        {
+            currentBlock = newLabel().index;
+            emitLabel(Label{currentBlock});
+
+            // front-ends can use the invariant this is always SSA value 0
+            alloc(allocBytes);
+
+            if(args) for(;*args;++args)
+            {
+                switch(*args)
+                {
+                case 'i': env.push_back(iarg()); break;
+                case 'f': env.push_back(farg()); break;
+                case 'd': env.push_back(darg()); break;
+                default: BJIT_ASSERT(false);
+                }
+            }
+        }
+
         void opt(bool unsafeOpt = false)
         {
             // check sanity limit (eg. don't let tests hang)
@@ -463,6 +760,7 @@ namespace bjit
             while(repeat)
             {
                 BJIT_ASSERT(++iterOpt < 0x100);
+                ++stats.nOptIter;
 
                 repeat = false;
                 
@@ -490,17 +788,37 @@ namespace bjit
             opt_sink(unsafeOpt);
         }
 
+        // add a new block, recycling one from reset() if possible
+        uint16_t newBlock()
+        {
+            BJIT_ASSERT(blocks.size() < noVal);
+            uint16_t b = blocks.size();
+
+            // new blocks get dominators patched manually, so
+            // make sure the next rebuild_dom() redoes them properly
+            scratch.domCfg.clear();
+
+            if(blockPool.size())
+            {
+                blocks.emplace_back(std::move(blockPool.back()));
+                blockPool.pop_back();
+            }
+            else blocks.emplace_back(arena.get());
+
+            return b;
+        }
+
         // used to break critical edges, returns the new block
         // tries to fix most info, but not necessarily all
         uint16_t breakEdge(uint16_t from, uint16_t to)
         {
-            uint16_t b = blocks.size();
-            BJIT_LOG(" BCE[%d:%d:%d]", from, b, to);
-            blocks.resize(blocks.size() + 1);
+            uint16_t b = newBlock();
+            BJIT_TRACE(opt, debug, "bce %d:%d:%d", from, b, to);
 
             blocks[b].comeFrom.push_back(from);
             auto & jmp = ops[addOp(ops::jmp, Op::_none, b)];
             jmp.label[0] = to;
+            jmp.pos = 0;    // CSE might hoist into this block before DCE
 
             // if original jump is no-opt then also mark
             // the new jump as no_opt so we don't try to
@@ -512,8 +830,8 @@ namespace bjit
             blocks[b].livein = blocks[to].livein;
 
             // fix doms, don't care about pdoms
-            blocks[b].dom = blocks[from].dom;
-            blocks[b].dom.push_back(b);
+            // new block doesn't get DFS numbers, see dominates()
+            blocks[b].domDepth = blocks[from].domDepth + 1;
 
             // fix memtags (eg. CSE/RA)
             blocks[b].memtag = blocks[from].memout;
@@ -527,8 +845,7 @@ namespace bjit
             if(blocks[to].idom == from)
             {
                 blocks[to].idom = b;
-                blocks[to].dom.back() = b;
-                blocks[to].dom.push_back(to);
+                blocks[to].domDepth = blocks[b].domDepth + 1;
             }
 
             if(blocks[from].pdom == to) blocks[from].pdom = b;
@@ -557,6 +874,7 @@ namespace bjit
             uint16_t i = ops.size();
             
             ops.resize(i + 1);
+            
             ops[i].opcode = opcode;
             ops[i].in[0] = noVal;
             ops[i].in[1] = noVal;
@@ -667,6 +985,10 @@ namespace bjit
         void allocRegs(bool unsafeOpt);
         void findSCC();         // resolve stack congruence classes
         void findUsedRegs();    // usedRegs post final DCE
+        void collectStats();    // counts for CompileStats after emit
+
+        // opt-ra-fast.cpp
+        void allocRegsFast();   // for levelOpt 0, see compile()
 
         // opt-fold.cpp
         bool opt_fold(bool unsafeOpt);
@@ -691,10 +1013,40 @@ namespace bjit
         void rebuild_cfg();
         void rebuild_dom();
 
+        // returns true if block a dominates block b (or a == b)
+        //
+        // this is O(1) for blocks numbered by rebuild_dom(), but blocks
+        // added since (eg. breakEdge) walk up their idoms until they
+        // find a block that has been numbered
+        bool dominates(uint16_t a, uint16_t b)
+        {
+            while(a != b)
+            {
+                if(blocks[a].domPre != noVal && blocks[b].domPre != noVal)
+                {
+                    return blocks[a].domPre <= blocks[b].domPre
+                        && blocks[b].domPost <= blocks[a].domPost;
+                }
+                if(!b) return false;
+                b = blocks[b].idom;
+            }
+            return true;
+        }
+
         // opt-dce.cpp
         // compute live-in variables, set all nUse = 0
         void rebuild_livein();
 
+        // is value live-in to block, as of the last rebuild_livein()
+        // this does not see any changes to livein made since
+        bool isLiveIn(uint16_t b, uint16_t val) const
+        {
+            size_t i = b * size_t(scratch.liveWords) + (val >> 6);
+            if(val >= (scratch.liveWords << 6)) return false;
+            if(i >= scratch.liveIn.size()) return false;
+            return (scratch.liveIn[i] >> (val & 63)) & 1;
+        }
+
         // initializes nUse, used by livescan() and allocRegs()
         // if inOnly then only live-in variables will have nUse != 0
         void findUsesBlock(int b, bool inOnly, bool localOnly);
@@ -703,6 +1055,85 @@ namespace bjit
         void arch_emit(std::vector<uint8_t> & bytes);
     };
 
+    namespace impl { struct AsyncJob; struct AsyncPool; struct CodeRegion; }   // module.cpp
+    namespace impl { struct TierProc; }     // module-tier.cpp
+
+    // Executable memory shared by many modules, see Module::load(CodeHeap&)
+    //
+    // the heap reserves regions of (at least) regionSize bytes from the
+    // system and gives every module a 64-byte aligned chunk, which goes
+    // back to the heap on unload(), so tiny modules don't each waste most
+    // of a page (and a TLB entry and a pair of system calls to load)
+    //
+    // the regions are dual-mapped (see Module::load()), so they're always
+    // executable and written through a second view, which means modules can
+    // be loaded, patched and unloaded while others in the heap are running;
+    // where dual mapping is not supported, load() gives each module a private
+    // mapping instead (which getStats() doesn't count)
+    //
+    // the heap is thread-safe, but must outlive all modules loaded into it
+    struct CodeHeap
+    {
+        // if hugePages, then regions are rounded to 2MB and backed by
+        // huge pages if the system lets us (currently Linux only), so
+        // that all the code in a region only needs one iTLB entry; this
+        // uses explicit huge pages if any are available, otherwise it
+        // asks for transparent ones for the (still dual-mapped) memory,
+        // use getStats() to see if we got any
+        CodeHeap(unsigned regionSize = 1<<20, bool hugePages = false)
+            : regionSize(regionSize), hugePages(hugePages) {}
+        ~CodeHeap();
+
+        // process-wide heap, never destroyed
+        static CodeHeap & shared();
+
+        // defer flushing the instruction cache for modules that this thread
+        // loads or patches into the heap until the matching endBatch(), so
+        // loading a bunch of modules only has to flush once; calls can nest
+        // and modules loaded during the batch must not be called until after
+        // the outermost endBatch(), but batches on other threads (and the
+        // modules they load) don't affect each other
+        void beginBatch();
+        void endBatch();
+
+        struct Stats
+        {
+            size_t      reserved;       // bytes reserved from the system
+            size_t      used;           // bytes given to modules
+
+            unsigned    nRegions;
+            unsigned    nHugeAsked;     // CodeHeap(hugePages) regions
+            unsigned    nHugeRegions;   // actually backed by huge pages
+
+            // pages with code in them, ie. the number of iTLB entries
+            // needed to cover all the code loaded into the heap, counting
+            // 4k pages in regions not (yet) backed by huge pages
+            unsigned    nPages;
+        };
+        Stats getStats();
+
+    private:
+        friend struct Module;
+
+        std::mutex                      mutex;
+        std::vector<impl::CodeRegion*>  regions;
+        unsigned                        regionSize;
+        bool                            hugePages;
+        std::atomic<bool>               noDualMap { false };
+
+        // returns executable address and the address to write to in wmem
+        // if near is not null, then try to allocate close to it
+        uint8_t * alloc(size_t size, uint8_t *& wmem, uint8_t * near = 0);
+        impl::CodeRegion * newRegion(size_t size);
+        void free(uint8_t * mem, size_t size);
+
+        // bracket writes to memory allocated from the heap
+        void beginWrite(uint8_t * mem);
+        void endWrite(uint8_t * mem, size_t size);
+
+        impl::CodeRegion * findRegion(uint8_t * mem);
+    };
+
     // This will eventually become a proper module linking class.
     // For now it handles loading code into executable memory.
     //
@@ -711,7 +1142,9 @@ namespace bjit
     // if the module is temporarily unloaded.
     struct Module
     {
-        ~Module() { if(exec_mem) unload(); }
+        // waits for compileAsync() already being compiled, drops the rest
+        // and unloads
+        ~Module();
 
         // load compiled procedures into executable memory
         //
@@ -722,7 +1155,25 @@ namespace bjit
         //
         // load() always allocates enough executable memory to load
         // the module, but always at least mmapSizeMin bytes, see patch()
-        uintptr_t load(unsigned mmapSizeMin = 0);
+        //
+        // if dualMap is true, then the memory is mapped twice, once as
+        // read+execute and once as read+write, so patch() can write to
+        // the module without ever making it non-executable; if this
+        // isn't supported on the platform, then load() returns zero
+        uintptr_t load(unsigned mmapSizeMin = 0, bool dualMap = false);
+
+        // load compiled procedures into a chunk of a shared CodeHeap
+        //
+        // this works like load() otherwise, including the mmapSizeMin
+        // to leave space for patch(), and unload() returns the chunk back
+        // to the heap, which must outlive the module
+        //
+        // if near is another module loaded into the same heap, then try
+        // to place this module right after it (eg. if they call each other)
+        //
+        // if the heap can't dual-map its memory, this is the same as load()
+        uintptr_t load(CodeHeap & heap, unsigned mmapSizeMin = 0,
+            const Module * near = 0);
 
         // attempt to patch changes to a currently loaded module
         //
@@ -737,6 +1188,13 @@ namespace bjit
         // suspended stack-frames (callers or another thread) is fine
         // as patch() will never attempt to move the module
         //
+        // if the module was loaded with dualMap, then patch() writes
+        // through the read+write view and never changes memory access,
+        // so other threads can keep running code in the module and since
+        // stub targets and near calls are updated with aligned atomic
+        // stores, threads calling through them see either the old or
+        // the new target, but never a mix of both
+        //
         // if the function fails because the module cannot be patched,
         // then patch will not adjust the executable memory in any way
         // (ie. if code doesn't fit, it won't touch stubs either)
@@ -836,20 +1294,173 @@ namespace bjit
             auto & procReloc = proc.getReloc();
             relocs.insert(relocs.end(), procReloc.begin(), procReloc.end());
 
+            auto & procUnwind = proc.getUnwind();
+            unwind.insert(unwind.end(), procUnwind.begin(), procUnwind.end());
+
             return index;
         }
 
+        // like compile(), but if a proc with the same Proc::hash() has
+        // already been compiled with compileDedupe() into this module, then
+        // returns the index of that one instead, without compiling anything
+        //
+        // returns Proc index
+        // levelOpt: 0:DCE, 1:all-safe, 2:all, see Proc::compile
+        int compileDedupe(Proc & proc, unsigned levelOpt = 2);
+
+        struct DedupeStats
+        {
+            unsigned    nHits = 0;
+            unsigned    nMisses = 0;
+        };
+
+        // hits and misses for compileDedupe()
+        const DedupeStats & getDedupeStats() const { return dedupeStats; }
+
+        // compile a batch of procs in parallel, returns the index
+        // of the first proc and the rest follow in the same order
+        //
+        // procs are compiled into separate buffers on nThreads threads
+        // (0 for one per core) and then appended in order, so the result
+        // does not depend on the number of threads and matches compiling
+        // the procs one at a time with compile() except for padding
+        //
+        // levelOpt: 0:DCE, 1:all-safe, 2:all, see Proc::compile
+        int compileBatch(Proc * const * procs, unsigned nProcs,
+            unsigned levelOpt = 2, unsigned nThreads = 0);
+
+        // compile a proc on a background thread
+        //
+        // returns the index of a stub that initially jumps to fallback,
+        // which is patched to jump to the compiled proc once it has been
+        // installed by updateAsync() and it keeps doing so after any
+        // unload()+load() so the stub index is safe to use forever
+        //
+        // the proc must not be touched (or destroyed) until installed
+        //
+        // levelOpt: 0:DCE, 1:all-safe, 2:all, see Proc::compile
+        int compileAsync(Proc & proc, uintptr_t fallback, unsigned levelOpt = 2);
+
+        // install procs from compileAsync() that have finished compiling
+        // or if wait is true, then wait for all of them to finish first
+        //
+        // this adds the new code to the module, redirects the stubs and
+        // near calls to the stubs, but like with patchStub() and friends
+        // you will also need to either patch() or unload()+load() the
+        // module for the changes to become active
+        //
+        // returns the number of procs installed
+        unsigned updateAsync(bool wait = false);
+
+        // returns the number of procs from compileAsync() not yet installed
+        unsigned pendingAsync() { return asyncJobs.size(); }
+
+        // number of threads for compileAsync() and compileTiered(), where
+        // 0 means one per core; procs wait in a queue until a thread is free
+        //
+        // the threads are started the first time they are needed, after
+        // which changing this does nothing
+        void setAsyncThreads(unsigned nThreads) { asyncThreads = nThreads; }
+
+        // compile a proc for tiered execution, returns the index of a stub
+        // that jumps to a quick levelOpt 0 version of the proc, which counts
+        // the calls to it in the prologue (see Proc::setEntryCounter())
+        //
+        // once a proc has been called setTierThreshold() times, updateTiered()
+        // recompiles it at levelOpt 2 on a background thread, then redirects
+        // the stub (and near calls to it) like updateAsync(), so use the stub
+        // index for getPointer() and near calls as with compileAsync()
+        //
+        // the IR is recorded (see Proc::record()), so the proc can be reused
+        // right away; only calls are counted, so procs that run a long loop
+        // but are rarely called will stay at levelOpt 0
+        //
+        // the counters are owned by the module and their addresses are in
+        // the code, so saveCache() can't be used with tiered procs
+        int compileTiered(Proc & proc);
+
+        // start recompiling procs from compileTiered() that have been called
+        // often enough and install those that are done, or if wait is true
+        // then wait for all of them (and any compileAsync()) to finish first
+        //
+        // same as updateAsync() you also need to patch() or unload()+load()
+        //
+        // returns the number of procs installed
+        unsigned updateTiered(bool wait = false);
+
+        // calls to a proc from compileTiered() before it is recompiled
+        void setTierThreshold(uint32_t nCalls) { tierThreshold = nCalls; }
+
         // compile a stub, this counts as a procedure in terms of
         // near-indexes, but only contains a jump to an external address
         int compileStub(uintptr_t address)
         {
+            // align, so patchStub() can update the address atomically
+            while(bytes.size() & 0xf) bytes.push_back(0);
+
             int index = offsets.size();
             offsets.push_back(bytes.size());
+            stubs.push_back(index);
 
             arch_compileStub(address);
             return index;
         }
 
+        // save compiled code (and stub targets) for loadCache()
+        //
+        // the key should identify the IR that was compiled (eg. a hash
+        // of whatever the procs were generated from), so that loadCache()
+        // can tell if the cache is still valid; near patches to a loaded
+        // module are not saved until after patch() or unload()
+        //
+        // the file version returns false if it can't write the file
+        void saveCache(std::vector<uint8_t> & out, uint64_t key);
+        bool saveCache(const char * path, uint64_t key);
+
+        // called for every stub by loadCache() with the stub index and
+        // the address it had when saved, should return the new address
+        // (eg. of a host function) or zero to make loadCache() fail
+        typedef uintptr_t (*StubResolver)(
+            unsigned index, uintptr_t address, void * user);
+
+        // replace the contents of an unloaded module with code saved by
+        // saveCache(), then load() as usual, which relocates the code
+        //
+        // returns false without touching the module if the data is not
+        // valid (for this version and architecture), the key doesn't match
+        // or the resolver fails; without a resolver the stubs keep the saved
+        // addresses, which are generally only valid in the same process
+        //
+        // stubs from compileAsync() that were installed before saving
+        // point to the compiled proc again, without calling the resolver
+        bool loadCache(const uint8_t * data, size_t size, uint64_t key,
+            StubResolver resolve = 0, void * user = 0);
+        bool loadCache(const char * path, uint64_t key,
+            StubResolver resolve = 0, void * user = 0);
+
+        // report procs to the Linux perf profiler, so that samples in
+        // generated code show up with names rather than as [unknown]
+        //
+        // procs are reported when they are made executable by load() and
+        // patch() and again after unload()+load() at the new addresses;
+        // these do nothing on other platforms
+        enum PerfFlags
+        {
+            perfMap     = 1,    // append to /tmp/perf-<pid>.map
+            perfJitDump = 2,    // /tmp/jit-<pid>.dump for perf inject --jit
+        };
+        void setPerf(unsigned flags) { perfFlags = flags; }
+
+        // register DWARF unwind tables for the code with the C++ runtime
+        // (__register_frame), so that debuggers, profilers and exceptions
+        // can unwind through procs; this is done by load() and patch() and
+        // undone by unload(); does nothing on platforms without support
+        void setUnwind(bool enable) { unwindEnabled = enable; }
+
+        // name of a proc for profiling, default is bjit_<index>
+        // or bjit_stub_<index> for stubs
+        void setName(unsigned index, const char * name);
+
         const std::vector<uint8_t> & getBytes() const { return bytes; }
         
     private:
@@ -873,21 +1484,167 @@ namespace bjit
         std::vector<PatchNear>  nearPatches;
         
         std::vector<NearReloc>  relocs;
+
+        // stubs from compileAsync() that have been installed
+        struct StubForward
+        {
+            unsigned    stubIndex;
+            unsigned    procIndex;
+        };
+        std::vector<StubForward>    stubForwards;
+
+        // procs from compileDedupe() by Proc::hash(), the key is checked
+        // too, so that hash collisions don't give us the wrong code
+        struct DedupeKey
+        {
+            uint64_t                        hash;
+            std::vector<uint64_t> const     &key;
+        };
+
+        struct DedupeProc
+        {
+            uint64_t                hash = 0;
+            unsigned                index = 0;
+            std::vector<uint64_t>   key;
+
+            static uint64_t getHash(DedupeKey const & k) { return k.hash; }
+            static uint64_t getHash(DedupeProc const & p) { return p.hash; }
+
+            bool isEqual(DedupeKey const & k) const
+            { return hash == k.hash && key == k.key; }
+            bool isEqual(DedupeProc const & p) const
+            { return hash == p.hash && key == p.key; }
+        };
+        HashTable<DedupeProc>   dedupeProcs;
+        DedupeStats             dedupeStats;
+        std::vector<uint64_t>   dedupeKey;  // reused by compileDedupe()
+
+        // procs that are stubs, for saveCache()
+        std::vector<unsigned>       stubs;
+
+        // module-perf.cpp: names from setName() and how many procs
+        // from the start have been reported since load()
+        std::vector<std::string>    names;
+        unsigned                    perfFlags = 0;
+        unsigned                    nPerfReported = 0;
+
+        void perfReport();
+
+        // module-unwind.cpp: unwind tables for setUnwind(), one for each
+        // load() or patch() that added procs, registered while loaded
+        std::vector<impl::UnwindOp> unwind;
+        std::vector<std::vector<uint8_t>>   ehFrames;
+        unsigned                    nUnwindRegistered = 0;  // procs
+        unsigned                    iUnwindRegistered = 0;  // in unwind
+        bool                        unwindEnabled = false;
+
+        void unwindRegister();
+        void unwindDeregister();
+
+        // pending compileAsync(), owned by us, see module.cpp
+        std::vector<impl::AsyncJob*>    asyncJobs;
+        impl::AsyncPool                 *asyncPool = 0;
+        unsigned                        asyncThreads = 0;
+
+        // start compiling proc for the stub at stubIndex, if ownProc
+        // then the job deletes the proc once it has been installed
+        void startAsync(Proc & proc, unsigned stubIndex,
+            unsigned levelOpt, bool ownProc);
+
+        // module-tier.cpp: procs from compileTiered(), owned by us
+        std::vector<impl::TierProc*>    tierProcs;
+        uint32_t                        tierThreshold = 1000;
+
+        void tierDestroy();
         
         std::vector<uint32_t>   offsets;
         std::vector<uint8_t>    bytes;
 
         
         void        *exec_mem = 0;
+        void        *write_mem = 0;     // read+write view with dualMap
+        CodeHeap    *heap = 0;          // if loaded into a CodeHeap
         unsigned    loadSize = 0;
         unsigned    mmapSize = 0;
 
+        // module.cpp: helpers for load()
+        void copyAndRelocate(uint8_t * mem);
+        uintptr_t loadDual();
+
+        // append code compiled into a separate buffer as a new proc
+        int appendProc(Proc & proc, std::vector<uint8_t> & code);
+
         // in arch-XX-emit.cpp
         void arch_compileStub(uintptr_t address);
 
         void arch_patchStub(void * ptr, uintptr_t address);
+        uintptr_t arch_readStub(void * ptr);
         void arch_patchNear(void * ptr, int32_t offset);
 
     };
 
+    namespace impl { struct InterpProc; struct InterpFrame; }   // interp.cpp
+
+    // Runs procs directly from the IR without compiling, for procs that
+    // only run a couple of times, or as a reference for testing compiled
+    // code.
+    //
+    // add() decodes the IR (which must not have been compiled yet) into
+    // threaded code, the proc itself is not modified and can be compiled
+    // afterwards. Indexes are given out the same way as by Module, so if
+    // procs and stubs are added in the same order as they are compiled
+    // then near calls work the same.
+    //
+    // Calls to native code (icallp, stubs) support the same arguments as
+    // procs on SysV and arm64; on Windows only integer arguments.
+    struct Interp
+    {
+        // values are passed and returned as untyped 64-bit slots
+        union Slot
+        {
+            int64_t     i64;
+            uint64_t    u64;
+            double      f64;
+            float       f32;
+        };
+
+        Interp() {}
+        ~Interp();
+
+        Interp(const Interp &) = delete;
+        Interp & operator=(const Interp &) = delete;
+
+        // returns the index of the proc or stub, see Module::compile()
+        unsigned add(Proc & proc);
+        unsigned addStub(uintptr_t address);
+
+        // run a proc with arguments in the order the proc takes them,
+        // stubs can only be called from procs
+        Slot run(unsigned index, const Slot * args = 0, unsigned nArgs = 0);
+
+        // typed wrapper for run(), eg. call<int>(0, 1, 2.5)
+        template <typename R, typename... Args>
+        R call(unsigned index, Args... args)
+        {
+            Slot slots[sizeof...(Args) + 1] = { toSlot(args)... };
+            return fromSlot(run(index, slots, sizeof...(Args)), (R*)0);
+        }
+
+    private:
+        friend struct impl::InterpFrame;
+
+        std::vector<impl::InterpProc*>  procs;
+
+        static Slot toSlot(double v) { Slot s; s.u64 = 0; s.f64 = v; return s; }
+        static Slot toSlot(float v) { Slot s; s.u64 = 0; s.f32 = v; return s; }
+        template <typename T>
+        static Slot toSlot(T v) { Slot s; s.i64 = (int64_t) v; return s; }
+
+        static double fromSlot(Slot s, double*) { return s.f64; }
+        static float fromSlot(Slot s, float*) { return s.f32; }
+        static void fromSlot(Slot s, void*) { }
+        template <typename T>
+        static T fromSlot(Slot s, T*) { return (T) s.i64; }
+    };
+
 }
\ No newline at end of file
@@ -135,10 +135,9 @@ void bjit::Proc::debug() const
             BJIT_LOG("L%d:", b);
             for(auto s : blocks[b].comeFrom) BJIT_LOG(" <L%d", s);
             BJIT_LOG("\n; IDom: L%d (nDom: %d),",
-                blocks[b].idom, (int)blocks[b].dom.size());
+                blocks[b].idom, (int)blocks[b].domDepth);
             if(blocks[b].pdom != noVal) BJIT_LOG(" PDom: L%d", blocks[b].pdom);
             else BJIT_LOG(" PDom: exit");
-            //BJIT_LOG("\n; "); for(auto s : blocks[b].dom) BJIT_LOG(" ^L%d", s);
             //BJIT_LOG("\n; "); for(auto s : blocks[b].pdom) BJIT_LOG(" L%d^", s);
 
             // print memory tag, but not for entry (always ffff and def at 0000)
@@ -146,6 +146,7 @@ namespace bjit
                 s.hash = slotFree;
                 s.item = std::move(Item());
             }
+            nUsed = 0;
         }
 
         // explicit rehash is useful in some situations
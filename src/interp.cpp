@@ -0,0 +1,754 @@
+
+// Interp decodes procs into an array of instructions that each carry
+// a pointer to their handler, which returns the next instruction to run
+// (or null to return), so the interpreter loop is just an indirect call.
+//
+// Values live in slots indexed by the SSA value (ie. the op index) and
+// phis are resolved by parallel moves on the edges that need them.
+
+#include <cmath>
+#include <cstring>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+namespace bjit
+{
+    namespace impl
+    {
+        struct InterpInsn;
+        typedef const InterpInsn * (*InterpFn)(const InterpInsn *, InterpFrame &);
+
+        struct InterpInsn
+        {
+            InterpFn    fn;
+
+            uint16_t    out;
+            uint16_t    in[3];
+
+            // jumps: targets if true/false, edges: next[0] is the target
+            // calls: first argument and the number of arguments
+            uint32_t    next[2];
+
+            union
+            {
+                int64_t     i64;
+                uint64_t    u64;
+                double      f64;
+                float       f32;
+                int32_t     imm32;  // also the offset of loads and stores
+
+                struct { uint32_t first, count; } moves;    // edges
+            };
+        };
+
+        struct InterpArg  { uint16_t slot; uint16_t type; };
+        struct InterpMove { uint16_t src, dst; };
+
+        struct InterpProc
+        {
+            uintptr_t   native = 0;     // stubs only
+
+            std::vector<InterpInsn> code;
+            std::vector<InterpArg>  args;
+            std::vector<InterpMove> moves;
+
+            unsigned    nSlots = 0;     // one for each op
+            unsigned    nTemp = 0;      // for parallel moves
+            unsigned    nArgs = 0;
+            unsigned    allocBytes = 0;
+
+            unsigned    retType = Op::_ptr;     // for tail calls
+        };
+
+        struct InterpFrame
+        {
+            Interp              &interp;
+            InterpProc          &proc;
+
+            Interp::Slot        *v;
+            const Interp::Slot  *args;
+            uint8_t             *stack;
+
+            Interp::Slot        ret;
+
+            Interp::Slot callNear(unsigned index, unsigned type,
+                const Interp::Slot * a, const uint16_t * types, unsigned n);
+        };
+    }
+}
+
+using impl::InterpInsn;
+using impl::InterpFrame;
+typedef Interp::Slot Slot;
+typedef impl::Op Op;
+
+// the most the emitters can pass in registers on any platform
+static const unsigned interpMaxArgs = 16;
+
+// calls to native code, see the comment on Interp about arguments
+#if defined(_WIN32)
+#  define BJIT_INTERP_NATIVE_ARGS   uint64_t, uint64_t, uint64_t, uint64_t
+#  define BJIT_INTERP_PASS_ARGS     x[0], x[1], x[2], x[3]
+static const unsigned interpIntRegs = 4;
+static const unsigned interpFloatRegs = 0;
+#else
+#  if defined(__aarch64__)
+#  define BJIT_INTERP_INT_ARGS  uint64_t, uint64_t, uint64_t, uint64_t, \
+                                uint64_t, uint64_t, uint64_t, uint64_t
+#  define BJIT_INTERP_PASS_INT  x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7]
+static const unsigned interpIntRegs = 8;
+#  else
+#  define BJIT_INTERP_INT_ARGS  uint64_t, uint64_t, uint64_t, \
+                                uint64_t, uint64_t, uint64_t
+#  define BJIT_INTERP_PASS_INT  x[0], x[1], x[2], x[3], x[4], x[5]
+static const unsigned interpIntRegs = 6;
+#  endif
+#  define BJIT_INTERP_NATIVE_ARGS   BJIT_INTERP_INT_ARGS, \
+        double, double, double, double, double, double, double, double
+#  define BJIT_INTERP_PASS_ARGS     BJIT_INTERP_PASS_INT, \
+        d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7]
+static const unsigned interpFloatRegs = 8;
+#endif
+
+// integer and float arguments go in separate registers in order, so pass
+// all of them to a function that takes the lot; floats are passed in the
+// low bits of a double, which is where the callee looks for them
+static Slot interp_callNative(uintptr_t fn, unsigned type,
+    const Slot * a, const uint16_t * types, unsigned n)
+{
+    uint64_t    x[8] = {};
+    double      d[8] = {};
+
+    unsigned nInt = 0, nFloat = 0;
+    for(unsigned k = 0; k < n; ++k)
+    {
+        if(types[k] == Op::_ptr)
+        {
+            BJIT_ASSERT(nInt < interpIntRegs);
+            x[nInt++] = a[k].u64;
+        }
+        else
+        {
+            BJIT_ASSERT(nFloat < interpFloatRegs);
+            Slot s = a[k];
+            if(types[k] == Op::_f32) { float f = s.f32; s.u64 = 0; s.f32 = f; }
+            d[nFloat++] = s.f64;
+        }
+    }
+    (void) d;
+
+    Slot r;
+    r.u64 = 0;
+    switch(type)
+    {
+    case Op::_f32:
+        r.f32 = ((float(*)(BJIT_INTERP_NATIVE_ARGS))fn)(BJIT_INTERP_PASS_ARGS);
+        break;
+    case Op::_f64:
+        r.f64 = ((double(*)(BJIT_INTERP_NATIVE_ARGS))fn)(BJIT_INTERP_PASS_ARGS);
+        break;
+    default:
+        r.u64 = ((uint64_t(*)(BJIT_INTERP_NATIVE_ARGS))fn)(BJIT_INTERP_PASS_ARGS);
+        break;
+    }
+    return r;
+}
+
+Slot InterpFrame::callNear(unsigned index, unsigned type,
+    const Slot * a, const uint16_t * types, unsigned n)
+{
+    BJIT_ASSERT(index < interp.procs.size());
+
+    auto & p = *interp.procs[index];
+    if(p.native) return interp_callNative(p.native, type, a, types, n);
+
+    return interp.run(index, a, n);
+}
+
+// float to integer conversions, which are undefined in C when the
+// result is out of range, so do what the hardware does
+static int64_t interp_cvt(double d)
+{
+#if defined(__aarch64__)
+    if(d != d) return 0;
+    if(d >= 9223372036854775808.0) return INT64_MAX;
+    if(d < -9223372036854775808.0) return INT64_MIN;
+#else
+    if(!(d >= -9223372036854775808.0 && d < 9223372036854775808.0))
+        return INT64_MIN;
+#endif
+    return (int64_t) d;
+}
+
+// division by zero traps on x64, so follow arm64 (which doesn't)
+static int64_t interp_idiv(int64_t a, int64_t b)
+{
+    if(!b) return 0;
+    if(b == -1) return (int64_t) (0 - (uint64_t) a);
+    return a / b;
+}
+
+static int64_t interp_imod(int64_t a, int64_t b)
+{
+    if(!b) return a;
+    if(b == -1) return 0;
+    return a % b;
+}
+
+template <typename T>
+static T interp_load(uint64_t address)
+{
+    T v;
+    memcpy(&v, (const void*) address, sizeof(T));
+    return v;
+}
+
+template <typename T>
+static void interp_store(uint64_t address, T v)
+{
+    memcpy((void*) address, &v, sizeof(T));
+}
+
+static uint64_t interp_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float interp_float(uint64_t u)
+{
+    uint32_t u32 = (uint32_t) u;
+    float f;
+    memcpy(&f, &u32, sizeof(f));
+    return f;
+}
+
+#define O   (f.v[i->out])
+#define A   (f.v[i->in[0]])
+#define B   (f.v[i->in[1]])
+#define C   (f.v[i->in[2]])
+#define I   (int64_t(i->imm32))
+#define M   (uint64_t(uint32_t(i->imm32)))   // offset of loads and stores
+
+// ops that write (at most) one value and continue to the next
+#define BJIT_INTERP_OPS(_) \
+    _(ilt, O.i64 = A.i64 < B.i64) \
+    _(ige, O.i64 = A.i64 >= B.i64) \
+    _(igt, O.i64 = A.i64 > B.i64) \
+    _(ile, O.i64 = A.i64 <= B.i64) \
+    _(ult, O.i64 = A.u64 < B.u64) \
+    _(uge, O.i64 = A.u64 >= B.u64) \
+    _(ugt, O.i64 = A.u64 > B.u64) \
+    _(ule, O.i64 = A.u64 <= B.u64) \
+    _(ieq, O.i64 = A.u64 == B.u64) \
+    _(ine, O.i64 = A.u64 != B.u64) \
+    _(deq, O.i64 = A.f64 == B.f64) \
+    _(dne, O.i64 = A.f64 != B.f64) \
+    _(dlt, O.i64 = A.f64 < B.f64) \
+    _(dge, O.i64 = A.f64 >= B.f64) \
+    _(dgt, O.i64 = A.f64 > B.f64) \
+    _(dle, O.i64 = A.f64 <= B.f64) \
+    _(flt, O.i64 = A.f32 < B.f32) \
+    _(fge, O.i64 = A.f32 >= B.f32) \
+    _(fgt, O.i64 = A.f32 > B.f32) \
+    _(fle, O.i64 = A.f32 <= B.f32) \
+    _(feq, O.i64 = A.f32 == B.f32) \
+    _(fne, O.i64 = A.f32 != B.f32) \
+    _(iltI, O.i64 = A.i64 < I) \
+    _(igeI, O.i64 = A.i64 >= I) \
+    _(igtI, O.i64 = A.i64 > I) \
+    _(ileI, O.i64 = A.i64 <= I) \
+    _(ultI, O.i64 = A.u64 < uint64_t(I)) \
+    _(ugeI, O.i64 = A.u64 >= uint64_t(I)) \
+    _(ugtI, O.i64 = A.u64 > uint64_t(I)) \
+    _(uleI, O.i64 = A.u64 <= uint64_t(I)) \
+    _(ieqI, O.i64 = A.i64 == I) \
+    _(ineI, O.i64 = A.i64 != I) \
+    _(iadd, O.u64 = A.u64 + B.u64) \
+    _(isub, O.u64 = A.u64 - B.u64) \
+    _(ineg, O.u64 = 0 - A.u64) \
+    _(imul, O.u64 = A.u64 * B.u64) \
+    _(idiv, O.i64 = interp_idiv(A.i64, B.i64)) \
+    _(imod, O.i64 = interp_imod(A.i64, B.i64)) \
+    _(udiv, O.u64 = B.u64 ? A.u64 / B.u64 : 0) \
+    _(umod, O.u64 = B.u64 ? A.u64 % B.u64 : A.u64) \
+    _(inot, O.u64 = ~A.u64) \
+    _(iand, O.u64 = A.u64 & B.u64) \
+    _(ior, O.u64 = A.u64 | B.u64) \
+    _(ixor, O.u64 = A.u64 ^ B.u64) \
+    _(ishl, O.u64 = A.u64 << (B.u64 & 63)) \
+    _(ishr, O.i64 = A.i64 >> (B.u64 & 63)) \
+    _(ushr, O.u64 = A.u64 >> (B.u64 & 63)) \
+    _(iaddI, O.u64 = A.u64 + uint64_t(I)) \
+    _(isubI, O.u64 = A.u64 - uint64_t(I)) \
+    _(imulI, O.u64 = A.u64 * uint64_t(I)) \
+    _(iandI, O.u64 = A.u64 & uint64_t(I)) \
+    _(iorI, O.u64 = A.u64 | uint64_t(I)) \
+    _(ixorI, O.u64 = A.u64 ^ uint64_t(I)) \
+    _(ishlI, O.u64 = A.u64 << (I & 63)) \
+    _(ishrI, O.i64 = A.i64 >> (I & 63)) \
+    _(ushrI, O.u64 = A.u64 >> (I & 63)) \
+    _(dadd, O.f64 = A.f64 + B.f64) \
+    _(dsub, O.f64 = A.f64 - B.f64) \
+    _(dneg, O.f64 = -A.f64) \
+    _(dabs, O.f64 = std::fabs(A.f64)) \
+    _(dmul, O.f64 = A.f64 * B.f64) \
+    _(ddiv, O.f64 = A.f64 / B.f64) \
+    _(fadd, O.f32 = A.f32 + B.f32) \
+    _(fsub, O.f32 = A.f32 - B.f32) \
+    _(fneg, O.f32 = -A.f32) \
+    _(fabs, O.f32 = std::fabs(A.f32)) \
+    _(fmul, O.f32 = A.f32 * B.f32) \
+    _(fdiv, O.f32 = A.f32 / B.f32) \
+    _(ci2d, O.f64 = (double) A.i64) \
+    _(cd2i, O.i64 = interp_cvt(A.f64)) \
+    _(ci2f, O.f32 = (float) A.i64) \
+    _(cf2i, O.i64 = interp_cvt(A.f32)) \
+    _(cf2d, O.f64 = A.f32) \
+    _(cd2f, O.f32 = (float) A.f64) \
+    _(bci2d, O.u64 = A.u64) \
+    _(bcd2i, O.u64 = A.u64) \
+    _(bci2f, O.f32 = interp_float(A.u64)) \
+    _(bcf2i, O.u64 = interp_bits(A.f32)) \
+    _(lci, O.u64 = i->u64) \
+    _(lcf, O.f32 = i->f32) \
+    _(lcd, O.f64 = i->f64) \
+    _(i8, O.i64 = (int8_t) A.u64) \
+    _(i16, O.i64 = (int16_t) A.u64) \
+    _(i32, O.i64 = (int32_t) A.u64) \
+    _(u8, O.u64 = (uint8_t) A.u64) \
+    _(u16, O.u64 = (uint16_t) A.u64) \
+    _(u32, O.u64 = (uint32_t) A.u64) \
+    _(li8, O.i64 = interp_load<int8_t>(A.u64 + M)) \
+    _(li16, O.i64 = interp_load<int16_t>(A.u64 + M)) \
+    _(li32, O.i64 = interp_load<int32_t>(A.u64 + M)) \
+    _(li64, O.i64 = interp_load<int64_t>(A.u64 + M)) \
+    _(lu8, O.u64 = interp_load<uint8_t>(A.u64 + M)) \
+    _(lu16, O.u64 = interp_load<uint16_t>(A.u64 + M)) \
+    _(lu32, O.u64 = interp_load<uint32_t>(A.u64 + M)) \
+    _(lf32, O.f32 = interp_load<float>(A.u64 + M)) \
+    _(lf64, O.f64 = interp_load<double>(A.u64 + M)) \
+    _(l2i8, O.i64 = interp_load<int8_t>(A.u64 + B.u64 + M)) \
+    _(l2i16, O.i64 = interp_load<int16_t>(A.u64 + B.u64 + M)) \
+    _(l2i32, O.i64 = interp_load<int32_t>(A.u64 + B.u64 + M)) \
+    _(l2i64, O.i64 = interp_load<int64_t>(A.u64 + B.u64 + M)) \
+    _(l2u8, O.u64 = interp_load<uint8_t>(A.u64 + B.u64 + M)) \
+    _(l2u16, O.u64 = interp_load<uint16_t>(A.u64 + B.u64 + M)) \
+    _(l2u32, O.u64 = interp_load<uint32_t>(A.u64 + B.u64 + M)) \
+    _(l2f32, O.f32 = interp_load<float>(A.u64 + B.u64 + M)) \
+    _(l2f64, O.f64 = interp_load<double>(A.u64 + B.u64 + M)) \
+    _(si8, interp_store<int8_t>(B.u64 + M, (int8_t) A.u64)) \
+    _(si16, interp_store<int16_t>(B.u64 + M, (int16_t) A.u64)) \
+    _(si32, interp_store<int32_t>(B.u64 + M, (int32_t) A.u64)) \
+    _(si64, interp_store<int64_t>(B.u64 + M, A.i64)) \
+    _(sf32, interp_store<float>(B.u64 + M, A.f32)) \
+    _(sf64, interp_store<double>(B.u64 + M, A.f64)) \
+    _(s2i8, interp_store<int8_t>(B.u64 + C.u64 + M, (int8_t) A.u64)) \
+    _(s2i16, interp_store<int16_t>(B.u64 + C.u64 + M, (int16_t) A.u64)) \
+    _(s2i32, interp_store<int32_t>(B.u64 + C.u64 + M, (int32_t) A.u64)) \
+    _(s2i64, interp_store<int64_t>(B.u64 + C.u64 + M, A.i64)) \
+    _(s2f32, interp_store<float>(B.u64 + C.u64 + M, A.f32)) \
+    _(s2f64, interp_store<double>(B.u64 + C.u64 + M, A.f64)) \
+    _(iarg, O = f.args[i->imm32]) \
+    _(farg, O = f.args[i->imm32]) \
+    _(darg, O = f.args[i->imm32]) \
+    _(alloc, O.u64 = (uintptr_t) f.stack) \
+    _(fence, (void) 0)
+
+// conditional jumps, to next[0] if true
+#define BJIT_INTERP_JUMPS(_) \
+    _(jilt, A.i64 < B.i64) \
+    _(jige, A.i64 >= B.i64) \
+    _(jigt, A.i64 > B.i64) \
+    _(jile, A.i64 <= B.i64) \
+    _(jult, A.u64 < B.u64) \
+    _(juge, A.u64 >= B.u64) \
+    _(jugt, A.u64 > B.u64) \
+    _(jule, A.u64 <= B.u64) \
+    _(jieq, A.u64 == B.u64) \
+    _(jine, A.u64 != B.u64) \
+    _(jdeq, A.f64 == B.f64) \
+    _(jdne, A.f64 != B.f64) \
+    _(jdlt, A.f64 < B.f64) \
+    _(jdge, A.f64 >= B.f64) \
+    _(jdgt, A.f64 > B.f64) \
+    _(jdle, A.f64 <= B.f64) \
+    _(jflt, A.f32 < B.f32) \
+    _(jfge, A.f32 >= B.f32) \
+    _(jfgt, A.f32 > B.f32) \
+    _(jfle, A.f32 <= B.f32) \
+    _(jfeq, A.f32 == B.f32) \
+    _(jfne, A.f32 != B.f32) \
+    _(jz, !A.u64) \
+    _(jnz, !!A.u64) \
+    _(jiltI, A.i64 < I) \
+    _(jigeI, A.i64 >= I) \
+    _(jigtI, A.i64 > I) \
+    _(jileI, A.i64 <= I) \
+    _(jultI, A.u64 < uint64_t(I)) \
+    _(jugeI, A.u64 >= uint64_t(I)) \
+    _(jugtI, A.u64 > uint64_t(I)) \
+    _(juleI, A.u64 <= uint64_t(I)) \
+    _(jieqI, A.i64 == I) \
+    _(jineI, A.i64 != I)
+
+#define BJIT_INTERP_OP(name, expr) \
+    static const InterpInsn * interp_##name( \
+        const InterpInsn * i, InterpFrame & f) { expr; return i + 1; }
+
+#define BJIT_INTERP_JUMP(name, cond) \
+    static const InterpInsn * interp_##name( \
+        const InterpInsn * i, InterpFrame & f) \
+    { return f.proc.code.data() + i->next[(cond) ? 0 : 1]; }
+
+BJIT_INTERP_OPS(BJIT_INTERP_OP)
+BJIT_INTERP_JUMPS(BJIT_INTERP_JUMP)
+
+static const InterpInsn * interp_iret(const InterpInsn * i, InterpFrame & f)
+{ f.ret = A; return 0; }
+
+static const InterpInsn * interp_iretI(const InterpInsn * i, InterpFrame & f)
+{ f.ret.i64 = I; return 0; }
+
+// jmp or a conditional jump that needs to resolve phis on the way
+static const InterpInsn * interp_edge(const InterpInsn * i, InterpFrame & f)
+{
+    auto * m = f.proc.moves.data() + i->moves.first;
+    auto * t = f.v + f.proc.nSlots;
+
+    unsigned n = i->moves.count;
+    for(unsigned k = 0; k < n; ++k) t[k] = f.v[m[k].src];
+    for(unsigned k = 0; k < n; ++k) f.v[m[k].dst] = t[k];
+
+    return f.proc.code.data() + i->next[0];
+}
+
+// collect arguments for a call, returns the count
+static unsigned interp_args(const InterpInsn * i, InterpFrame & f,
+    Slot * a, uint16_t * types)
+{
+    auto * arg = f.proc.args.data() + i->next[0];
+    unsigned n = i->next[1];
+    for(unsigned k = 0; k < n; ++k)
+    {
+        a[k] = f.v[arg[k].slot];
+        types[k] = arg[k].type;
+    }
+    return n;
+}
+
+template <unsigned type>
+static const InterpInsn * interp_callp(const InterpInsn * i, InterpFrame & f)
+{
+    Slot        a[interpMaxArgs];
+    uint16_t    types[interpMaxArgs];
+    unsigned    n = interp_args(i, f, a, types);
+
+    O = interp_callNative(A.u64, type, a, types, n);
+    return i + 1;
+}
+
+template <unsigned type>
+static const InterpInsn * interp_calln(const InterpInsn * i, InterpFrame & f)
+{
+    Slot        a[interpMaxArgs];
+    uint16_t    types[interpMaxArgs];
+    unsigned    n = interp_args(i, f, a, types);
+
+    O = f.callNear(i->imm32, type, a, types, n);
+    return i + 1;
+}
+
+static const InterpInsn * interp_tcallp(const InterpInsn * i, InterpFrame & f)
+{
+    Slot        a[interpMaxArgs];
+    uint16_t    types[interpMaxArgs];
+    unsigned    n = interp_args(i, f, a, types);
+
+    f.ret = interp_callNative(A.u64, f.proc.retType, a, types, n);
+    return 0;
+}
+
+static const InterpInsn * interp_tcalln(const InterpInsn * i, InterpFrame & f)
+{
+    Slot        a[interpMaxArgs];
+    uint16_t    types[interpMaxArgs];
+    unsigned    n = interp_args(i, f, a, types);
+
+    f.ret = f.callNear(i->imm32, f.proc.retType, a, types, n);
+    return 0;
+}
+
+#undef O
+#undef A
+#undef B
+#undef C
+#undef I
+#undef M
+
+Interp::~Interp()
+{
+    for(auto * p : procs) delete p;
+}
+
+unsigned Interp::addStub(uintptr_t address)
+{
+    auto * p = new impl::InterpProc;
+    p->native = address;
+    procs.push_back(p);
+    return procs.size() - 1;
+}
+
+unsigned Interp::add(Proc & proc)
+{
+    // we need the original SSA form, with phis in place
+    BJIT_ASSERT(!proc.raDone);
+
+    auto * p = new impl::InterpProc;
+    auto & code = p->code;
+
+    auto & ops = proc.ops;
+    auto & blocks = proc.blocks;
+
+    p->nSlots = ops.size();
+    p->nArgs = proc.nArgsTotal;
+
+    const uint32_t noPos = ~uint32_t(0);
+    std::vector<uint32_t>   blockPos(blocks.size(), noPos);
+    std::vector<uint16_t>   order;
+    std::vector<bool>       queued(blocks.size(), false);
+
+    // jump targets to patch once we know where the blocks start
+    struct Fixup { uint32_t insn; uint16_t k; uint16_t block; };
+    std::vector<Fixup>      fixups;
+
+    auto queue = [&](uint16_t b)
+    {
+        BJIT_ASSERT(b < blocks.size());
+        if(queued[b]) return;
+        queued[b] = true;
+        order.push_back(b);
+    };
+
+    auto newInsn = [&](impl::InterpFn fn, uint16_t out) -> uint32_t
+    {
+        InterpInsn insn;
+        memset(&insn, 0, sizeof(insn));
+        insn.fn = fn;
+        insn.out = out;
+        code.push_back(insn);
+        return code.size() - 1;
+    };
+
+    // collect the moves for phis in 'to' when coming from 'from'
+    auto edgeMoves = [&](uint16_t from, uint16_t to, InterpInsn & insn)
+    {
+        insn.moves.first = p->moves.size();
+        for(auto & a : blocks[to].alts)
+        {
+            if(a.src != from) continue;
+            p->moves.push_back(impl::InterpMove{a.val, a.phi});
+        }
+        insn.moves.count = p->moves.size() - insn.moves.first;
+        if(p->nTemp < insn.moves.count) p->nTemp = insn.moves.count;
+
+        queue(to);
+    };
+
+    std::vector<impl::InterpArg>    pending;    // arguments for next call
+
+    queue(0);
+    for(unsigned iOrder = 0; iOrder < order.size(); ++iOrder)
+    {
+        auto b = order[iOrder];
+        blockPos[b] = code.size();
+        pending.clear();
+
+        bool done = false;
+        for(auto c : blocks[b].code)
+        {
+            if(c == noVal) continue;
+
+            auto & op = ops[c];
+
+            // generic ops
+            impl::InterpFn fn = 0;
+            switch(op.opcode)
+            {
+#define BJIT_INTERP_CASE(name, expr) case ops::name: fn = interp_##name; break;
+                BJIT_INTERP_OPS(BJIT_INTERP_CASE)
+#undef BJIT_INTERP_CASE
+            default: break;
+            }
+
+            if(fn)
+            {
+                auto & insn = code[newInsn(fn, c)];
+                for(int k = 0; k < op.nInputs(); ++k) insn.in[k] = op.in[k];
+
+                if(op.hasI64() || op.hasF64()) insn.u64 = op.u64;
+                else if(op.hasF32()) insn.f32 = op.f32;
+                else if(op.hasImm32()) insn.imm32 = op.imm32;
+                else if(op.hasMem()) insn.imm32 = op.off16;
+                else if(op.opcode == ops::iarg || op.opcode == ops::farg
+                || op.opcode == ops::darg) insn.imm32 = op.indexTotal;
+                continue;
+            }
+
+            // conditional jumps
+            switch(op.opcode)
+            {
+#define BJIT_INTERP_CASE(name, cond) case ops::name: fn = interp_##name; break;
+                BJIT_INTERP_JUMPS(BJIT_INTERP_CASE)
+#undef BJIT_INTERP_CASE
+            default: break;
+            }
+
+            if(fn)
+            {
+                auto j = newInsn(fn, noVal);
+                for(int k = 0; k < op.nInputs(); ++k) code[j].in[k] = op.in[k];
+                if(op.hasImm32()) code[j].imm32 = op.imm32;
+
+                // jump directly unless we need to resolve phis
+                for(int k = 0; k < 2; ++k)
+                {
+                    InterpInsn edge;
+                    edgeMoves(b, op.label[k], edge);
+                    if(!edge.moves.count)
+                    {
+                        fixups.push_back(Fixup{j, (uint16_t) k, op.label[k]});
+                        continue;
+                    }
+
+                    auto e = newInsn(interp_edge, noVal);
+                    code[e].moves = edge.moves;
+                    code[j].next[k] = e;
+                    fixups.push_back(Fixup{e, 0, op.label[k]});
+                }
+
+                done = true;
+                break;
+            }
+
+            switch(op.opcode)
+            {
+            case ops::phi: break;   // resolved on edges
+            case ops::nop: break;
+
+            case ops::ipass: case ops::fpass: case ops::dpass:
+                if(pending.size() <= op.indexTotal)
+                    pending.resize(op.indexTotal + 1);
+                pending[op.indexTotal] = impl::InterpArg{op.in[0], op.flags.type};
+                break;
+
+            case ops::icallp: fn = interp_callp<Op::_ptr>; break;
+            case ops::fcallp: fn = interp_callp<Op::_f32>; break;
+            case ops::dcallp: fn = interp_callp<Op::_f64>; break;
+            case ops::icalln: fn = interp_calln<Op::_ptr>; break;
+            case ops::fcalln: fn = interp_calln<Op::_f32>; break;
+            case ops::dcalln: fn = interp_calln<Op::_f64>; break;
+            case ops::tcallp: fn = interp_tcallp; break;
+            case ops::tcalln: fn = interp_tcalln; break;
+
+            case ops::jmp:
+                {
+                    auto e = newInsn(interp_edge, noVal);
+                    edgeMoves(b, op.label[0], code[e]);
+                    fixups.push_back(Fixup{e, 0, op.label[0]});
+                    done = true;
+                }
+                break;
+
+            case ops::iret: case ops::fret: case ops::dret:
+                code[newInsn(interp_iret, noVal)].in[0] = op.in[0];
+                done = true;
+                break;
+
+            case ops::iretI:
+                code[newInsn(interp_iretI, noVal)].imm32 = op.imm32;
+                done = true;
+                break;
+
+            default:
+                BJIT_TRACE(opt, error, "interp: can't run %s", op.strOpcode());
+                BJIT_ASSERT(false);
+            }
+
+            if(fn)
+            {
+                BJIT_ASSERT(pending.size() <= interpMaxArgs);
+
+                auto & insn = code[newInsn(fn, c)];
+                if(op.nInputs()) insn.in[0] = op.in[0];
+                if(op.hasImm32()) insn.imm32 = op.imm32;
+                insn.next[0] = p->args.size();
+                insn.next[1] = pending.size();
+                p->args.insert(p->args.end(), pending.begin(), pending.end());
+                pending.clear();
+
+                if(op.opcode == ops::tcallp || op.opcode == ops::tcalln)
+                    done = true;
+            }
+
+            if(done) break;
+        }
+
+        // front-ends must end every block with a jump or a return
+        BJIT_ASSERT(done);
+    }
+
+    for(auto & fix : fixups)
+    {
+        BJIT_ASSERT(blockPos[fix.block] != noPos);
+        code[fix.insn].next[fix.k] = blockPos[fix.block];
+    }
+
+    // tail calls return whatever the proc normally returns
+    for(auto b : order)
+    for(auto c : blocks[b].code)
+    {
+        if(c == noVal) continue;
+        switch(ops[c].opcode)
+        {
+        case ops::fret: p->retType = Op::_f32; break;
+        case ops::dret: p->retType = Op::_f64; break;
+        }
+    }
+
+    p->allocBytes = (ops[0].imm32 + 0xf) & ~0xf;
+
+    procs.push_back(p);
+    return procs.size() - 1;
+}
+
+Slot Interp::run(unsigned index, const Slot * args, unsigned nArgs)
+{
+    BJIT_ASSERT(index < procs.size());
+
+    auto & p = *procs[index];
+    BJIT_ASSERT(!p.native);     // stubs can only be called from procs
+    BJIT_ASSERT(nArgs >= p.nArgs);
+
+    // the stack block goes first, so it's aligned like native code
+    unsigned nAlloc = p.allocBytes / sizeof(Slot);
+    unsigned nTotal = nAlloc + p.nSlots + p.nTemp + 1;
+
+    Slot        local[128];
+    std::vector<Slot>   heap;
+
+    Slot * mem = local;
+    if(nTotal > 128) { heap.resize(nTotal); mem = heap.data(); }
+    if((uintptr_t) mem & 0xf) ++mem;
+
+    InterpFrame f = { *this, p, mem + nAlloc, args, (uint8_t*) mem, Slot() };
+    f.ret.u64 = 0;
+
+    const InterpInsn * pc = p.code.data();
+    while(pc) pc = pc->fn(pc, f);
+
+    return f.ret;
+}
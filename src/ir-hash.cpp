@@ -0,0 +1,141 @@
+
+#include <algorithm>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+// This walks the reachable blocks breadth-first from the entry and numbers
+// blocks and live ops in that order, so that the hash only depends on the
+// structure of the IR and not on the order it was built in.
+uint64_t Proc::hash(unsigned levelOpt, std::vector<uint64_t> * key)
+{
+    auto & order = scratch.hashOrder;
+    auto & blockPos = scratch.hashBlockPos;
+    auto & opPos = scratch.hashOpPos;
+
+    order.clear();
+    blockPos.assign(blocks.size(), noVal);
+    opPos.assign(ops.size(), noVal);
+
+    order.push_back(0);
+    blockPos[0] = 0;
+    for(int i = 0; i < order.size(); ++i)
+    {
+        for(auto op : blocks[order[i]].code)
+        {
+            if(op == noVal || ops[op].opcode > ops::jmp) continue;
+
+            for(int k = 0; k < 2; ++k)
+            {
+                if(k && ops[op].opcode == ops::jmp) break;
+
+                auto target = ops[op].label[k];
+                if(blockPos[target] != noVal) continue;
+
+                blockPos[target] = order.size();
+                order.push_back(target);
+            }
+            break;
+        }
+    }
+
+    // live ops are those with side-effects and everything they need,
+    // mark with zero for now and number them in order afterwards
+    todo.clear();
+    for(auto b : order)
+    {
+        for(auto op : blocks[b].code)
+        {
+            if(op != noVal && ops[op].hasSideFX()) todo.push_back(op);
+        }
+    }
+
+    while(todo.size())
+    {
+        auto op = todo.back(); todo.pop_back();
+        if(opPos[op] != noVal) continue;
+        opPos[op] = 0;
+
+        for(int i = 0; i < ops[op].nInputs(); ++i) todo.push_back(ops[op].in[i]);
+
+        if(ops[op].opcode != ops::phi) continue;
+
+        for(auto & a : blocks[ops[op].block].alts)
+        {
+            if(a.phi == op && blockPos[a.src] != noVal) todo.push_back(a.val);
+        }
+    }
+
+    uint16_t nLive = 0;
+    for(auto b : order)
+    {
+        for(auto op : blocks[b].code)
+        {
+            if(op != noVal && opPos[op] != noVal) opPos[op] = nLive++;
+        }
+    }
+
+    // the key is everything that goes into the hash, in the same order
+    if(key) key->assign(1, levelOpt);
+
+    uint64_t x = hash64(levelOpt);
+    auto mix = [&](uint64_t v)
+    {
+        x = hash64(x ^ v);
+        if(key) key->push_back(v);
+    };
+
+    // setFramePointer() and setEntryCounter() change the code, only mix
+    // them in when set so that hashes of the default mode stay the same
+    if(framePointer) mix(~uint64_t(0));
+    if(entryCounter) mix((uintptr_t) entryCounter);
+
+    auto & alts = scratch.hashAlts;
+    for(auto b : order)
+    {
+        mix(noVal);
+
+        for(auto op : blocks[b].code)
+        {
+            if(op == noVal || opPos[op] == noVal) continue;
+
+            auto & o = ops[op];
+            mix(o.opcode | (uint64_t(o.flags.type) << 16));
+
+            for(int i = 0; i < o.nInputs(); ++i) mix(opPos[o.in[i]]);
+
+            if(o.hasI64() || o.hasF64()) mix(o.u64);
+            if(o.hasImm32() || o.hasF32()) mix(uint32_t(o.imm32));
+            if(o.hasMem()) mix(o.off16);
+
+            switch(o.opcode)
+            {
+            case ops::iarg: case ops::farg: case ops::darg:
+            case ops::ipass: case ops::fpass: case ops::dpass:
+                mix(o.indexType | (uint64_t(o.indexTotal) << 16));
+                break;
+            }
+
+            if(o.opcode <= ops::jmp)
+            {
+                mix(blockPos[o.label[0]]);
+                if(o.opcode != ops::jmp) mix(blockPos[o.label[1]]);
+            }
+        }
+
+        // phi sources are added as jumps are emitted, so sort them
+        alts.clear();
+        for(auto & a : blocks[b].alts)
+        {
+            if(opPos[a.phi] == noVal || blockPos[a.src] == noVal) continue;
+
+            alts.push_back(opPos[a.phi] | (uint64_t(blockPos[a.src]) << 16)
+                | (uint64_t(opPos[a.val]) << 32));
+        }
+        std::sort(alts.begin(), alts.end());
+        for(auto a : alts) mix(a);
+    }
+
+    return x;
+}
@@ -0,0 +1,232 @@
+
+#include <cstring>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+// Binary dump of the IR for Proc::record() and Proc::replay(), in host
+// byte order since we only care about replaying on the same kind of host.
+//
+// bump this whenever the format or the meaning of the IR changes
+static const uint32_t recordVersion = 2;
+
+static const uint32_t recordMagic = 0x7269626a;     // "bjir"
+
+// settings that change the generated code, see Proc::record()
+enum
+{
+    recordFramePointer  = 1,
+    recordOptSparse     = 2
+};
+
+namespace
+{
+    struct RecordWriter
+    {
+        std::vector<uint8_t> & out;
+
+        template <typename T>
+        void put(T v)
+        {
+            auto ptr = (const uint8_t*) &v;
+            out.insert(out.end(), ptr, ptr + sizeof(T));
+        }
+    };
+
+    struct RecordReader
+    {
+        const uint8_t   *ptr;
+        const uint8_t   *end;
+        bool            ok;
+
+        template <typename T>
+        T get()
+        {
+            T v = T();
+            if(end - ptr < (ptrdiff_t) sizeof(T)) { ok = false; return v; }
+            memcpy(&v, ptr, sizeof(T));
+            ptr += sizeof(T);
+            return v;
+        }
+    };
+}
+
+void Proc::record(std::vector<uint8_t> & out)
+{
+    BJIT_ASSERT(!raDone);
+
+    size_t start = out.size();
+    RecordWriter w { out };
+
+    w.put<uint32_t>(0);     // size, patched below
+    w.put<uint32_t>(recordMagic);
+    w.put<uint32_t>(recordVersion);
+
+    w.put<uint16_t>(ops.size());
+    w.put<uint16_t>(blocks.size());
+    w.put<uint16_t>(env.size());
+    w.put<uint16_t>(currentBlock);
+
+    w.put<uint8_t>(nArgsInt);
+    w.put<uint8_t>(nArgsFloat);
+    w.put<uint8_t>(nArgsTotal);
+
+    w.put<uint8_t>((framePointer ? recordFramePointer : 0)
+        | (optSparse ? recordOptSparse : 0));
+
+    for(int i = 0; i < ops.size(); ++i)
+    {
+        auto & op = ops[i];
+        w.put<uint64_t>(op.u64);
+        w.put<uint16_t>(op.label[0]);
+        w.put<uint16_t>(op.label[1]);
+        w.put<uint16_t>(op.block);
+        w.put<uint16_t>(op.opcode);
+        w.put<uint8_t>(op.flags.type | (op.flags.no_opt << 4));
+    }
+
+    for(auto & b : blocks)
+    {
+        w.put<uint8_t>(b.flags.live);
+
+        w.put<uint16_t>(b.code.size());
+        for(auto c : b.code) w.put<uint16_t>(c);
+
+        w.put<uint16_t>(b.args.size());
+        for(auto & a : b.args) w.put<uint16_t>(a.phiop);
+
+        w.put<uint16_t>(b.alts.size());
+        for(auto & a : b.alts)
+        {
+            w.put<uint16_t>(a.phi);
+            w.put<uint16_t>(a.src);
+            w.put<uint16_t>(a.val);
+        }
+    }
+
+    for(auto & e : env) w.put<uint16_t>(e.index);
+
+    uint32_t size = out.size() - start;
+    memcpy(out.data() + start, &size, sizeof(size));
+}
+
+bool Proc::replay(const uint8_t * data, size_t size)
+{
+    RecordReader r { data, data + size, true };
+
+    if(r.get<uint32_t>() != size
+    || r.get<uint32_t>() != recordMagic
+    || r.get<uint32_t>() != recordVersion) r.ok = false;
+
+    unsigned nOps = r.get<uint16_t>();
+    unsigned nBlocks = r.get<uint16_t>();
+    unsigned nEnv = r.get<uint16_t>();
+    unsigned block = r.get<uint16_t>();
+
+    unsigned argsInt = r.get<uint8_t>();
+    unsigned argsFloat = r.get<uint8_t>();
+    unsigned argsTotal = r.get<uint8_t>();
+
+    unsigned settings = r.get<uint8_t>();
+    if(settings & ~unsigned(recordFramePointer | recordOptSparse)) r.ok = false;
+
+    clear();
+
+    if(!r.ok || !nBlocks || block >= nBlocks) r.ok = false;
+
+    nArgsInt = argsInt;
+    nArgsFloat = argsFloat;
+    nArgsTotal = argsTotal;
+
+    if(r.ok)
+    {
+        framePointer = settings & recordFramePointer;
+        optSparse = settings & recordOptSparse;
+    }
+    currentBlock = block;
+
+    // validate as we go, so nothing will index out of bounds later
+    auto okVal = [&](unsigned v) { return v < nOps; };
+    auto okBlock = [&](unsigned b) { return b < nBlocks; };
+
+    if(!r.ok) nOps = nBlocks = nEnv = 0;
+
+    ops.resize(nOps);
+    for(int i = 0; i < nOps; ++i)
+    {
+        auto & op = ops[i];
+        op.u64 = r.get<uint64_t>();
+        op.label[0] = r.get<uint16_t>();
+        op.label[1] = r.get<uint16_t>();
+        op.block = r.get<uint16_t>();
+        op.opcode = r.get<uint16_t>();
+
+        uint8_t flags = r.get<uint8_t>();
+        op.flags.type = (Op::Type) (flags & 0xf);
+        op.flags.no_opt = (flags >> 4) & 1;
+
+        if(op.opcode > ops::nop) { op.opcode = ops::nop; r.ok = false; }
+        if(!okBlock(op.block)) r.ok = false;
+        if(op.opcode == ops::nop) continue;
+
+        for(int k = 0; k < op.nInputs(); ++k)
+        {
+            if(!okVal(op.in[k])) r.ok = false;
+        }
+
+        if(op.opcode <= ops::jmp)
+        {
+            if(!okBlock(op.label[0])) r.ok = false;
+            if(op.opcode != ops::jmp && !okBlock(op.label[1])) r.ok = false;
+        }
+        else if(op.hasOutput()) op.scc = noSCC;
+    }
+
+    for(int i = 0; r.ok && i < nBlocks; ++i)
+    {
+        auto & b = blocks[newBlock()];
+        b.flags.live = r.get<uint8_t>();
+
+        for(int n = r.get<uint16_t>(); r.ok && n--;)
+        {
+            auto c = r.get<uint16_t>();
+            if(c != noVal && !okVal(c)) r.ok = false;
+            b.code.push_back(c);
+        }
+
+        for(int n = r.get<uint16_t>(); r.ok && n--;)
+        {
+            auto phi = r.get<uint16_t>();
+            if(phi != noVal && !okVal(phi)) r.ok = false;
+            b.args.push_back(phi);
+        }
+
+        for(int n = r.get<uint16_t>(); r.ok && n--;)
+        {
+            impl::PhiAlt a;
+            a.phi = r.get<uint16_t>();
+            a.src = r.get<uint16_t>();
+            a.val = r.get<uint16_t>();
+            if(!okVal(a.phi) || !okBlock(a.src) || !okVal(a.val)) r.ok = false;
+            b.alts.push_back(a);
+        }
+    }
+
+    for(int i = 0; r.ok && i < nEnv; ++i)
+    {
+        auto v = r.get<uint16_t>();
+        if(!okVal(v)) r.ok = false;
+        env.push_back(Value{v});
+    }
+
+    if(!r.ok || r.ptr != r.end)
+    {
+        // don't leave garbage around
+        clear();
+        init(0, 0);
+        return false;
+    }
+
+    return true;
+}
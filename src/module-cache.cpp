@@ -0,0 +1,262 @@
+
+// Module::saveCache() and loadCache() for keeping compiled code on disk.
+// Files are read with mmap() where available, since we copy everything
+// into the module anyway and relocation happens in load() as usual.
+#if defined(__unix__) || defined(__LINUX__) || defined(__APPLE__)
+#  define BJIT_USE_MMAP
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include <cstring>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+// bump this whenever the format or the generated code changes
+// in a way that makes previously saved code invalid
+static const uint32_t cacheVersion = 2;
+
+#if defined(__x86_64__)
+static const uint32_t cacheArch = 1;
+#elif defined(__aarch64__)
+static const uint32_t cacheArch = 2;
+#endif
+
+// followed by stubs, offsets, relocs, forwards, unwind and then the code
+struct CacheHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    arch;
+
+    uint32_t    nBytes;
+    uint32_t    nOffsets;
+    uint32_t    nRelocs;
+    uint32_t    nStubs;
+    uint32_t    nForwards;
+    uint32_t    nUnwind;
+    uint32_t    pad;
+
+    uint64_t    key;
+    uint64_t    checksum;   // of everything after the header
+};
+
+struct CacheStub
+{
+    uint32_t    index;
+    uint32_t    pad;
+    uint64_t    address;
+};
+
+template <typename T>
+static void cache_write(std::vector<uint8_t> & out, const T * data, size_t n)
+{
+    auto ptr = (const uint8_t*) data;
+    out.insert(out.end(), ptr, ptr + n * sizeof(T));
+}
+
+template <typename T>
+static void cache_read(std::vector<T> & v, const uint8_t *& data, size_t n)
+{
+    v.resize(n);
+    if(n) memcpy(v.data(), data, n * sizeof(T));
+    data += n * sizeof(T);
+}
+
+void Module::saveCache(std::vector<uint8_t> & out, uint64_t key)
+{
+    // the code has pointers to the counters of compileTiered()
+    BJIT_ASSERT(!tierProcs.size());
+
+    CacheHeader header;
+    memcpy(header.magic, "bjit", 4);
+    header.version = cacheVersion;
+    header.arch = cacheArch;
+    header.nBytes = bytes.size();
+    header.nOffsets = offsets.size();
+    header.nRelocs = relocs.size();
+    header.nStubs = stubs.size();
+    header.nForwards = stubForwards.size();
+    header.nUnwind = unwind.size();
+    header.pad = 0;
+    header.key = key;
+    header.checksum = 0;
+
+    out.clear();
+    cache_write(out, &header, 1);
+
+    for(auto & s : stubs)
+    {
+        CacheStub stub = { s, 0, arch_readStub(offsets[s] + bytes.data()) };
+        cache_write(out, &stub, 1);
+    }
+
+    cache_write(out, offsets.data(), offsets.size());
+    cache_write(out, relocs.data(), relocs.size());
+    cache_write(out, stubForwards.data(), stubForwards.size());
+    cache_write(out, unwind.data(), unwind.size());
+    cache_write(out, bytes.data(), bytes.size());
+
+    header.checksum = stringHash64(out.data() + sizeof(CacheHeader),
+        out.size() - sizeof(CacheHeader));
+    memcpy(out.data(), &header, sizeof(CacheHeader));
+}
+
+bool Module::saveCache(const char * path, uint64_t key)
+{
+    std::vector<uint8_t>    data;
+    saveCache(data, key);
+
+    FILE * f = fopen(path, "wb");
+    if(!f) return false;
+
+    bool ok = (fwrite(data.data(), 1, data.size(), f) == data.size());
+    if(fclose(f)) ok = false;
+
+    return ok;
+}
+
+bool Module::loadCache(const uint8_t * data, size_t size, uint64_t key,
+    StubResolver resolve, void * user)
+{
+    BJIT_ASSERT(!exec_mem);
+    BJIT_ASSERT(!asyncJobs.size());
+    BJIT_ASSERT(!tierProcs.size());
+
+    CacheHeader header;
+    if(size < sizeof(CacheHeader)) return false;
+    memcpy(&header, data, sizeof(CacheHeader));
+
+    if(memcmp(header.magic, "bjit", 4)
+    || header.version != cacheVersion
+    || header.arch != cacheArch
+    || header.key != key) return false;
+
+    // check that sizes add up before trusting the checksum
+    uint64_t expect = sizeof(CacheHeader)
+        + uint64_t(header.nStubs) * sizeof(CacheStub)
+        + uint64_t(header.nOffsets) * sizeof(uint32_t)
+        + uint64_t(header.nRelocs) * sizeof(NearReloc)
+        + uint64_t(header.nForwards) * sizeof(StubForward)
+        + uint64_t(header.nUnwind) * sizeof(impl::UnwindOp)
+        + header.nBytes;
+    if(expect != size) return false;
+
+    if(header.checksum != stringHash64(data + sizeof(CacheHeader),
+        size - sizeof(CacheHeader))) return false;
+
+    // read into temporaries, so we don't touch anything on failure
+    std::vector<CacheStub>      newStubs;
+    std::vector<uint32_t>       newOffsets;
+    std::vector<NearReloc>      newRelocs;
+    std::vector<StubForward>    newForwards;
+    std::vector<impl::UnwindOp> newUnwind;
+    std::vector<uint8_t>        newBytes;
+
+    const uint8_t * ptr = data + sizeof(CacheHeader);
+    cache_read(newStubs, ptr, header.nStubs);
+    cache_read(newOffsets, ptr, header.nOffsets);
+    cache_read(newRelocs, ptr, header.nRelocs);
+    cache_read(newForwards, ptr, header.nForwards);
+    cache_read(newUnwind, ptr, header.nUnwind);
+    cache_read(newBytes, ptr, header.nBytes);
+
+    // make sure nothing points out of bounds
+    for(auto & o : newOffsets)
+    {
+        if(o >= header.nBytes) return false;
+    }
+    for(auto & r : newRelocs)
+    {
+        if(r.procIndex >= header.nOffsets) return false;
+        if(uint64_t(r.codeOffset) + 4 > header.nBytes) return false;
+    }
+    for(auto & f : newForwards)
+    {
+        if(f.stubIndex >= header.nOffsets) return false;
+        if(f.procIndex >= header.nOffsets) return false;
+    }
+    for(unsigned i = 0; i < newUnwind.size(); ++i)
+    {
+        if(newUnwind[i].codeOffset > header.nBytes) return false;
+        if(i && newUnwind[i].codeOffset < newUnwind[i-1].codeOffset)
+            return false;
+    }
+    for(auto & s : newStubs)
+    {
+        if(s.index >= header.nOffsets) return false;
+        if(uint64_t(newOffsets[s.index]) + 16 > header.nBytes) return false;
+    }
+
+    // resolve stubs, forwards are done by load()
+    for(auto & s : newStubs)
+    {
+        bool forward = false;
+        for(auto & f : newForwards) if(f.stubIndex == s.index) forward = true;
+        if(forward || !resolve) continue;
+
+        uintptr_t address = resolve(s.index, s.address, user);
+        if(!address) return false;
+
+        arch_patchStub(newOffsets[s.index] + newBytes.data(), address);
+    }
+
+    stubs.clear();
+    for(auto & s : newStubs) stubs.push_back(s.index);
+
+    offsets.swap(newOffsets);
+    relocs.swap(newRelocs);
+    stubForwards.swap(newForwards);
+    unwind.swap(newUnwind);
+    bytes.swap(newBytes);
+
+    stubPatches.clear();
+    nearPatches.clear();
+
+    // these refer to procs that are now gone
+    dedupeProcs.clear();
+
+    return true;
+}
+
+bool Module::loadCache(const char * path, uint64_t key,
+    StubResolver resolve, void * user)
+{
+#ifdef BJIT_USE_MMAP
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) || !st.st_size)
+    {
+        close(fd);
+        return false;
+    }
+
+    void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return false;
+
+    bool ok = loadCache((const uint8_t*) data, st.st_size, key, resolve, user);
+    munmap(data, st.st_size);
+
+    return ok;
+#else
+    FILE * f = fopen(path, "rb");
+    if(!f) return false;
+
+    std::vector<uint8_t>    data;
+    uint8_t buf[0x1000];
+    while(size_t n = fread(buf, 1, sizeof(buf), f))
+    {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+
+    return loadCache(data.data(), data.size(), key, resolve, user);
+#endif
+}
@@ -0,0 +1,195 @@
+
+// Module::setPerf() support for the Linux perf profiler, which looks for
+// symbols of JIT code in /tmp/perf-<pid>.map and for `perf inject --jit`
+// also reads a jitdump file, which has to be mapped executable by the
+// process so that `perf record` sees it (record with `-k mono` for this).
+//
+// Both files are per process, so they are shared by all modules.
+#if defined(__linux__)
+#  define BJIT_USE_PERF
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  include <time.h>
+#  include <elf.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+void Module::setName(unsigned index, const char * name)
+{
+    if(names.size() <= index) names.resize(index + 1);
+    names[index] = name;
+}
+
+#ifdef BJIT_USE_PERF
+
+// see tools/perf/Documentation/jitdump-specification.txt in Linux
+struct JitDumpHeader
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    totalSize;
+    uint32_t    elfMach;
+    uint32_t    pad1;
+    uint32_t    pid;
+    uint64_t    timestamp;
+    uint64_t    flags;
+};
+
+struct JitDumpCodeLoad
+{
+    uint32_t    id;         // record header
+    uint32_t    totalSize;
+    uint64_t    timestamp;
+
+    uint32_t    pid;
+    uint32_t    tid;
+    uint64_t    vma;
+    uint64_t    codeAddr;
+    uint64_t    codeSize;
+    uint64_t    codeIndex;
+
+    // followed by the name with a null-terminator and then the code
+};
+
+static const uint32_t jitDumpMagic = 0x4A695444;
+static const uint32_t jitCodeLoad = 0;
+
+#if defined(__x86_64__)
+static const uint32_t jitDumpMach = EM_X86_64;
+#elif defined(__aarch64__)
+static const uint32_t jitDumpMach = EM_AARCH64;
+#endif
+
+static std::mutex   perfMutex;
+static FILE         *perfMapFile = 0;
+static FILE         *jitDumpFile = 0;
+static uint64_t     jitDumpIndex = 0;
+
+static uint64_t perf_timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// opens the files the first time, returns false if it can't
+static bool perf_open(unsigned flags)
+{
+    char path[64];
+
+    if((flags & Module::perfMap) && !perfMapFile)
+    {
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+        perfMapFile = fopen(path, "a");
+        if(!perfMapFile)
+        {
+            BJIT_TRACE(module, error, "can't open %s", path);
+            return false;
+        }
+    }
+
+    if((flags & Module::perfJitDump) && !jitDumpFile)
+    {
+        snprintf(path, sizeof(path), "/tmp/jit-%d.dump", (int) getpid());
+        jitDumpFile = fopen(path, "w+");
+        if(!jitDumpFile)
+        {
+            BJIT_TRACE(module, error, "can't open %s", path);
+            return false;
+        }
+
+        // this is how perf finds the file, the mapping is never used
+        long page = sysconf(_SC_PAGESIZE);
+        if(MAP_FAILED == mmap(NULL, page, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+            fileno(jitDumpFile), 0))
+        {
+            BJIT_TRACE(module, error, "can't map %s", path);
+        }
+
+        JitDumpHeader header;
+        header.magic = jitDumpMagic;
+        header.version = 1;
+        header.totalSize = sizeof(header);
+        header.elfMach = jitDumpMach;
+        header.pad1 = 0;
+        header.pid = getpid();
+        header.timestamp = perf_timestamp();
+        header.flags = 0;
+        fwrite(&header, sizeof(header), 1, jitDumpFile);
+    }
+
+    return true;
+}
+
+void Module::perfReport()
+{
+    if(!perfFlags) return;
+
+    std::lock_guard<std::mutex> lock(perfMutex);
+    if(!perf_open(perfFlags)) return;
+
+    std::string defaultName;
+    for(unsigned i = nPerfReported; i < offsets.size(); ++i)
+    {
+        unsigned end = (i+1 < offsets.size()) ? offsets[i+1] : bytes.size();
+        unsigned size = end - offsets[i];
+
+        const char * name = (i < names.size()) ? names[i].c_str() : "";
+        if(!*name)
+        {
+            bool isStub = false;
+            for(auto s : stubs) if(s == i) isStub = true;
+
+            char buf[32];
+            snprintf(buf, sizeof(buf), isStub ? "bjit_stub_%d" : "bjit_%d", i);
+            defaultName = buf;
+            name = defaultName.c_str();
+        }
+
+        uintptr_t addr = offsets[i] + (uintptr_t) exec_mem;
+
+        if(perfFlags & perfMap)
+        {
+            fprintf(perfMapFile, "%lx %x %s\n", (unsigned long) addr, size, name);
+        }
+
+        if(perfFlags & perfJitDump)
+        {
+            unsigned nameSize = strlen(name) + 1;
+
+            JitDumpCodeLoad rec;
+            rec.id = jitCodeLoad;
+            rec.totalSize = sizeof(rec) + nameSize + size;
+            rec.timestamp = perf_timestamp();
+            rec.pid = getpid();
+            rec.tid = syscall(SYS_gettid);
+            rec.vma = addr;
+            rec.codeAddr = addr;
+            rec.codeSize = size;
+            rec.codeIndex = jitDumpIndex++;
+
+            fwrite(&rec, sizeof(rec), 1, jitDumpFile);
+            fwrite(name, nameSize, 1, jitDumpFile);
+
+            // the loaded code, since near calls are relocated
+            fwrite((const void*) addr, size, 1, jitDumpFile);
+        }
+    }
+    nPerfReported = offsets.size();
+
+    if(perfMapFile) fflush(perfMapFile);
+    if(jitDumpFile) fflush(jitDumpFile);
+}
+
+#else
+
+void Module::perfReport() { }
+
+#endif
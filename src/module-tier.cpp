@@ -0,0 +1,79 @@
+
+// Module::compileTiered() and updateTiered() for compiling procs quickly
+// first and then again with full optimization once they turn out to be hot.
+//
+// The quick version counts calls in the prologue and sits behind a stub
+// that forwards to it, so that recompiling is the same as installing a proc
+// from compileAsync(), which redirects the stub and near calls to it.
+
+#include "bjit.h"
+
+using namespace bjit;
+
+struct bjit::impl::TierProc
+{
+    uint32_t                counter = 0;    // by the levelOpt 0 code, load atomically
+    unsigned                stubIndex;
+    bool                    started = false;
+
+    std::vector<uint8_t>    ir;             // from Proc::record()
+};
+
+int Module::compileTiered(Proc & proc)
+{
+    auto * t = new impl::TierProc;
+    tierProcs.push_back(t);
+
+    proc.record(t->ir);
+
+    // stub first, so that it gets the index compile() would have given
+    t->stubIndex = compileStub(0);
+
+    auto oldCounter = proc.getEntryCounter();
+    proc.setEntryCounter(&t->counter);
+    unsigned procIndex = compile(proc, 0);
+    proc.setEntryCounter(oldCounter);
+
+    stubForwards.push_back(StubForward{t->stubIndex, procIndex});
+
+    // like updateAsync(), patch() or load() takes care of the rest
+    if(isLoaded())
+    {
+        patchStub(t->stubIndex, (uintptr_t)exec_mem + offsets[procIndex]);
+    }
+
+    return t->stubIndex;
+}
+
+unsigned Module::updateTiered(bool wait)
+{
+    for(auto * t : tierProcs)
+    {
+        if(t->started) continue;
+
+        // the code increments this with a plain add, an atomic load at
+        // least keeps us from racing with it (a stale count is fine)
+        uint32_t calls = __atomic_load_n(&t->counter, __ATOMIC_RELAXED);
+        if(calls < tierThreshold) continue;
+
+        auto * proc = new Proc(0, 0);
+        bool ok = proc->replay(t->ir.data(), t->ir.size());
+        BJIT_ASSERT(ok);
+
+        BJIT_TRACE(module, info, "tier: recompiling stub %u after %u calls",
+            t->stubIndex, calls);
+
+        startAsync(*proc, t->stubIndex, 2, true);
+
+        t->started = true;
+        std::vector<uint8_t>().swap(t->ir);
+    }
+
+    return updateAsync(wait);
+}
+
+void Module::tierDestroy()
+{
+    for(auto * t : tierProcs) delete t;
+    tierProcs.clear();
+}
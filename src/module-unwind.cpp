@@ -0,0 +1,242 @@
+
+// Module::setUnwind() builds .eh_frame style tables with one CIE and one
+// FDE per proc from the UnwindOps recorded by arch_emit() and registers them
+// with __register_frame() from the runtime (libgcc or libunwind); there is
+// one table for the procs from load() and one for each patch() after it.
+//
+// libgcc takes the whole (zero-terminated) table at once, while libunwind
+// (eg. macOS) wants each FDE separately.
+#if defined(__linux__) || defined(__APPLE__)
+#  define BJIT_USE_UNWIND
+#endif
+
+#include <cstring>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+#ifdef BJIT_USE_UNWIND
+
+extern "C" void __register_frame(void *);
+extern "C" void __deregister_frame(void *);
+
+#if defined(__x86_64__)
+static const unsigned   dwarfCodeAlign = 1;
+static const unsigned   dwarfRA = 16;
+static const unsigned   dwarfSP = 7;
+static const unsigned   dwarfInitCFA = 8;   // return address is on stack
+#elif defined(__aarch64__)
+static const unsigned   dwarfCodeAlign = 4;
+static const unsigned   dwarfRA = 30;
+static const unsigned   dwarfSP = 31;
+static const unsigned   dwarfInitCFA = 0;   // return address is in lr
+#endif
+
+static const int        dwarfDataAlign = -8;
+
+// the subset of DWARF call frame instructions we need
+enum
+{
+    DW_CFA_nop              = 0x00,
+    DW_CFA_advance_loc1     = 0x02,
+    DW_CFA_advance_loc2     = 0x03,
+    DW_CFA_advance_loc4     = 0x04,
+    DW_CFA_offset_extended  = 0x05,
+    DW_CFA_remember_state   = 0x0a,
+    DW_CFA_restore_state    = 0x0b,
+    DW_CFA_def_cfa          = 0x0c,
+    DW_CFA_def_cfa_offset   = 0x0e,
+    DW_CFA_advance_loc      = 0x40,
+    DW_CFA_offset           = 0x80,
+};
+
+static void dwarf_uleb(std::vector<uint8_t> & out, uint64_t v)
+{
+    do
+    {
+        uint8_t b = v & 0x7f; v >>= 7;
+        out.push_back(v ? (b | 0x80) : b);
+    } while(v);
+}
+
+static void dwarf_sleb(std::vector<uint8_t> & out, int64_t v)
+{
+    bool more = true;
+    while(more)
+    {
+        uint8_t b = v & 0x7f; v >>= 7;
+        more = !((v == 0 && !(b & 0x40)) || (v == -1 && (b & 0x40)));
+        out.push_back(more ? (b | 0x80) : b);
+    }
+}
+
+template <typename T>
+static void dwarf_put(std::vector<uint8_t> & out, T v)
+{
+    auto ptr = (const uint8_t*) &v;
+    out.insert(out.end(), ptr, ptr + sizeof(T));
+}
+
+// pad an entry that started at start with nops and patch the length
+static void dwarf_finish(std::vector<uint8_t> & out, size_t start)
+{
+    while((out.size() - start) & 7) out.push_back(DW_CFA_nop);
+
+    uint32_t length = out.size() - start - 4;
+    memcpy(out.data() + start, &length, 4);
+}
+
+// calls f for every table (or FDE) that the runtime wants on its own
+template <typename F>
+static void forEachFrame(std::vector<uint8_t> & table, F && f)
+{
+#ifdef __APPLE__
+    for(size_t i = 0; i < table.size() - 4;)
+    {
+        uint32_t length;
+        memcpy(&length, table.data() + i, 4);
+        if(i) f(table.data() + i);
+        i += length + 4;
+    }
+#else
+    f(table.data());
+#endif
+}
+
+void Module::unwindRegister()
+{
+    if(!unwindEnabled) return;
+
+    // patch() only adds procs and the old ones never move while loaded,
+    // so add a table for the new procs and leave the old tables alone,
+    // since other threads might be unwinding through them right now
+    //
+    // replacing a table with a new one for all procs won't work either:
+    // libgcc keys tables by their first address, so they can't overlap
+    if(nUnwindRegistered == offsets.size()) return;
+
+    ehFrames.emplace_back();
+    auto & out = ehFrames.back();
+
+    dwarf_put<uint32_t>(out, 0);    // length
+    dwarf_put<uint32_t>(out, 0);    // CIE id
+    out.push_back(1);               // version
+    out.push_back('z');
+    out.push_back('R');
+    out.push_back(0);
+    dwarf_uleb(out, dwarfCodeAlign);
+    dwarf_sleb(out, dwarfDataAlign);
+    dwarf_uleb(out, dwarfRA);
+    dwarf_uleb(out, 1);             // augmentation data
+    out.push_back(0);               // DW_EH_PE_absptr
+
+    out.push_back(DW_CFA_def_cfa);
+    dwarf_uleb(out, dwarfSP);
+    dwarf_uleb(out, dwarfInitCFA);
+    if(dwarfInitCFA)
+    {
+        out.push_back(DW_CFA_offset | dwarfRA);
+        dwarf_uleb(out, dwarfInitCFA / -dwarfDataAlign);
+    }
+    dwarf_finish(out, 0);
+
+    unsigned iUnwind = iUnwindRegistered;
+    for(unsigned i = nUnwindRegistered; i < offsets.size(); ++i)
+    {
+        unsigned end = (i+1 < offsets.size()) ? offsets[i+1] : bytes.size();
+
+        size_t start = out.size();
+        dwarf_put<uint32_t>(out, 0);
+        dwarf_put<uint32_t>(out, out.size());       // back to CIE at 0
+        dwarf_put<uint64_t>(out, offsets[i] + (uintptr_t) exec_mem);
+        dwarf_put<uint64_t>(out, end - offsets[i]);
+        dwarf_uleb(out, 0);         // augmentation data
+
+        unsigned loc = offsets[i];
+        for(; iUnwind < unwind.size() && unwind[iUnwind].codeOffset <= end;
+            ++iUnwind)
+        {
+            auto & u = unwind[iUnwind];
+            BJIT_ASSERT(u.codeOffset >= loc);
+
+            // changes at the very end of a proc don't matter
+            if(u.codeOffset == end) continue;
+
+            unsigned delta = (u.codeOffset - loc) / dwarfCodeAlign;
+            loc = u.codeOffset;
+
+            if(!delta) {}
+            else if(delta < 0x40) out.push_back(DW_CFA_advance_loc | delta);
+            else if(delta < 0x100)
+            {
+                out.push_back(DW_CFA_advance_loc1);
+                dwarf_put<uint8_t>(out, delta);
+            }
+            else if(delta < 0x10000)
+            {
+                out.push_back(DW_CFA_advance_loc2);
+                dwarf_put<uint16_t>(out, delta);
+            }
+            else
+            {
+                out.push_back(DW_CFA_advance_loc4);
+                dwarf_put<uint32_t>(out, delta);
+            }
+
+            switch(u.op)
+            {
+            case impl::UnwindOp::setCFA:
+                out.push_back(DW_CFA_def_cfa_offset);
+                dwarf_uleb(out, u.offset);
+                break;
+
+            case impl::UnwindOp::saveReg:
+                if(u.reg < 0x40) out.push_back(DW_CFA_offset | u.reg);
+                else
+                {
+                    out.push_back(DW_CFA_offset_extended);
+                    dwarf_uleb(out, u.reg);
+                }
+                dwarf_uleb(out, u.offset / dwarfDataAlign);
+                break;
+
+            case impl::UnwindOp::remember:
+                out.push_back(DW_CFA_remember_state);
+                break;
+
+            case impl::UnwindOp::restore:
+                out.push_back(DW_CFA_restore_state);
+                break;
+            }
+        }
+
+        dwarf_finish(out, start);
+    }
+
+    dwarf_put<uint32_t>(out, 0);    // terminator
+
+    forEachFrame(out, [](uint8_t * p) { __register_frame(p); });
+
+    nUnwindRegistered = offsets.size();
+    iUnwindRegistered = iUnwind;
+}
+
+void Module::unwindDeregister()
+{
+    for(auto & table : ehFrames)
+    {
+        forEachFrame(table, [](uint8_t * p) { __deregister_frame(p); });
+    }
+    ehFrames.clear();
+
+    nUnwindRegistered = 0;
+    iUnwindRegistered = 0;
+}
+
+#else
+
+void Module::unwindRegister() { }
+void Module::unwindDeregister() { }
+
+#endif
@@ -16,7 +16,24 @@
 # define MAP_ANONYMOUS MAP_ANON  // the joy of being different
 #endif
 
+// Define BJIT_CAN_DUALMAP on platforms where we can map the same memory
+// twice for load(dualMap), on Linux we need memfd_create() for this.
+#if defined(__linux__)
+#  define BJIT_CAN_DUALMAP
+#  include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+#  define BJIT_CAN_DUALMAP
+#endif
+
+#include <cstdio>
 #include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include "bjit.h"
 
@@ -32,7 +49,391 @@ static void flush_cache(char * exec_mem, uint32_t mmapSize)
 #endif
 }
 
-uintptr_t Module::load(unsigned mmapSizeMin)
+// huge page size for CodeHeap(hugePages), this is what x64 and arm64
+// (with 4k base pages) use on Linux and we only try to use them there
+static const size_t hugePageSize = 0x200000;
+
+#ifdef BJIT_USE_MMAP
+// like mmap() but with the returned address aligned to align
+static void * mmap_aligned(size_t size, size_t align, int prot, int flags, int fd)
+{
+    if(!align) return mmap(NULL, size, prot, flags, fd, 0);
+
+    // reserve enough address space, then map over the aligned part
+    auto base = (uint8_t*) mmap(NULL, size + align, PROT_NONE,
+        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(base == MAP_FAILED) return MAP_FAILED;
+
+    auto mem = (uint8_t*)(((uintptr_t)base + align - 1) & ~(uintptr_t)(align - 1));
+    if(mem != base) munmap(base, mem - base);
+    munmap(mem + size, base + align - mem);
+
+    void * ptr = mmap(mem, size, prot, flags | MAP_FIXED, fd, 0);
+    if(ptr == MAP_FAILED) munmap(mem, size);
+    return ptr;
+}
+#endif
+
+// map the same memory twice, once read+execute and once read+write
+// returns false if this fails or isn't supported on the platform
+//
+// if huge is not null, then align to huge pages and try to use explicit
+// huge pages (which the system might not have any of) or transparent ones
+// for the shared memory, and set *huge only if we got explicit ones, since
+// whether transparent ones are used is up to the system, see map_thp_size()
+static bool map_dual(size_t size, void *& rx, void *& rw, bool * huge = 0)
+{
+#if defined(BJIT_CAN_DUALMAP) && defined(BJIT_USE_MMAP)
+    size_t align = huge ? hugePageSize : 0;
+    if(huge) *huge = false;
+
+    // anonymous file that we can map twice, closing the descriptor
+    // is fine once mapped, the memory goes away when both are unmapped
+    auto mapFile = [&](unsigned flags) -> bool
+    {
+        int fd = memfd_create("bjit", MFD_CLOEXEC | flags);
+        if(fd < 0) return false;
+
+        rx = rw = MAP_FAILED;
+        if(!ftruncate(fd, size))
+        {
+            rx = mmap_aligned(size, align, PROT_READ | PROT_EXEC, MAP_SHARED, fd);
+            rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+
+        if(rx == MAP_FAILED || rw == MAP_FAILED)
+        {
+            if(rx != MAP_FAILED) munmap(rx, size);
+            if(rw != MAP_FAILED) munmap(rw, size);
+            return false;
+        }
+        return true;
+    };
+
+#ifdef MFD_HUGETLB
+    // explicit huge pages fail silently if there are none
+    if(huge && mapFile(MFD_HUGETLB)) return *huge = true;
+#endif
+
+    if(!mapFile(0))
+    {
+        BJIT_TRACE(module, error, "memfd_create or mmap failed in bjit::map_dual()");
+        return false;
+    }
+
+#ifdef MADV_HUGEPAGE
+    // transparent huge pages for shared memory depend on the system
+    // settings (see shmem_enabled), but this is the best we can do
+    if(huge) madvise(rx, size, MADV_HUGEPAGE);
+#endif
+    return true;
+#elif defined(BJIT_CAN_DUALMAP) && defined(_WIN32)
+    // large pages need special privileges on Windows, don't bother
+    if(huge) *huge = false;
+
+    HANDLE h = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+        PAGE_EXECUTE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    if(!h)
+    {
+        BJIT_TRACE(module, error, "CreateFileMapping failed in bjit::map_dual()");
+        return false;
+    }
+
+    rx = MapViewOfFile(h, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, 0);
+    rw = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, 0);
+    CloseHandle(h);
+
+    if(!rx || !rw)
+    {
+        BJIT_TRACE(module, error, "MapViewOfFile failed in bjit::map_dual()");
+        if(rx) UnmapViewOfFile(rx);
+        if(rw) UnmapViewOfFile(rw);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// returns how much of the mapping starting at addr is currently backed
+// by transparent huge pages (as far as /proc/self/smaps tells us)
+static size_t map_thp_size(void * addr)
+{
+#if defined(BJIT_CAN_DUALMAP) && defined(BJIT_USE_MMAP)
+    FILE * f = fopen("/proc/self/smaps", "r");
+    if(!f) return 0;
+
+    char line[256];
+    size_t kb = 0;
+    bool found = false;
+    while(fgets(line, sizeof(line), f))
+    {
+        // mappings start with "start-end perms ..." in hex
+        unsigned long start, end;
+        if(2 == sscanf(line, "%lx-%lx ", &start, &end))
+        {
+            if(found) break;
+            found = (start == (uintptr_t) addr);
+        }
+        else if(found && 1 == sscanf(line, "ShmemPmdMapped: %zu kB", &kb)) break;
+    }
+    fclose(f);
+
+    return kb * 1024;
+#else
+    return 0;
+#endif
+}
+
+// state for one compileAsync() until updateAsync() installs it
+struct bjit::impl::AsyncJob
+{
+    Proc                    *proc;
+    unsigned                stubIndex;
+    unsigned                levelOpt;
+    bool                    ownProc;    // from updateTiered()
+
+    std::vector<uint8_t>    code;
+    std::atomic<bool>       done { false };
+};
+
+// worker threads for startAsync(), started as needed up to nThreads
+// and kept around until the module is destroyed
+struct bjit::impl::AsyncPool
+{
+    std::mutex                  mutex;
+    std::condition_variable     wake;       // queue not empty, or quit
+    std::condition_variable     finished;   // some job is done
+
+    std::deque<AsyncJob*>       queue;
+    std::vector<std::thread>    threads;
+    unsigned                    nThreads;
+    unsigned                    nIdle = 0;
+    bool                        quit = false;
+
+    void push(AsyncJob * job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.push_back(job);
+
+        if(queue.size() > nIdle && threads.size() < nThreads)
+            threads.emplace_back([this]() { run(); });
+        else wake.notify_one();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            ++nIdle;
+            wake.wait(lock, [this]() { return quit || queue.size(); });
+            --nIdle;
+            if(quit) return;
+
+            auto * job = queue.front();
+            queue.pop_front();
+
+            lock.unlock();
+            job->proc->compile(job->code, job->levelOpt);
+            lock.lock();
+
+            job->done = true;
+            finished.notify_all();
+        }
+    }
+
+    void waitFor(AsyncJob & job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&job]() { return (bool) job.done; });
+    }
+
+    // jobs that are still queued are dropped, running ones finish first
+    ~AsyncPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queue.clear();
+            quit = true;
+        }
+        wake.notify_all();
+        for(auto & t : threads) t.join();
+    }
+};
+
+Module::~Module()
+{
+    delete asyncPool;
+    for(auto & job : asyncJobs)
+    {
+        if(job->ownProc) delete job->proc;
+        delete job;
+    }
+    
+    if(exec_mem) unload();
+
+    // the code that used the counters is gone now
+    tierDestroy();
+}
+
+int Module::appendProc(Proc & proc, std::vector<uint8_t> & code)
+{
+    int index = offsets.size();
+
+    // procs assume they start 16-byte aligned (eg. for constants)
+    while(bytes.size() & 0xf) bytes.push_back(0);
+
+    uint32_t base = bytes.size();
+    offsets.push_back(base);
+    bytes.insert(bytes.end(), code.begin(), code.end());
+
+    // near calls were emitted relative to the start of code
+    for(auto & r : proc.getReloc())
+    {
+        relocs.push_back(NearReloc{r.codeOffset + base, r.procIndex});
+        arch_patchNear(relocs.back().codeOffset + bytes.data(), -(int32_t)base);
+    }
+
+    for(auto & u : proc.getUnwind())
+    {
+        unwind.push_back(u);
+        unwind.back().codeOffset += base;
+    }
+
+    return index;
+}
+
+int Module::compileDedupe(Proc & proc, unsigned levelOpt)
+{
+    uint64_t hash = proc.hash(levelOpt, &dedupeKey);
+
+    if(auto * p = dedupeProcs.find(DedupeKey{hash, dedupeKey}))
+    {
+        ++dedupeStats.nHits;
+        return p->index;
+    }
+    ++dedupeStats.nMisses;
+
+    DedupeProc p;
+    p.hash = hash;
+    p.key = dedupeKey;
+    p.index = compile(proc, levelOpt);
+    dedupeProcs.insert(p);
+
+    return p.index;
+}
+
+int Module::compileBatch(Proc * const * procs, unsigned nProcs,
+    unsigned levelOpt, unsigned nThreads)
+{
+    int index = offsets.size();
+
+    // every thread grabs the next proc that nobody has taken yet
+    // until there are none left, so slow procs don't hold others up
+    std::vector<std::vector<uint8_t>>   code(nProcs);
+    std::atomic<unsigned>               next(0);
+
+    auto worker = [&]()
+    {
+        for(unsigned i; (i = next++) < nProcs;)
+        {
+            procs[i]->compile(code[i], levelOpt);
+        }
+    };
+
+    if(!nThreads) nThreads = std::thread::hardware_concurrency();
+    if(nThreads > nProcs) nThreads = nProcs;
+
+    // the calling thread also does work, so start one less
+    std::vector<std::thread>    pool;
+    for(unsigned t = 1; t < nThreads; ++t) pool.emplace_back(worker);
+    worker();
+    for(auto & t : pool) t.join();
+
+    // then append in order
+    for(unsigned i = 0; i < nProcs; ++i) appendProc(*procs[i], code[i]);
+
+    return index;
+}
+
+int Module::compileAsync(Proc & proc, uintptr_t fallback, unsigned levelOpt)
+{
+    int index = compileStub(fallback);
+    startAsync(proc, index, levelOpt, false);
+
+    return index;
+}
+
+void Module::startAsync(Proc & proc, unsigned stubIndex,
+    unsigned levelOpt, bool ownProc)
+{
+    asyncJobs.push_back(new impl::AsyncJob);
+    auto & job = *asyncJobs.back();
+    job.proc = &proc;
+    job.stubIndex = stubIndex;
+    job.levelOpt = levelOpt;
+    job.ownProc = ownProc;
+
+    if(!asyncPool)
+    {
+        asyncPool = new impl::AsyncPool;
+        asyncPool->nThreads = asyncThreads ? asyncThreads
+            : std::thread::hardware_concurrency();
+        if(!asyncPool->nThreads) asyncPool->nThreads = 1;
+    }
+    asyncPool->push(&job);
+}
+
+unsigned Module::updateAsync(bool wait)
+{
+    unsigned nDone = 0;
+
+    // install finished ones in order, keep the rest for later
+    int j = 0;
+    for(int i = 0; i < asyncJobs.size(); ++i)
+    {
+        auto & job = *asyncJobs[i];
+        if(!wait && !job.done)
+        {
+            if(i != j) std::swap(asyncJobs[i], asyncJobs[j]);
+            ++j;
+            continue;
+        }
+
+        if(!job.done) asyncPool->waitFor(job);
+
+        unsigned procIndex = appendProc(*job.proc, job.code);
+
+        // stubs from compileTiered() already forward to the old version
+        bool found = false;
+        for(auto & f : stubForwards)
+        {
+            if(f.stubIndex != job.stubIndex) continue;
+            f.procIndex = procIndex;
+            found = true;
+        }
+        if(!found) stubForwards.push_back(StubForward{job.stubIndex, procIndex});
+
+        // if loaded, then patch the stub now, load() does the rest
+        if(isLoaded())
+        {
+            patchStub(job.stubIndex, (uintptr_t)exec_mem + offsets[procIndex]);
+        }
+        patchCalls(job.stubIndex, procIndex);
+
+        if(job.ownProc) delete job.proc;
+        delete &job;
+        ++nDone;
+    }
+    asyncJobs.resize(j);
+
+    return nDone;
+}
+
+uintptr_t Module::load(unsigned mmapSizeMin, bool dualMap)
 {
     BJIT_ASSERT(!exec_mem);
 
@@ -40,19 +441,25 @@ uintptr_t Module::load(unsigned mmapSizeMin)
     return 0;
 #endif
 
+#ifndef BJIT_CAN_DUALMAP
+    if(dualMap) return 0;
+#endif
+
     // compute sizes
     mmapSize = mmapSizeMin;
     loadSize = bytes.size();
     
     if(mmapSize < loadSize) mmapSize = loadSize;
 
+    if(dualMap) return loadDual();
+
 #ifdef BJIT_USE_MMAP
     // get a block of memory we can mess with, read+write
     exec_mem = mmap(NULL, mmapSize, PROT_READ | PROT_WRITE,
         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
     if(!exec_mem)
     {
-        BJIT_LOG("error: mmap failed in bjit::Module::load()\n");
+        BJIT_TRACE(module, error, "mmap failed in bjit::Module::load()");
         return 0;
     }
 #endif
@@ -60,24 +467,18 @@ uintptr_t Module::load(unsigned mmapSizeMin)
     exec_mem = VirtualAlloc(0, mmapSize, MEM_COMMIT, PAGE_READWRITE);
     if(!exec_mem)
     {
-        BJIT_LOG("error: VirtualAlloc failed in bjit::Module::load()\n");
+        BJIT_TRACE(module, error, "VirtualAlloc failed in bjit::Module::load()");
         return 0;
     }
 #endif
 
-    // copy & relocate
-    memcpy(exec_mem, bytes.data(), bytes.size());
-    for(auto & r : relocs)
-    {
-        BJIT_ASSERT(r.procIndex < offsets.size());
-        arch_patchNear(r.codeOffset+(uint8_t*)exec_mem, offsets[r.procIndex]);
-    }
+    copyAndRelocate((uint8_t*) exec_mem);
 
 #ifdef BJIT_USE_MMAP
     // return zero on success
     if(mprotect(exec_mem, mmapSize, PROT_READ | PROT_EXEC))
     {
-        BJIT_LOG("error: mprotect failed in bjit::Module::load()\n");
+        BJIT_TRACE(module, error, "mprotect failed in bjit::Module::load()");
         // if we can't set executable, then try to unload
         unload();
         return 0;
@@ -92,13 +493,91 @@ uintptr_t Module::load(unsigned mmapSizeMin)
     DWORD   oldFlags = 0;
     if(!VirtualProtect(exec_mem, mmapSize, PAGE_EXECUTE_READ, &oldFlags))
     {
-        BJIT_LOG("error: mprotect failed in bjit::Module::load()\n");
+        BJIT_TRACE(module, error, "mprotect failed in bjit::Module::load()");
         // if we can't set executable, then try to unload
         unload();
         return 0;
     }
 #endif
 
+    unwindRegister();
+    perfReport();
+    return (uintptr_t) exec_mem;
+}
+
+void Module::copyAndRelocate(uint8_t * mem)
+{
+    memcpy(mem, bytes.data(), bytes.size());
+    for(auto & r : relocs)
+    {
+        BJIT_ASSERT(r.procIndex < offsets.size());
+        arch_patchNear(r.codeOffset + mem, offsets[r.procIndex]);
+    }
+
+    // stubs from compileAsync() need the new address
+    for(auto & f : stubForwards)
+    {
+        arch_patchStub(offsets[f.stubIndex] + mem,
+            offsets[f.procIndex] + (uintptr_t)exec_mem);
+    }
+}
+
+uintptr_t Module::loadDual()
+{
+    void * rx, * rw;
+    if(!map_dual(mmapSize, rx, rw)) return 0;
+
+    exec_mem = rx;
+    write_mem = rw;
+
+    copyAndRelocate((uint8_t*) write_mem);
+    flush_cache((char*)exec_mem, mmapSize);
+
+    unwindRegister();
+    perfReport();
+    return (uintptr_t) exec_mem;
+}
+
+uintptr_t Module::load(CodeHeap & codeHeap, unsigned mmapSizeMin,
+    const Module * near)
+{
+    BJIT_ASSERT(!exec_mem);
+
+#ifndef BJIT_CAN_LOAD
+    return 0;
+#endif
+
+    mmapSize = mmapSizeMin;
+    loadSize = bytes.size();
+
+    if(mmapSize < loadSize) mmapSize = loadSize;
+
+    // chunks are cache-line aligned, so round up to use all of it
+    mmapSize = (mmapSize + 63) & ~63;
+
+    uint8_t * wmem;
+    auto mem = codeHeap.alloc(mmapSize, wmem,
+        (near && near->heap == &codeHeap) ? (uint8_t*) near->exec_mem : 0);
+    if(!mem)
+    {
+        mmapSize = 0;
+        loadSize = 0;
+
+        // heap can't share memory safely, see CodeHeap::newRegion()
+        if(codeHeap.noDualMap) return load(mmapSizeMin);
+        return 0;
+    }
+
+    heap = &codeHeap;
+    exec_mem = mem;
+    write_mem = wmem;
+
+    heap->beginWrite(mem);
+    copyAndRelocate(wmem);
+    heap->endWrite(mem, mmapSize);
+
+    unwindRegister();
+    perfReport();
     return (uintptr_t) exec_mem;
 }
 
@@ -109,33 +588,41 @@ bool Module::patch()
     // check if patching is going to work?
     if(mmapSize < bytes.size()) return false;
 
+    // with dualMap we can just write through the other view
+    auto mem = (uint8_t*)(write_mem ? write_mem : exec_mem);
+
+    // heap takes care of flushing the icache for the region
+    if(heap) heap->beginWrite((uint8_t*)exec_mem);
+
 #ifdef BJIT_USE_MMAP
     // return zero on success
-    BJIT_ASSERT(!mprotect(exec_mem, mmapSize, PROT_READ | PROT_WRITE));
+    if(!write_mem && !heap)
+        BJIT_ASSERT(!mprotect(exec_mem, mmapSize, PROT_READ | PROT_WRITE));
 #endif
 #ifdef _WIN32
     // Note that VirtualProtect REQUIRES oldFlags to be a valid pointer!
     // returns non-zero on success
     DWORD   oldFlags = 0;
-    BJIT_ASSERT(VirtualProtect(exec_mem, mmapSize, PAGE_READWRITE, &oldFlags));
+    if(!write_mem && !heap)
+        BJIT_ASSERT(VirtualProtect(exec_mem, mmapSize, PAGE_READWRITE, &oldFlags));
 #endif
 
     // copy and relocate, only new ones
-    memcpy(loadSize+(uint8_t*)exec_mem, loadSize+bytes.data(),
+    memcpy(loadSize+mem, loadSize+bytes.data(),
         bytes.size()-loadSize);
     for(auto & r : relocs)
     {
         if(r.codeOffset < loadSize) continue;
         
         BJIT_ASSERT(r.procIndex < offsets.size());
-        arch_patchNear(r.codeOffset+(uint8_t*)exec_mem, offsets[r.procIndex]);
+        arch_patchNear(r.codeOffset+mem, offsets[r.procIndex]);
     }
     loadSize = bytes.size();
 
     // do all pending stub-patches
     for(auto & p : stubPatches)
     {
-        arch_patchStub(offsets[p.procIndex] + (uint8_t*)exec_mem, p.newAddress);
+        arch_patchStub(offsets[p.procIndex] + mem, p.newAddress);
     }
     stubPatches.clear();
 
@@ -152,15 +639,24 @@ bool Module::patch()
             {
                 r.procIndex = p.newTarget;
                 // relocate
-                arch_patchNear(r.codeOffset+(uint8_t*)exec_mem, delta);
+                arch_patchNear(r.codeOffset+mem, delta);
             }
         }
     }
     nearPatches.clear();
 
+    if(heap)
+    {
+        heap->endWrite((uint8_t*)exec_mem, mmapSize);
+        unwindRegister();
+        perfReport();
+        return true;
+    }
+
 #ifdef BJIT_USE_MMAP
     // return zero on success
-    BJIT_ASSERT(!mprotect(exec_mem, mmapSize, PROT_READ | PROT_EXEC));
+    if(!write_mem)
+        BJIT_ASSERT(!mprotect(exec_mem, mmapSize, PROT_READ | PROT_EXEC));
 
     flush_cache((char*)exec_mem, mmapSize);
     
@@ -168,9 +664,12 @@ bool Module::patch()
 #ifdef _WIN32
     // Note that VirtualProtect REQUIRES oldFlags to be a valid pointer!
     // returns non-zero on success
-    BJIT_ASSERT(VirtualProtect(exec_mem, mmapSize, PAGE_EXECUTE_READ, &oldFlags));
+    if(!write_mem)
+        BJIT_ASSERT(VirtualProtect(exec_mem, mmapSize, PAGE_EXECUTE_READ, &oldFlags));
 #endif    
 
+    unwindRegister();
+    perfReport();
     return true;
 }
 
@@ -178,12 +677,28 @@ uintptr_t Module::unload()
 {
     BJIT_ASSERT(exec_mem);
 
+    unwindDeregister();
+
+    if(heap)
+    {
+        heap->free((uint8_t*)exec_mem, mmapSize);
+        heap = 0;
+    }
+    else
+    {
 #ifdef BJIT_USE_MMAP
-    munmap(exec_mem, mmapSize);
+        munmap(exec_mem, mmapSize);
+        if(write_mem) munmap(write_mem, mmapSize);
 #endif
 #ifdef _WIN32
-    VirtualFree(exec_mem, 0, MEM_RELEASE);
+        if(write_mem)
+        {
+            UnmapViewOfFile(exec_mem);
+            UnmapViewOfFile(write_mem);
+        }
+        else VirtualFree(exec_mem, 0, MEM_RELEASE);
 #endif
+    }
 
     uintptr_t ret = (uintptr_t) exec_mem;
 
@@ -207,8 +722,277 @@ uintptr_t Module::unload()
     nearPatches.clear();
     
     exec_mem = 0;
+    write_mem = 0;
     mmapSize = 0;
     loadSize = 0;
+    nPerfReported = 0;
 
     return ret;
-}
\ No newline at end of file
+}
+// one block of executable memory reserved by a CodeHeap
+struct bjit::impl::CodeRegion
+{
+    uint8_t     *exec;
+    uint8_t     *write;     // second view of the same memory
+    size_t      size;
+
+    // we asked for huge pages, and got explicit ones if hugeTLB,
+    // otherwise see map_thp_size() for whether the system gave us any
+    bool        hugeAsked;
+    bool        hugeTLB;
+
+    // unused chunks, sorted by offset
+    struct Chunk
+    {
+        size_t  offset;
+        size_t  size;
+    };
+    std::vector<Chunk>  freeList;
+};
+
+// regions are rounded to this, which should be a multiple of page size
+static const size_t regionAlign = 0x10000;
+
+CodeHeap::~CodeHeap()
+{
+    for(auto * r : regions)
+    {
+#ifdef BJIT_USE_MMAP
+        munmap(r->exec, r->size);
+        munmap(r->write, r->size);
+#endif
+#ifdef _WIN32
+        UnmapViewOfFile(r->exec);
+        UnmapViewOfFile(r->write);
+#endif
+        delete r;
+    }
+}
+
+CodeHeap & CodeHeap::shared()
+{
+    // never freed, so modules can still unload from static destructors
+    static CodeHeap * heap = new CodeHeap;
+    return *heap;
+}
+
+// CodeHeap::beginBatch() on the calling thread, with the ranges that the
+// thread wrote since then; these are per thread, since other threads
+// might be loading or patching modules that they want to call right away
+namespace
+{
+    struct HeapBatch
+    {
+        CodeHeap    *heap;
+        unsigned    depth;
+
+        std::vector<std::pair<char*, size_t>>  dirty;
+    };
+}
+static thread_local std::vector<HeapBatch> heapBatches;
+
+static HeapBatch * findBatch(CodeHeap * heap)
+{
+    for(auto & b : heapBatches) if(b.heap == heap) return &b;
+    return 0;
+}
+
+void CodeHeap::beginBatch()
+{
+    auto * b = findBatch(this);
+    if(!b)
+    {
+        heapBatches.push_back(HeapBatch{this, 0});
+        b = &heapBatches.back();
+    }
+    ++b->depth;
+}
+
+void CodeHeap::endBatch()
+{
+    auto * b = findBatch(this);
+    BJIT_ASSERT(b && b->depth);
+    if(--b->depth) return;
+
+    for(auto & d : b->dirty) flush_cache(d.first, d.second);
+    heapBatches.erase(heapBatches.begin() + (b - heapBatches.data()));
+}
+
+CodeHeap::Stats CodeHeap::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Stats stats = {};
+    for(auto * r : regions)
+    {
+        stats.reserved += r->size;
+        stats.nRegions += 1;
+        if(r->hugeAsked) stats.nHugeAsked += 1;
+
+        // transparent huge pages only count if they cover the whole region,
+        // since we can't tell which parts of it they are mapped for
+        bool huge = r->hugeTLB
+            || (r->hugeAsked && map_thp_size(r->exec) == r->size);
+        if(huge) stats.nHugeRegions += 1;
+
+        // count pages touched by the used ranges between free chunks
+        size_t page = huge ? hugePageSize : 0x1000;
+        size_t start = 0, lastPage = ~size_t(0);
+        for(int i = 0; i <= r->freeList.size(); ++i)
+        {
+            size_t end = i < r->freeList.size() ? r->freeList[i].offset : r->size;
+            if(end > start)
+            {
+                stats.used += end - start;
+
+                size_t first = start / page, last = (end - 1) / page;
+                if(first == lastPage) ++first;
+                if(first <= last) stats.nPages += last - first + 1;
+                lastPage = last;
+            }
+            if(i < r->freeList.size())
+                start = r->freeList[i].offset + r->freeList[i].size;
+        }
+    }
+    return stats;
+}
+
+uint8_t * CodeHeap::alloc(size_t size, uint8_t *& wmem, uint8_t * near)
+{
+    // cache-line aligned, so modules don't share lines
+    size = (size + 63) & ~size_t(63);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto take = [&](impl::CodeRegion * r, int i) -> uint8_t *
+    {
+        auto & c = r->freeList[i];
+
+        size_t offset = c.offset;
+        c.offset += size;
+        c.size -= size;
+        if(!c.size) r->freeList.erase(r->freeList.begin() + i);
+
+        wmem = r->write + offset;
+        return r->exec + offset;
+    };
+
+    // try the first fit after near, then before it in the same region
+    auto * nearRegion = near ? findRegion(near) : 0;
+    if(nearRegion)
+    {
+        auto & list = nearRegion->freeList;
+        size_t nearOffset = near - nearRegion->exec;
+
+        int best = -1;
+        for(int i = 0; i < list.size(); ++i)
+        {
+            if(list[i].size < size) continue;
+            best = i;
+            if(list[i].offset > nearOffset) break;
+        }
+        if(best >= 0) return take(nearRegion, best);
+    }
+
+    // first fit, new modules mostly just go to the end of a region
+    for(auto * r : regions)
+    {
+        for(int i = 0; i < r->freeList.size(); ++i)
+        {
+            if(r->freeList[i].size >= size) return take(r, i);
+        }
+    }
+
+    if(noDualMap) return 0;
+
+    auto * r = newRegion(size);
+    if(!r) return 0;
+
+    r->freeList.push_back({0, r->size});
+    return take(r, 0);
+}
+
+impl::CodeRegion * CodeHeap::newRegion(size_t size)
+{
+    size_t align = hugePages ? hugePageSize : regionAlign;
+    size_t rsize = regionSize < size ? size : regionSize;
+    rsize = (rsize + align - 1) & ~(align - 1);
+
+    // without dual mapping we'd have to make the whole region writable
+    // and not executable while loading, which would stop all the other
+    // modules in it, so Module::load() uses private mappings instead
+    void * rx = 0, * rw = 0;
+    bool huge = false;
+
+    if(!map_dual(rsize, rx, rw, hugePages ? &huge : 0))
+    {
+        noDualMap = true;
+        return 0;
+    }
+
+    auto * r = new impl::CodeRegion;
+    r->exec = (uint8_t*) rx;
+    r->write = (uint8_t*) rw;
+    r->size = rsize;
+    r->hugeAsked = hugePages;
+    r->hugeTLB = huge;
+    regions.push_back(r);
+
+    return r;
+}
+
+void CodeHeap::free(uint8_t * mem, size_t size)
+{
+    size = (size + 63) & ~size_t(63);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto * r = findRegion(mem);
+    BJIT_ASSERT(r);
+
+    // keep sorted and merge with neighbours
+    auto & list = r->freeList;
+    size_t offset = mem - r->exec;
+
+    int i = 0;
+    while(i < list.size() && list[i].offset < offset) ++i;
+    list.insert(list.begin() + i, impl::CodeRegion::Chunk{offset, size});
+
+    if(i + 1 < list.size() && offset + size == list[i+1].offset)
+    {
+        list[i].size += list[i+1].size;
+        list.erase(list.begin() + i + 1);
+    }
+    if(i && list[i-1].offset + list[i-1].size == offset)
+    {
+        list[i-1].size += list[i].size;
+        list.erase(list.begin() + i);
+    }
+}
+
+void CodeHeap::beginWrite(uint8_t * mem)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    BJIT_ASSERT(findRegion(mem));
+}
+
+void CodeHeap::endWrite(uint8_t * mem, size_t size)
+{
+    // flush now, unless this thread is in a batch
+    auto * b = findBatch(this);
+    if(!b) { flush_cache((char*) mem, size); return; }
+
+    // modules loaded in a row are usually next to each other
+    if(b->dirty.size() && b->dirty.back().first + b->dirty.back().second
+        == (char*) mem) b->dirty.back().second += size;
+    else b->dirty.emplace_back((char*) mem, size);
+}
+
+impl::CodeRegion * CodeHeap::findRegion(uint8_t * mem)
+{
+    for(auto * r : regions)
+    {
+        if(mem >= r->exec && mem < r->exec + r->size) return r;
+    }
+    return 0;
+}
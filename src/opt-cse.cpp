@@ -93,12 +93,15 @@ void Proc::rebuild_memtags(bool unsafeOpt)
 */
 bool Proc::opt_cse(bool unsafeOpt)
 {
+    impl::PassTimer timer(stats, CompileStats::cse, passTimer);
+
     rebuild_dom();
     rebuild_memtags(unsafeOpt);
 
-    impl::Rename rename;
+    auto & rename = scratch.rename;
+    rename.clear();
 
-    BJIT_LOG(" CSE");
+    BJIT_TRACE(opt, info, "cse");
 
     // we'll do a second round of dom-rebuilding
     // if we break edges when hoisting
@@ -109,7 +112,8 @@ bool Proc::opt_cse(bool unsafeOpt)
 
     // pairs, packed into uint32_t for cheap sort
     BJIT_ASSERT(sizeof(uint32_t) == 2*sizeof(noVal));
-    std::vector<uint32_t>   pairs;
+    auto & pairs = scratch.csePairs;
+    pairs.clear();
 
     // clear hash
     cseTable.clear();
@@ -264,7 +268,8 @@ bool Proc::opt_cse(bool unsafeOpt)
         BJIT_LOG("\nCSE pairs: %04x vs. %04x: ", p>>16, p&noVal);
     }
 
-    std::vector<uint16_t>   preList;
+    auto & preList = scratch.csePreList;
+    preList.clear();
 
     // check for PRE
     auto checkPre = [&](OpCSE & cse)
@@ -314,15 +319,12 @@ bool Proc::opt_cse(bool unsafeOpt)
                 if(a.phi == match.in[1]) match.in[1] = a.val;
             }
 
-            auto & cfdom = blocks[cf].dom;
-            
             // match
             auto * p = cseTable.find(match);
             if(p)
             {
                 // check dominance
-                auto pds = blocks[p->block].dom.size();
-                if(cfdom.size() >= pds && cfdom[pds-1] == p->block)
+                if(dominates(p->block, cf))
                 {
                     preList[c] = p->index;
                     matches = true;
@@ -336,8 +338,7 @@ bool Proc::opt_cse(bool unsafeOpt)
                     {
                         auto altIndex = (*it)&noVal;
                         auto & alt = ops[altIndex];
-                        auto ads = blocks[alt.block].dom.size();
-                        if(cfdom.size() >= ads && cfdom[ads-1] == alt.block)
+                        if(dominates(alt.block, cf))
                         {
                             preList[c] = altIndex;
                             matches = true;
@@ -416,15 +417,8 @@ bool Proc::opt_cse(bool unsafeOpt)
             op0index, op0.block, op1index, op1.block);
 
         // closest common dominator
-        int ccd = 0;
-        int iMax = std::min(
-            blocks[b0].dom.size(), blocks[b1].dom.size());
-            
-        for(int i = 0; i < iMax; ++i)
-        {
-            if(blocks[b0].dom[i] == blocks[b1].dom[i]) ccd = blocks[b0].dom[i];
-            else break;
-        }
+        int ccd = b0;
+        while(!dominates(ccd, b1)) ccd = blocks[ccd].idom;
 
         if(cse_debug) BJIT_LOG(" CCD:%d ", ccd);
 
@@ -470,7 +464,8 @@ bool Proc::opt_cse(bool unsafeOpt)
             }
             else
             {
-                BJIT_LOG("GOOD: %04x first in block", op1index);
+                if(cse_debug)
+                    BJIT_LOG("GOOD: %04x first in block", op1index);
                 rename.add(op0index, op1index);
                 op0.makeNOP();
                 op1.flags.no_opt = false;   // can optimize again
@@ -551,6 +546,29 @@ bool Proc::opt_cse(bool unsafeOpt)
         BJIT_ASSERT(false); // not reached
     };
 
+    // try all pairs within a set of ops that matched the same op
+    //
+    // once an op has been eliminated, csePair() won't do anything with
+    // it, so skip those here or this gets quadratic for big sets
+    auto cseFlush = [&](int begin, int end) -> bool
+    {
+        bool progress = false;
+        for(int p = begin; p < end; ++p)
+        {
+            for(int q = p+1; q < end; ++q)
+            {
+                if(ops[pairs[p]&noVal].opcode == ops::nop) break;
+                if(ops[pairs[q]&noVal].opcode == ops::nop) continue;
+                
+                if(csePair(pairs[p]&noVal, pairs[q]&noVal))
+                {
+                    progress = true;
+                }
+            }
+        }
+        return progress;
+    };
+
     bool progress = true, anyProgress = false;
     while(progress)
     {
@@ -567,31 +585,12 @@ bool Proc::opt_cse(bool unsafeOpt)
             // if representative op is different, flush
             if((pairs[j]&~noVal) != (pairs[i]&~noVal))
             {
-                for(int p = j; p < i; ++p)
-                {
-                    for(int q = p+1; q < i; ++q)
-                    {
-                        if(csePair(pairs[p]&noVal, pairs[q]&noVal))
-                        {
-                            progress = true;
-                        }
-                    }
-                }
-    
+                if(cseFlush(j, i)) progress = true;
                 j = i;
             }
         }
         // last set from j to limit
-        for(int p = j; p < limit; ++p)
-        {
-            for(int q = p+1; q < limit; ++q)
-            {
-                if(csePair(pairs[p]&noVal, pairs[q]&noVal))
-                {
-                    progress = true;
-                }
-            }
-        }
+        if(cseFlush(j, limit)) progress = true;
     
         // don't need renames if we found nothing
         if(!progress) break;
@@ -619,19 +618,13 @@ bool Proc::opt_cse(bool unsafeOpt)
             if(op.opcode <= ops::jmp)
             {
                 for(auto & s : blocks[op.label[0]].alts)
-                for(auto & r : rename.map)
-                {
-                    if(s.val == r.src) s.val = r.dst;
-                }
+                    s.val = rename(s.val);
             }
 
             if(op.opcode < ops::jmp)
             {
                 for(auto & s : blocks[op.label[1]].alts)
-                for(auto & r : rename.map)
-                {
-                    if(s.val == r.src) s.val = r.dst;
-                }
+                    s.val = rename(s.val);
             }
         }
     }
@@ -5,6 +5,8 @@ using namespace bjit;
 
 void Proc::opt_dce(bool unsafeOpt)
 {
+    impl::PassTimer timer(stats, CompileStats::dce, passTimer);
+
     bool progress = true;
 
     int iters = 0;
@@ -396,7 +398,7 @@ void Proc::opt_dce(bool unsafeOpt)
         }
     }
     
-    BJIT_LOG("\n DCE:%d", iters);
+    BJIT_TRACE(opt, info, "dce:%d", iters);
 }
 
 void Proc::findUsesBlock(int b, bool inOnly, bool localOnly)
@@ -448,46 +450,166 @@ void Proc::rebuild_livein()
     rebuild_cfg();
     
     BJIT_ASSERT(live.size());
-    
-    for(auto & op : ops)
+
+    // This is the usual backwards dataflow, with one bit per value:
+    //
+    //   out(b) = union of in(s) and phi-sources from b, for s in succ(b)
+    //   in(b) = gen(b) | (out(b) & ~defs(b))
+    //
+    // where gen(b) is the set of upward exposed uses. We keep a worklist
+    // that starts in post-order, so most blocks are final on first visit.
+    unsigned nWords = (ops.size() + 63) >> 6;
+    unsigned nBlocks = blocks.size();
+
+    auto & in = scratch.liveIn;
+    auto & gen = scratch.liveGen;
+    auto & out = scratch.liveOut;
+    auto & order = scratch.liveOrder;
+    auto & queued = scratch.liveQueued;
+
+    scratch.liveWords = nWords;
+    in.assign(nBlocks * nWords, 0);
+    gen.assign(nBlocks * nWords, 0);
+    out.assign(nWords, 0);
+    queued.assign(nBlocks, 0);
+
+    auto setBit = [](uint64_t * set, uint16_t v)
+    { set[v >> 6] |= uint64_t(1) << (v & 63); };
+    auto clearBit = [](uint64_t * set, uint16_t v)
+    { set[v >> 6] &=~(uint64_t(1) << (v & 63)); };
+
+    // find upward exposed uses, this must be done in reverse
+    for(auto b : live)
     {
-        // NOTE: nUse aliases on labels
-        if(op.hasOutput()) op.nUse = 0;
+        auto * g = gen.data() + b * nWords;
+        auto & code = blocks[b].code;
+        for(int c = code.size(); c--;)
+        {
+            if(code[c] == noVal) continue;
+            auto & op = ops[code[c]];
+
+            if(op.hasOutput()) clearBit(g, code[c]);
+
+            switch(op.nInputs())
+            {
+            case 3: setBit(g, op.in[2]);
+            case 2: setBit(g, op.in[1]);
+            case 1: setBit(g, op.in[0]);
+            case 0: break;
+            default: BJIT_ASSERT(false);
+            }
+        }
     }
 
-    for(auto & b : live) blocks[b].livein.clear();
+    // find post-order, so we can push it on a stack in reverse
+    // use queued[] for 1 = visited, 2 = finished, then clear it
+    order.clear();
+    todo.clear();
+    todo.push_back(0);
+    while(todo.size())
+    {
+        auto b = todo.back();
+        if(!queued[b])
+        {
+            queued[b] = 1;
+
+            auto & jmp = ops[blocks[b].code.back()];
+            if(jmp.opcode <= ops::jmp)
+            for(int k = 0; k < 2; ++k)
+            {
+                if(k && jmp.opcode == ops::jmp) break;
+                if(!queued[jmp.label[k]]) todo.push_back(jmp.label[k]);
+            }
+            continue;
+        }
+
+        todo.pop_back();
+        if(queued[b] == 2) continue;
+        queued[b] = 2;
+        order.push_back(b);
+    }
+
+    // worklist, initially reverse post-order so we pop in post-order
+    for(int i = order.size(); i--;)
+    {
+        todo.push_back(order[i]);
+        queued[order[i]] = true;
+    }
 
     int iter = 0;
-    bool progress = true;
-    while(progress)
+    while(todo.size())
     {
         ++iter;
-        progress = false;
 
-        // reverse live almost always requires less iteration
-        for(int b = live.size();b--;)
+        auto b = todo.back();
+        todo.pop_back();
+        queued[b] = false;
+
+        for(unsigned w = 0; w < nWords; ++w) out[w] = 0;
+
+        auto & jmp = ops[blocks[b].code.back()];
+        if(jmp.opcode <= ops::jmp)
+        for(int k = 0; k < 2; ++k)
         {
-            auto sz = blocks[live[b]].livein.size();
+            if(k && jmp.opcode == ops::jmp) break;
 
-            findUsesBlock(live[b], true, false);
-            blocks[live[b]].livein.clear();
-    
-            for(int i = 0; i < ops.size(); ++i)
+            auto * s = in.data() + jmp.label[k] * nWords;
+            for(unsigned w = 0; w < nWords; ++w) out[w] |= s[w];
+            
+            for(auto & a : blocks[jmp.label[k]].alts)
             {
-                // is this a variable that we need?
-                if(!ops[i].hasOutput() || !ops[i].nUse) continue;
+                if(a.src == b) setBit(out.data(), a.val);
+            }
+        }
+
+        for(auto c : blocks[b].code)
+        {
+            if(c != noVal && ops[c].hasOutput()) clearBit(out.data(), c);
+        }
 
-                //BJIT_LOG(" v%04x live in %d\n", i, live[b]);
-                blocks[live[b]].livein.push_back(i);
-                ops[i].nUse = 0;
+        bool changed = false;
+        auto * g = gen.data() + b * nWords;
+        auto * l = in.data() + b * nWords;
+        for(unsigned w = 0; w < nWords; ++w)
+        {
+            uint64_t x = out[w] | g[w];
+            changed |= (x != l[w]);
+            l[w] = x;
+        }
+
+        if(changed)
+        for(auto cf : blocks[b].comeFrom)
+        {
+            if(queued[cf]) continue;
+            queued[cf] = true;
+            todo.push_back(cf);
+        }
+    }
+
+    // materialize the livein lists, in order of value
+    for(auto b : live)
+    {
+        auto & livein = blocks[b].livein;
+        livein.clear();
+        
+        auto * l = in.data() + b * nWords;
+        for(unsigned w = 0; w < nWords; ++w)
+        {
+            for(uint64_t x = l[w]; x; x &= x - 1)
+            {
+                livein.push_back((w << 6) + __builtin_ctzll(x));
             }
-    
-            if(blocks[live[b]].livein.size() != sz) progress = true;
         }
     }
+    
+    for(auto & op : ops)
+    {
+        // NOTE: nUse aliases on labels
+        if(op.hasOutput()) op.nUse = 0;
+    }
 
     if(blocks[0].livein.size()) debug();
     BJIT_ASSERT(!blocks[0].livein.size());
 
-    BJIT_LOG(" Live:%d", iter);
+    BJIT_TRACE(opt, debug, "live:%d", iter);
 }
@@ -1,6 +1,8 @@
 
 #include "bjit.h"
 
+#include <algorithm>
+
 using namespace bjit;
 
 void Proc::rebuild_cfg()
@@ -80,190 +82,205 @@ void Proc::rebuild_cfg()
     }
 }
 
-void Proc::rebuild_dom()
+// Finds immediate dominators of all nodes reachable from entry, using
+// the iterative algorithm from Cooper, Harvey and Kennedy: "A Simple,
+// Fast Dominance Algorithm". The result goes into s.domIdom (noVal for
+// unreachable nodes) and the nodes in reverse post-order into s.domNodes.
+//
+// succ(n, k) and pred(n, k) return the k-th edge or noVal if no more,
+// so that we can run this on the reverse CFG for post-dominators.
+//
+// Returns number of iterations, mostly for debug.
+template <typename Succ, typename Pred>
+static int findIdoms(unsigned nNodes, uint16_t entry,
+    impl::Scratch & s, Succ && succ, Pred && pred)
 {
-    rebuild_cfg();
-    
-    // find dominator algorithm
-    //
-    // start with every node dominating itself
-    // iterate blocks n until no change:
-    //   tdom(n) = blocks
-    //   for p in comeFrom(n):
-    //     tdom(n) = sdom(n) intersect dom(p)
-    //   dom(n) = { n } union sdom(n)
+    auto & order = s.domOrder;
+    auto & nodes = s.domNodes;
+    auto & idom = s.domIdom;
+    auto & stack = s.domStack;
 
+    order.assign(nNodes, noVal);
+    idom.assign(nNodes, noVal);
+    nodes.clear();
+    stack.clear();
 
-    // We run the same algorithm twice, first for post-dominators
-    // then for dominators. We only keep immediate post-dominators
-    // but we rebuild (in order) the full-list for dominators.
-    //
-    // We do post-dominators first so we can use .dom as temp for both
-    // which saves some useless per-block allocation.
-    
-    int domIters = 0;
-    bool iterate = true;
-    std::vector<uint16_t>   tdom;
-    
-    // post dominators first, so we can reuse .dom
-    for(auto & b : live)
+    // DFS for post-order, stack has node in high bits, next edge in low
+    order[entry] = 0;
+    stack.push_back(uint32_t(entry) << 16);
+    while(stack.size())
     {
-        // reset postdominators
-        if(ops[blocks[b].code.back()].opcode > ops::jmp)
+        uint16_t n = stack.back() >> 16;
+        uint16_t t = succ(n, stack.back() & 0xffff);
+        if(t == noVal)
         {
-            blocks[b].dom.clear();
-            blocks[b].dom.push_back(b);
+            nodes.push_back(n);
+            stack.pop_back();
+            continue;
         }
-        else blocks[b].dom = live;
-    }    
-    
+        ++stack.back();
+        if(order[t] != noVal) continue;
+
+        order[t] = 0;   // mark visited
+        stack.push_back(uint32_t(t) << 16);
+    }
+
+    std::reverse(nodes.begin(), nodes.end());
+    for(int i = 0; i < nodes.size(); ++i) order[nodes[i]] = i;
+
+    idom[entry] = entry;
+
+    int iters = 0;
+    bool iterate = true;
     while(iterate)
     {
         iterate = false;
-        ++domIters;
+        ++iters;
 
-        // backwards
-        for(int bi = live.size(); bi--;)
+        for(int i = 1; i < nodes.size(); ++i)
         {
-            auto & b = blocks[live[bi]];
-            auto & jmp = ops[b.code.back()];
-            // this is an exit block
-            if(jmp.opcode > ops::jmp) continue;
-
-            int nLabel = (jmp.opcode == ops::jmp) ? 1 : 2;
+            auto n = nodes[i];
 
-            tdom = live;
-            for(int k = 0; k < nLabel; ++k)
+            uint16_t newIdom = noVal;
+            for(int k = 0;; ++k)
             {
-                for(int t = 0; t < tdom.size();)
+                uint16_t p = pred(n, k);
+                if(p == noVal) break;
+
+                // skip unreachable and not yet processed
+                if(idom[p] == noVal) continue;
+                if(newIdom == noVal) { newIdom = p; continue; }
+
+                // walk up to common dominator, using RPO to compare
+                while(p != newIdom)
                 {
-                    bool found = false;
-                    for(auto & d : blocks[jmp.label[k]].dom)
-                    {
-                        if(d == tdom[t]) found = true;
-                    }
-                    
-                    if(found) { ++t; }
-                    else
-                    {
-                        std::swap(tdom[t], tdom.back());
-                        tdom.pop_back();
-                    }
+                    while(order[p] > order[newIdom]) p = idom[p];
+                    while(order[newIdom] > order[p]) newIdom = idom[newIdom];
                 }
             }
-            
-            bool foundSelf = false;
-            for(auto & t : tdom)
-            { if(t != live[bi]) continue; foundSelf = true; break; }
-    
-            if(!foundSelf) tdom.push_back(live[bi]);
-            if(tdom.size() != b.dom.size()) iterate = true;
 
-            // save copy, we'll reset tdom above anyway
-            std::swap(b.dom, tdom);
+            if(idom[n] != newIdom) { idom[n] = newIdom; iterate = true; }
         }
     }
 
-    // push theoretical exit-block (unifies multiple returns)
-    for(auto & b : live) { blocks[b].dom.push_back(noVal); }
+    return iters;
+}
+
+void Proc::rebuild_dom()
+{
+    rebuild_cfg();
+
+    // We find post-dominators first, on the reverse CFG with a
+    // theoretical exit-block that unifies multiple returns, then
+    // dominators. Only the immediate (post-)dominators are stored,
+    // but we number the dominator tree in DFS order so that we can
+    // answer dominance queries in O(1), see dominates().
+    //
+    // Blocks that never reach an exit (eg. infinite loops) and blocks
+    // post-dominated only by the exit get pdom = noVal.
+
+    uint16_t exit = blocks.size();
 
-    // find immediate post-dominators: we use the fact that the immediate
-    // dominator must have exactly one less dominator
+    auto jumpTarget = [&](uint16_t b, int k) -> uint16_t
+    {
+        auto & jmp = ops[blocks[b].code.back()];
+        if(jmp.opcode > ops::jmp) return noVal;
+        if(k >= (jmp.opcode == ops::jmp ? 1 : 2)) return noVal;
+        return jmp.label[k];
+    };
+
+    // The result only depends on the live blocks (in order) and their
+    // jump targets, so if these haven't changed since the last time,
+    // then everything is still valid. The passes often call us when
+    // they only changed code within blocks, so this saves a lot of work.
+    //
+    // newBlock() clears the old CFG, because breakEdge() and friends
+    // patch dominators of existing blocks, which we would then miss.
+    auto & cfg = scratch.domCfg;
+    auto & cfgNew = scratch.domCfgNew;
+    cfgNew.clear();
     for(auto & b : live)
     {
-        blocks[b].pdom = noVal;
-        for(auto & d : blocks[b].dom)
-        {
-            if(d == noVal) continue;   // no common post-dominator
-            if(blocks[d].dom.size() == blocks[b].dom.size() - 1)
-            {
-                blocks[b].pdom = d;
-                break;
-            }
-        }
+        cfgNew.push_back(b);
+        cfgNew.push_back(jumpTarget(b, 0));
+        cfgNew.push_back(jumpTarget(b, 1));
     }
-    
-    // forward pass
+    if(optSparse && cfg == cfgNew) return;
+    std::swap(cfg, cfgNew);
+
+    auto comeFrom = [&](uint16_t b, int k) -> uint16_t
+    {
+        auto & cf = blocks[b].comeFrom;
+        return k < cf.size() ? cf[k] : noVal;
+    };
+
+    // collect exit blocks, todo is free after rebuild_cfg()
+    todo.clear();
     for(auto & b : live)
     {
-        // reset dominators
-        if(!b) {
-            blocks[b].dom.clear();
-            blocks[b].dom.push_back(b);
-        }
-        else blocks[b].dom = live;
+        if(ops[blocks[b].code.back()].opcode > ops::jmp) todo.push_back(b);
     }
-    
-    iterate = true;
-    while(iterate)
-    {
-        iterate = false;
-        ++domIters;
 
-        for(auto & b : live)
+    int domIters = findIdoms(exit + 1, exit, scratch,
+        [&](uint16_t b, int k) -> uint16_t
+        {
+            if(b != exit) return comeFrom(b, k);
+            return k < todo.size() ? todo[k] : noVal;
+        },
+        [&](uint16_t b, int k) -> uint16_t
         {
-            // this is entry block
-            if(!b) continue;
-            BJIT_ASSERT(blocks[b].comeFrom.size());
+            if(ops[blocks[b].code.back()].opcode > ops::jmp)
+                return k ? noVal : exit;
+            return jumpTarget(b, k);
+        });
+    todo.clear();
 
-            tdom = live;
-            for(auto & f : blocks[b].comeFrom)
-            {
-                for(int t = 0; t < tdom.size();)
-                {
-                    bool found = false;
-                    for(auto & d : blocks[f].dom)
-                    {
-                        if(d == tdom[t]) found = true;
-                    }
-                    
-                    if(found) { ++t; }
-                    else
-                    {
-                        std::swap(tdom[t], tdom.back());
-                        tdom.pop_back();
-                    }
-                }
-            }
-            
-            bool foundSelf = false;
-            for(auto & t : tdom) { if(t != b) continue; foundSelf = true; break; }
-    
-            if(!foundSelf) tdom.push_back(b);
-            if(tdom.size() != blocks[b].dom.size()) iterate = true;
+    for(auto & b : live)
+    {
+        auto pdom = scratch.domIdom[b];
+        blocks[b].pdom = (pdom == exit) ? noVal : pdom;
+    }
 
-            // save copy, we'll reset tdom above anyway
-            std::swap(blocks[b].dom, tdom);
-        }
+    // then dominators
+    domIters += findIdoms(exit, 0, scratch, jumpTarget, comeFrom);
+
+    // forget stale numbering, also for dead blocks
+    for(auto & b : blocks) b.domPre = b.domPost = noVal;
+
+    auto & nodes = scratch.domNodes;
+    auto & idom = scratch.domIdom;
+    auto & size = scratch.domOrder;     // reuse as subtree sizes
+
+    BJIT_ASSERT(nodes.size() == live.size());
+
+    // dominators always come first in RPO, so compute depths
+    // in RPO, then sizes of dominator subtrees in reverse
+    for(auto b : nodes)
+    {
+        blocks[b].idom = b ? idom[b] : 0;
+        blocks[b].domDepth = b ? blocks[idom[b]].domDepth + 1 : 1;
+        size[b] = 1;
     }
-    
-    // find immediate dominators: we use the fact that the immediate
-    // dominator must have exactly one less dominator
-    for(auto & b : live)
+    for(int i = nodes.size(); --i;) size[idom[nodes[i]]] += size[nodes[i]];
+
+    // assign each subtree a range of pre-order numbers, we use
+    // domPost temporarily to track the next free number
+    blocks[0].domPre = 0;
+    blocks[0].domPost = 1;
+    for(int i = 1; i < nodes.size(); ++i)
     {
-        blocks[b].idom = 0;
-        
-        for(auto & d : blocks[b].dom)
-        {
-            if(blocks[d].dom.size() == blocks[b].dom.size() - 1)
-            {
-                blocks[b].idom = d;
-                break;
-            }
-        }
-        
+        auto b = nodes[i];
+        auto & d = blocks[idom[b]];
+        blocks[b].domPre = d.domPost;
+        blocks[b].domPost = d.domPost + 1;
+        d.domPost += size[b];
     }
 
-    // order dominators; we use these for CCD in CSE
-    for(auto & b : live)
+    // domPost is the last number in the subtree
+    for(auto b : nodes)
     {
-        for(auto & d : blocks[b].dom) d = noVal;
-        for(int d = b, i = blocks[b].dom.size(); i--;)
-        {
-            blocks[b].dom[i] = d;
-            d = blocks[d].idom;
-        }
+        blocks[b].domPost = blocks[b].domPre + size[b] - 1;
     }
 
-    BJIT_LOG(" Dom:%d", domIters);
-};
\ No newline at end of file
+    BJIT_TRACE(opt, debug, "dom:%d", domIters);
+};
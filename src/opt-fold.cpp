@@ -36,12 +36,15 @@ such the speculative further optimizations fail to materialize.
 */
 bool Proc::opt_fold(bool unsafeOpt)
 {
+    impl::PassTimer timer(stats, CompileStats::fold, passTimer);
+
     //debug();
     rebuild_dom();
     
     BJIT_ASSERT(live.size());   // should have at least one DCE pass done
 
-    impl::Rename rename;
+    auto & rename = scratch.rename;
+    rename.clear();
 
     int iter = 0;
 
@@ -49,8 +52,8 @@ bool Proc::opt_fold(bool unsafeOpt)
     // otherwise we run into infinite loops
     auto shouldSwap = [&](uint16_t op1, uint16_t op2) -> bool
     {
-        auto ndom1 = blocks[ops[op1].block].dom.size();
-        auto ndom2 = blocks[ops[op2].block].dom.size();
+        auto ndom1 = blocks[ops[op1].block].domDepth;
+        auto ndom2 = blocks[ops[op2].block].domDepth;
 
         if(ndom1 < ndom2) return true;
         if(ndom1 > ndom2) return false;
@@ -82,19 +85,13 @@ bool Proc::opt_fold(bool unsafeOpt)
                 if(op.opcode <= ops::jmp)
                 {
                     for(auto & s : blocks[op.label[0]].alts)
-                    for(auto & r : rename.map)
-                    {
-                        if(s.val == r.src) s.val = r.dst;
-                    }
+                        s.val = rename(s.val);
                 }
     
                 if(op.opcode < ops::jmp)
                 {
                     for(auto & s : blocks[op.label[1]].alts)
-                    for(auto & r : rename.map)
-                    {
-                        if(s.val == r.src) s.val = r.dst;
-                    }
+                        s.val = rename(s.val);
                 }
 
                 // catch phi-rewriting problems early
@@ -321,7 +318,6 @@ bool Proc::opt_fold(bool unsafeOpt)
                 if((I(ops::jieqI) || I(ops::jineI)) && !op.imm32)
                 {
                     op.opcode = I(ops::jieqI) ? ops::jz : ops::jnz;
-                    op.in[0] = noVal;
                     progress = true; PRINTLN;
                 }
 
@@ -1515,7 +1511,7 @@ bool Proc::opt_fold(bool unsafeOpt)
     }
 
     //debug();
-    BJIT_LOG(" Fold:%d", iter);
+    BJIT_TRACE(opt, info, "fold:%d", iter);
 
     return anyProgress;
 }
@@ -35,8 +35,7 @@ bool Proc::opt_jump_be(uint16_t b)
     auto target = jmp.label[0];
 
     // does the target dominate?
-    if(blocks[b].dom.size() <= blocks[target].dom.size()
-    || blocks[b].dom[blocks[target].dom.size()-1] != target)
+    if(b == target || !dominates(target, b))
     {
         if(jump_debug) BJIT_LOG(" JUMP:%d target doesn't dominate\n", b);
         return false;
@@ -50,10 +49,8 @@ bool Proc::opt_jump_be(uint16_t b)
         return false;
     }
 
-    if(jump_debug)
-        BJIT_LOG(" LOOP:%d (%d:%d,%d)", b, target, jcc.label[0], jcc.label[1]);
-    else
-        BJIT_LOG(" LOOP:%d", b);
+    BJIT_TRACE(opt, debug, "loop:%d (%d:%d,%d)",
+        b, target, jcc.label[0], jcc.label[1]);
 
     // break edges if target has phis (valid or not)
     if(ops[blocks[jcc.label[0]].code[0]].opcode == ops::phi)
@@ -66,15 +63,13 @@ bool Proc::opt_jump_be(uint16_t b)
     }
     
     // Make a carbon-copy of the target block
-    uint16_t nb = blocks.size();
-    blocks.resize(blocks.size() + 1);
+    uint16_t nb = newBlock();
     if(jump_debug) BJIT_LOG("\n Jump L%d -> L%d (was: L%d)\n", b, nb, target);
 
     auto & head = blocks[target];
     auto & copy = blocks[nb];
     copy.flags.live = true;
-    copy.dom = blocks[b].dom;
-    copy.dom.push_back(nb);
+    copy.domDepth = blocks[b].domDepth + 1;
     copy.idom = b;
     copy.pdom = blocks[b].pdom; // shouldn't REALLY need pdoms, but fix anyway
     blocks[b].pdom = nb;
@@ -85,8 +80,10 @@ bool Proc::opt_jump_be(uint16_t b)
     // we copy all the phis too
     copy.args.resize(head.args.size());
 
-    impl::Rename    renameCopy;
-    impl::Rename    renameJump;
+    auto & renameCopy = scratch.rename;
+    auto & renameJump = scratch.renameAlt;
+    renameCopy.clear();
+    renameJump.clear();
     
     BJIT_ASSERT(head.code.size());
     for(int i = 0; i < head.code.size(); ++i)
@@ -198,7 +195,7 @@ bool Proc::opt_jump_be(uint16_t b)
         auto & fixBlock = blocks[fb];
         if(fixBlock.idom != target) continue;
 
-        renameCopy.map.clear();
+        renameCopy.clear();
         // filter renames relevant to this block
         for(auto & r : renameJump.map)
         {
@@ -208,26 +205,13 @@ bool Proc::opt_jump_be(uint16_t b)
         // find all blocks dominated by this block
         for(auto rb : live)
         {
-            // we need to do this the old-fashioned way because
-            // break-edge doesn't try to fix .dom globally
-            bool found = false;
-            for(int db = rb; db; db = blocks[db].idom)
-            {
-                if(db != fb) continue;
-                found = true;
-                break;
-            }
-            if(!found) continue;
+            if(!dominates(fb, rb)) continue;
             
             if(jump_debug)
                 BJIT_LOG("Renaming L%d in branch %d\n", rb, fb);
 
             // rename livein for better debugs
-            for(auto & in : blocks[rb].livein)
-            for(auto & r : renameCopy.map)
-            {
-                if(in == r.src) in = r.dst;
-            }
+            for(auto & in : blocks[rb].livein) in = renameCopy(in);
                 
             for(auto & rop : blocks[rb].code)
             {
@@ -288,12 +272,14 @@ bool Proc::opt_jump_be(uint16_t b)
 
 bool Proc::opt_jump()
 {
+    impl::PassTimer timer(stats, CompileStats::jump, passTimer);
+
     rebuild_dom();      // don't need this if after CSE
     rebuild_livein();   // don't need this if after sink
 
     if(jump_debug) debug();
     
-    BJIT_LOG(" JUMP");
+    BJIT_TRACE(opt, info, "jump");
     
     bool progress = false;
     for(int li = 0, liveSz = live.size(); li < liveSz; ++li)
@@ -333,7 +319,7 @@ bool Proc::opt_jump()
                 }
             }
 
-            BJIT_LOG(" MERGE");
+            BJIT_TRACE(opt, debug, "merge");
             progress = true;
             break;
         }
@@ -407,7 +393,7 @@ void Proc::find_ivs()
     //debug();
     // detect IVs
     rebuild_dom();
-    BJIT_LOG(" IV");
+    BJIT_TRACE(opt, debug, "iv");
     for(auto & b : live)
     {
         for(auto & p : blocks[b].args)
@@ -446,24 +432,16 @@ void Proc::find_ivs()
                     if(findSource(val.in[1]) == a.phi)
                     {
                         // other operand must dominate PHI
-                        for(auto & d : blocks[blocks[b].idom].dom)
-                        {
-                            if(ops[val.in[0]].block != d) continue;
+                        if(dominates(ops[val.in[0]].block, blocks[b].idom))
                             phi.iv = avs;
-                            break;
-                        }
-                        if(phi.iv != avs) phi.iv = noVal;
+                        else phi.iv = noVal;
                     }
                     else if(findSource(val.in[0]) == a.phi)
                     {
                         // other operand must dominate PHI
-                        for(auto & d : blocks[blocks[b].idom].dom)
-                        {
-                            if(ops[val.in[1]].block != d) continue;
+                        if(dominates(ops[val.in[1]].block, blocks[b].idom))
                             phi.iv = avs;
-                            break;
-                        }
-                        if(phi.iv != avs) phi.iv = noVal;
+                        else phi.iv = noVal;
                     }
                     break;
                 case 1:
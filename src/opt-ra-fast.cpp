@@ -0,0 +1,381 @@
+
+#include "bjit.h"
+
+using namespace bjit;
+
+static const bool fast_sanity = false;  // run sanity() after, slow
+
+// Register allocation for levelOpt 0, trading code quality for speed.
+//
+// This works on one block at a time and keeps nothing in registers from
+// one block to the next: every value used by another block (and every phi)
+// gets a stack slot of its own and is stored where it is defined. Jumps
+// store the phi sources into the slots of the phis, so phis are no-ops like
+// with allocRegs(), but we never need SCCs, live-in sets or shuffle blocks.
+//
+// Inside a block we pick the first free register and if there are none,
+// throw out something that is cheap to get back: constants are always
+// rematerialized and other values are spilled at their definition.
+void Proc::allocRegsFast()
+{
+    impl::PassTimer timer(stats, CompileStats::ra, passTimer);
+
+    // explicitly do one DCE so we have live blocks and phis are clean
+    opt_dce();
+
+    BJIT_TRACE(ra, debug, "ra:fast");
+
+    // we can't store phi sources before a two-way jump
+    // so break any edge that has them, even if not critical
+    for(int li = 0, liveSz = live.size(); li < liveSz; ++li)
+    {
+        auto b = live[li];
+        auto c = blocks[b].code.back();
+
+        if(ops[c].opcode < ops::jmp)
+        for(int k = 0; k < 2; ++k)
+        {
+            for(auto & s : blocks[ops[c].label[k]].alts)
+            {
+                if(s.src != b) continue;
+
+                ops[c].label[k] = breakEdge(b, ops[c].label[k]);
+                break;
+            }
+        }
+    }
+
+    auto isConst = [&](uint16_t v) -> bool
+    {
+        return ops[v].canCSE() && !ops[v].nInputs();
+    };
+
+    // give a value a slot, if it's not a phi then store at definition
+    BJIT_ASSERT(!nSlots);
+    auto needSlot = [&](uint16_t v)
+    {
+        if(ops[v].scc != noSCC) return;
+        if(ops[v].opcode == ops::alloc || isConst(v)) return;
+
+        ops[v].scc = nSlots++;
+        if(ops[v].opcode != ops::phi) ops[v].flags.spill = true;
+    };
+
+    // nUse counts uses in the defining block only (including phi sources
+    // on jumps out of it), anything used by other blocks goes to stack
+    for(auto b : live)
+    {
+        for(auto c : blocks[b].code) if(ops[c].hasOutput()) ops[c].nUse = 0;
+    }
+
+    for(auto b : live)
+    {
+        for(auto c : blocks[b].code)
+        {
+            auto & op = ops[c];
+            if(op.opcode == ops::phi) needSlot(c);
+
+            for(int i = 0; i < op.nInputs(); ++i)
+            {
+                if(ops[op.in[i]].block == b) ++ops[op.in[i]].nUse;
+                else needSlot(op.in[i]);
+            }
+        }
+
+        for(auto & s : blocks[b].alts)
+        {
+            if(s.val == s.phi) continue;
+
+            if(ops[s.val].block == s.src) ++ops[s.val].nUse;
+            else needSlot(s.val);
+        }
+    }
+
+    // registers we may allocate at all, see setFramePointer()
+    RegMask allowed = framePointer ? ~regs::mask_frame : ~RegMask(0);
+
+    auto & codeOut = scratch.codeOut;
+
+    uint16_t    regstate[regs::nregs];  // value in each register
+    uint16_t    regop[regs::nregs];     // the op that put it there
+
+    RegMask     busy = 0;               // inputs of the current op
+    RegMask     pinned = 0;             // arguments until the call
+
+    uint16_t    b = 0;
+
+    auto emit = [&](uint16_t opcode, Op::Type type, int reg) -> uint16_t
+    {
+        uint16_t i = newOp(opcode, type, b);
+        ops[i].reg = reg;
+        codeOut.push_back(i);
+        return i;
+    };
+
+    // throw a value out of a register, moving it to a free one
+    // (not in avoid) if we still need it and have no way to get it back
+    auto evict = [&](int r, RegMask avoid)
+    {
+        auto v = regstate[r];
+        regstate[r] = noVal;
+
+        if(v == noVal || !ops[v].nUse || ops[v].block != b) return;
+        if(ops[v].scc != noSCC || isConst(v)) return;
+
+        for(int s = 0; s < regs::nregs; ++s) if(regstate[s] == v) return;
+
+        RegMask mask = ops[v].regsMask() & allowed
+            & ~(avoid | busy | pinned | R2Mask(r));
+        for(int s = 0; s < regs::nregs; ++s)
+        {
+            if(!(R2Mask(s) & mask) || regstate[s] != noVal) continue;
+
+            regop[s] = emit(ops::rename, ops[v].flags.type, s);
+            ops[regop[s]].in[0] = regop[r];
+            regstate[s] = v;
+            return;
+        }
+
+        needSlot(v);
+    };
+
+    // find a register in mask, free one if necessary
+    auto findReg = [&](RegMask mask, RegMask avoid, int prefer) -> int
+    {
+        mask &= allowed &~(avoid | pinned);
+        BJIT_ASSERT(mask);
+
+        if(prefer != regs::nregs && (R2Mask(prefer) & mask)
+        && regstate[prefer] == noVal) return prefer;
+
+        // free, then dropped for free, then reloaded, then spilled
+        int best = regs::nregs, bestCost = 3;
+        for(int r = 0; r < regs::nregs; ++r)
+        {
+            if(!(R2Mask(r) & mask)) continue;
+
+            auto v = regstate[r];
+            if(v == noVal) return r;
+
+            int cost = 2;
+            if(isConst(v) || !ops[v].nUse) cost = 0;
+            else if(ops[v].block != b || ops[v].scc != noSCC) cost = 1;
+            else for(int s = 0; s < regs::nregs; ++s)
+            {
+                if(s != r && regstate[s] == v) { cost = 0; break; }
+            }
+
+            if(cost < bestCost) { best = r; bestCost = cost; }
+        }
+
+        evict(best, avoid);
+        return best;
+    };
+
+    // returns an op that has value v in a register in mask
+    auto use = [&](uint16_t v, RegMask mask) -> uint16_t
+    {
+        // user-requested frame is always in the stack pointer
+        if(ops[v].opcode == ops::alloc && (R2Mask(ops[v].reg) & mask))
+            return v;
+
+        uint16_t src = (ops[v].opcode == ops::alloc) ? v : noVal;
+        for(int r = 0; r < regs::nregs; ++r)
+        {
+            if(regstate[r] != v) continue;
+            if(R2Mask(r) & mask) return regop[r];
+            src = regop[r];
+        }
+
+        int t = findReg(mask & ops[v].regsMask(), busy, regs::nregs);
+
+        uint16_t c;
+        if(src != noVal)
+        {
+            c = emit(ops::rename, ops[v].flags.type, t);
+            ops[c].in[0] = src;
+        }
+        else if(isConst(v))
+        {
+            c = emit(ops[v].opcode, ops[v].flags.type, t);
+            ops[c].i64 = ops[v].i64;
+        }
+        else
+        {
+            BJIT_ASSERT(ops[v].scc != noSCC);
+            c = emit(ops::reload, ops[v].flags.type, t);
+            ops[c].in[0] = v;
+        }
+
+        regstate[t] = v;
+        regop[t] = c;
+        return c;
+    };
+
+    // one use of a value done, free registers after the last one
+    auto release = [&](uint16_t v)
+    {
+        if(ops[v].block != b || --ops[v].nUse) return;
+
+        for(int r = 0; r < regs::nregs; ++r)
+        {
+            if(regstate[r] == v) regstate[r] = noVal;
+        }
+    };
+
+    // store phi sources into the slots of the phis in target
+    auto storePhis = [&](uint16_t target)
+    {
+        auto & alts = blocks[target].alts;
+
+        // if a source is a phi that we're about to overwrite, then
+        // load it first and treat the copy as a new value instead
+        for(auto & s : alts)
+        {
+            if(s.src != b || s.val == s.phi) continue;
+            if(ops[s.val].opcode != ops::phi
+            || ops[s.val].block != target) continue;
+
+            bool written = false;
+            for(auto & w : alts)
+            {
+                if(w.src != b || w.phi != s.val || w.val == w.phi) continue;
+                written = true;
+                break;
+            }
+            if(!written) continue;
+
+            auto c = use(s.val, ops[s.val].regsMask());
+            for(int r = 0; r < regs::nregs; ++r)
+            {
+                if(regop[r] == c && regstate[r] == s.val) regstate[r] = c;
+            }
+            ops[c].nUse = 1;
+
+            release(s.val);
+            s.val = c;
+        }
+
+        for(auto & s : alts)
+        {
+            if(s.src != b || s.val == s.phi) continue;
+
+            auto c = use(s.val, ops[s.val].regsMask());
+
+            // this rename is free, we just want the store
+            auto st = emit(ops::rename, ops[s.phi].flags.type, ops[c].reg);
+            ops[st].in[0] = c;
+            ops[st].scc = ops[s.phi].scc;
+            ops[st].flags.spill = true;
+
+            release(s.val);
+            s.val = st;
+        }
+    };
+
+    for(auto bi : live)
+    {
+        b = bi;
+        codeOut.clear();
+
+        for(int r = 0; r < regs::nregs; ++r) regstate[r] = noVal;
+        pinned = 0;
+
+        for(auto opIndex : blocks[b].code)
+        {
+            auto & op = ops[opIndex];
+
+            // phis live in their slots
+            if(op.opcode == ops::phi)
+            {
+                codeOut.push_back(opIndex);
+                continue;
+            }
+
+            // user-requested frame lives in the stack pointer
+            if(op.opcode == ops::alloc)
+            {
+                RegMask mask = op.regsOut();
+                op.reg = 0;
+                while(!(R2Mask(op.reg) & mask)) ++op.reg;
+
+                codeOut.push_back(opIndex);
+                continue;
+            }
+
+            if(op.opcode == ops::jmp) storePhis(op.label[0]);
+
+            uint16_t in[3];
+            busy = 0;
+            for(int i = 0; i < op.nInputs(); ++i)
+            {
+                in[i] = op.in[i];
+                op.in[i] = use(in[i], op.regsIn(i));
+                busy |= R2Mask(ops[op.in[i]].reg);
+            }
+
+            for(int i = 0; i < op.nInputs(); ++i) release(in[i]);
+
+            // argument registers must survive until the call
+            if(op.opcode == ops::ipass
+            || op.opcode == ops::fpass
+            || op.opcode == ops::dpass)
+            {
+                pinned |= busy;
+            }
+            else
+            {
+                pinned = 0;
+
+                RegMask lost = op.regsLost();
+                for(int r = 0; r < regs::nregs; ++r)
+                {
+                    if(R2Mask(r) & lost) evict(r, lost);
+                }
+            }
+
+            if(op.hasOutput())
+            {
+                RegMask mask = op.regsOut();
+                int prefer = regs::nregs;
+
+                if(!arch_explicit_output_regs && op.nInputs())
+                {
+                    // try to reuse the first operand, like the ISA does
+                    prefer = ops[op.in[0]].reg;
+
+                    // and don't overwrite the second operand with it
+                    if(!op.anyOutReg() && op.nInputs() > 1
+                    && ops[op.in[0]].reg != ops[op.in[1]].reg
+                    && (mask &~R2Mask(ops[op.in[1]].reg)))
+                        mask &=~R2Mask(ops[op.in[1]].reg);
+                }
+
+                op.reg = findReg(mask, 0, prefer);
+
+                regstate[op.reg] = ops[opIndex].nUse ? opIndex : noVal;
+                regop[op.reg] = opIndex;
+            }
+
+            busy = 0;
+            codeOut.push_back(opIndex);
+        }
+
+        std::swap(blocks[b].code, codeOut);
+    }
+    codeOut.clear();
+
+    opt_dce();
+
+    raDone = true;
+    BJIT_TRACE(ra, info, "ra: %d slots", nSlots);
+
+    // sanity() checks against live-in sets from before its own DCE,
+    // which can still collapse phis of edges we broke, so do that first
+    if(fast_sanity)
+    {
+        rebuild_cfg();
+        opt_dce();
+        sanity();
+    }
+}
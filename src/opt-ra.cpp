@@ -12,6 +12,8 @@ static const bool fix_sanity = true;    // whether to fix sanity for shuffles
 
 void Proc::allocRegs(bool unsafeOpt)
 {
+    impl::PassTimer timer(stats, CompileStats::ra, passTimer);
+
     // explicitly do one DCE so non-optimized builds work
     opt_dce();
     findSCC();
@@ -21,11 +23,12 @@ void Proc::allocRegs(bool unsafeOpt)
     rebuild_dom();
     rebuild_livein();
 
-    BJIT_LOG(" RA:PHI");
+    BJIT_TRACE(ra, debug, "ra:phi");
     
     // reintroduce phis to all blocks with live-in variables
-    impl::Rename rename;
-    impl::Rename renameBlock;
+    auto & rename = scratch.rename;
+    auto & renameBlock = scratch.renameAlt;
+    rename.clear();
     for(auto b : live)
     {
         if(!blocks[b].livein.size()) continue;
@@ -58,24 +61,14 @@ void Proc::allocRegs(bool unsafeOpt)
 
     for(auto b : live)
     {
-        renameBlock.map.clear();
+        renameBlock.clear();
         
         // we need to do this manually here
         // because we want the LAST rename that dominates
         for(int j = rename.map.size(); j--;)
         {
             auto & r = rename.map[j];
-            
-            bool found = false;
-            int idom = b;
-            while(idom)
-            {
-                if(ops[r.dst].block == idom) found = true;
-                idom = blocks[idom].idom;
-            }
-            if(!found) continue;
-
-            renameBlock.map.push_back(r);
+            if(dominates(ops[r.dst].block, b)) renameBlock.add(r.src, r.dst);
         }
 
         // rename the block
@@ -94,11 +87,7 @@ void Proc::allocRegs(bool unsafeOpt)
 
                 for(auto & a : blocks[op.label[k]].alts)
                 {
-                    if(a.src != b) continue;
-                    for(auto & r : renameBlock.map)
-                    {
-                        if(a.val == r.src) a.val = r.dst;
-                    }
+                    if(a.src == b) a.val = renameBlock(a.val);
                 }
             }
         }
@@ -106,9 +95,13 @@ void Proc::allocRegs(bool unsafeOpt)
 
     rebuild_memtags(unsafeOpt);
 
-    BJIT_LOG(" RA:BB");
+    BJIT_TRACE(ra, debug, "ra:bb");
 
-    std::vector<uint16_t>   codeOut;
+    auto & codeOut = scratch.codeOut;
+    codeOut.clear();
+
+    // registers we may allocate at all, see setFramePointer()
+    RegMask allowed = framePointer ? ~regs::mask_frame : ~RegMask(0);
 
     for(auto b : live)
     {
@@ -134,15 +127,8 @@ void Proc::allocRegs(bool unsafeOpt)
         // cleanup stale renames
         for(auto & r : rename.map)
         {
-            bool found = false;
-            int idom = b;
-            while(idom)
-            {
-                idom = blocks[idom].idom;
-                if(ops[r.dst].block == idom) found = true;
-            }
-
-            if(!found) r.src = r.dst;   // won't match anything
+            auto rb = ops[r.dst].block;
+            if(rb == b || !dominates(rb, b)) r.src = r.dst;
         }
 
         {
@@ -153,6 +139,8 @@ void Proc::allocRegs(bool unsafeOpt)
                 if(i != j) rename.map[j] = rename.map[i];
                 ++j;
             }
+            rename.map.erase(rename.map.begin() + j, rename.map.end());
+            rename.rebuild();
         }
 
         if(ra_debug) BJIT_LOG("L%d:\n", b);
@@ -183,6 +171,7 @@ void Proc::allocRegs(bool unsafeOpt)
         // and try to satisfy input constraints
         auto findBest = [&](RegMask mask, int reg, int c, uint16_t val=noVal) -> int
         {
+            mask &= allowed;
             if(!mask) return regs::nregs;
 
             // if preferred register is impossible, clear it
@@ -318,12 +307,8 @@ void Proc::allocRegs(bool unsafeOpt)
                 if(k && op.opcode == ops::jmp) break;
 
                 for(auto & s : blocks[op.label[k]].alts)
-                for(auto & r : rename.map)
                 {
-                    if(s.src == b && s.val == r.src)
-                    {
-                        s.val = r.dst;
-                    }
+                    if(s.src == b) s.val = rename(s.val);
                 }
             }
 
@@ -390,7 +375,7 @@ void Proc::allocRegs(bool unsafeOpt)
                 {
                     for(int r = 0; r < regs::nregs; ++r)
                     {
-                        if((R2Mask(r) & (mask &~usedRegsBlock))
+                        if((R2Mask(r) & allowed & (mask &~usedRegsBlock))
                         && regstate[r] == noVal)
                         {
                             regstate[r] = op.in[i];
@@ -861,9 +846,10 @@ void Proc::allocRegs(bool unsafeOpt)
     // do NOT DCE here, we need to keep "useless" phi's for shuffling
     if(ra_debug) debug();
 
-    BJIT_LOG(" RA:JMP");
+    BJIT_TRACE(ra, debug, "ra:jmp");
 
-    std::vector<uint16_t>   newBlocks;
+    auto & newBlocks = scratch.newBlocks;
+    newBlocks.clear();
     
     // compute jump-shuffles
     for(auto b : live)
@@ -876,7 +862,9 @@ void Proc::allocRegs(bool unsafeOpt)
             memcpy(sregs, blocks[b].regsOut, sizeof(sregs));
             memcpy(tregs, blocks[target].regsIn, sizeof(tregs));
 
-            impl::Rename rename;  // for correcting target PHIs
+            // for correcting target PHIs
+            auto & rename = scratch.renameAlt;
+            rename.clear();
 
             if(ra_debug) BJIT_LOG("Args L%d (L%d)-> L%d\n", b, out, target);
 
@@ -901,7 +889,7 @@ void Proc::allocRegs(bool unsafeOpt)
                     }
                     else
                     {
-                        BJIT_LOG("PHI LOOP: phi %04x, Broken SCCs?\n", s.phi);
+                        BJIT_TRACE(ra, error, "phi loop: phi %04x, broken SCCs?", s.phi);
                         BJIT_ASSERT(false);
                     }
                 }
@@ -1008,7 +996,7 @@ void Proc::allocRegs(bool unsafeOpt)
                         if(sregs[s] == tregs[t])
                         {
                             // figure out the correct register type
-                            RegMask mask = ops[tregs[t]].regsMask();
+                            RegMask mask = ops[tregs[t]].regsMask() & allowed;
 
                             // if source register is free in target
                             // then we don't need to move it
@@ -1144,11 +1132,7 @@ void Proc::allocRegs(bool unsafeOpt)
             }
 
             // rename target PHI values (but not block, we do it below)
-            for(auto & s : blocks[target].alts)
-            for(auto & r : rename.map)
-            {
-                if(s.val == r.src) s.val = r.dst;
-            }
+            for(auto & s : blocks[target].alts) s.val = rename(s.val);
             
             memcpy(blocks[out].regsOut, sregs, sizeof(sregs));
         };
@@ -1164,9 +1148,8 @@ void Proc::allocRegs(bool unsafeOpt)
         {
             // create some shuffle blocks
             // try to fix enough stuff for debug() to be happy
-            int b0 = blocks.size();
-            int b1 = blocks.size() + 1;
-            blocks.resize(blocks.size() + 2);
+            int b0 = newBlock();
+            int b1 = newBlock();
 
             blocks[b0].code.push_back(newOp(ops::jmp, Op::_none, b0));
             ops[blocks[b0].code.back()].label[0] = op.label[0];
@@ -1183,8 +1166,7 @@ void Proc::allocRegs(bool unsafeOpt)
                 // DCE won't rebuild, 'cos nothing dead
                 if(fix_sanity)
                 {
-                    blocks[b0].dom = blocks[b].dom;
-                    blocks[b0].dom.push_back(b1);
+                    blocks[b0].domDepth = blocks[b].domDepth + 1;
                     blocks[b0].idom = b;
                     blocks[b0].pdom = blocks[b].pdom;
                     blocks[b0].comeFrom.push_back(b);
@@ -1216,8 +1198,7 @@ void Proc::allocRegs(bool unsafeOpt)
                 // DCE won't rebuild, 'cos nothing dead
                 if(fix_sanity)
                 {
-                    blocks[b1].dom = blocks[b].dom;
-                    blocks[b1].dom.push_back(b1);
+                    blocks[b1].domDepth = blocks[b].domDepth + 1;
                     blocks[b1].idom = b;
                     blocks[b1].pdom = blocks[b].pdom;
                     blocks[b1].comeFrom.push_back(b);
@@ -1305,7 +1286,8 @@ void Proc::allocRegs(bool unsafeOpt)
     }
 
     // find slots
-    std::vector<bool>   sccUsed;
+    auto & sccUsed = scratch.sccUsed;
+    sccUsed.clear();
     
     // Cleanup and find slots
     for(auto & op : ops)
@@ -1326,7 +1308,8 @@ void Proc::allocRegs(bool unsafeOpt)
         if(op.flags.spill) sccUsed[op.scc] = true;
     }
 
-    std::vector<uint16_t>   slots(sccUsed.size(), 0xffff);
+    auto & slots = scratch.slots;
+    slots.assign(sccUsed.size(), 0xffff);
     BJIT_ASSERT(!nSlots);
     for(int s = 0; s < slots.size(); ++s)
         if(sccUsed[s]) slots[s] = nSlots++;
@@ -1334,7 +1317,7 @@ void Proc::allocRegs(bool unsafeOpt)
     for(auto & op : ops) if(op.hasOutput()) op.scc = slots[op.scc];
 
     if(ra_debug) BJIT_LOG("\n");
-    rename.map.clear();
+    rename.clear();
     // do a cleanup pass to get rid of renames that just hurt assembler
     for(auto b : live)
     {
@@ -1355,16 +1338,14 @@ void Proc::allocRegs(bool unsafeOpt)
 
             if(ops[c].opcode <= ops::jmp)
             for(auto & s : blocks[ops[c].label[0]].alts)
-            for(auto & r : rename.map)
             {
-                if(s.val == r.src && s.src == b) s.val = r.dst;
+                if(s.src == b) s.val = rename(s.val);
             }
             
             if(ops[c].opcode < ops::jmp)
             for(auto & s : blocks[ops[c].label[0]].alts)
-            for(auto & r : rename.map)
             {
-                if(s.val == r.src && s.src == b) s.val = r.dst;
+                if(s.src == b) s.val = rename(s.val);
             }
         }
     }
@@ -1407,7 +1388,7 @@ void Proc::allocRegs(bool unsafeOpt)
     opt_dce();
 
     raDone = true;
-    BJIT_LOG(" DONE\n");
+    BJIT_TRACE(ra, info, "ra: %d slots", nSlots);
     if(ra_debug) debug();
 
     // this won't work unless we fixed it :)
@@ -1416,13 +1397,16 @@ void Proc::allocRegs(bool unsafeOpt)
 
 void Proc::findSCC()
 {
+    impl::PassTimer timer(stats, CompileStats::scc, passTimer);
+
     rebuild_livein(); // need live-in registers
 
     BJIT_ASSERT(!raDone);
-    BJIT_LOG(" RA:SCC");
+    BJIT_TRACE(ra, debug, "ra:scc");
     //debug();
 
-    std::vector<bool>   sccUsed;
+    auto & sccUsed = scratch.sccUsed;
+    sccUsed.clear();
 
     // keep this as sanity check for now, we can remove it later
     for(auto & op : ops) if(op.hasOutput()) BJIT_ASSERT_MORE(op.scc == noSCC);
@@ -1450,7 +1434,7 @@ void Proc::findSCC()
             || (ops[in].opcode == ops::phi && ops[in].block == bi));
             if(!useAfterDefine)
             {
-                BJIT_LOG("\nNo SCC for %04x in L%d\n", in, bi);
+                BJIT_TRACE(ra, error, "no SCC for %04x in L%d", in, bi);
                 debug();
             }
             BJIT_ASSERT(useAfterDefine);
@@ -1590,7 +1574,7 @@ void Proc::findSCC()
 
 void Proc::findUsedRegs()
 {
-    BJIT_LOG(" FindRegs");
+    BJIT_TRACE(ra, debug, "ra:regs");
     usedRegs = 0;
     for(auto b : live)
     {
@@ -1604,3 +1588,48 @@ void Proc::findUsedRegs()
         }
     }
 }
+
+void Proc::collectStats()
+{
+    stats.nBlocksOut = live.size();
+    for(auto b : live)
+    {
+        for(auto c : blocks[b].code)
+        {
+            if(c == noVal) continue;
+
+            ++stats.nOpsOut;
+            if(ops[c].opcode == ops::rename) ++stats.nRenames;
+            if(ops[c].opcode == ops::reload) ++stats.nReloads;
+            if(ops[c].hasOutput() && ops[c].flags.spill) ++stats.nSpills;
+        }
+    }
+}
+
+const char * CompileStats::passName(unsigned pass)
+{
+    static const char * names[] =
+        { "dce", "fold", "reassoc", "cse", "jump", "sink", "scc", "ra", "emit" };
+
+    BJIT_ASSERT(pass < nPasses);
+    return names[pass];
+}
+
+void CompileStats::add(CompileStats const & s)
+{
+    for(int i = 0; i < nPasses; ++i)
+    {
+        seconds[i] += s.seconds[i];
+        nRuns[i] += s.nRuns[i];
+    }
+
+    nOptIter += s.nOptIter;
+    nOpsIn += s.nOpsIn;
+    nBlocksIn += s.nBlocksIn;
+    nOpsOut += s.nOpsOut;
+    nBlocksOut += s.nBlocksOut;
+    nSpills += s.nSpills;
+    nReloads += s.nReloads;
+    nRenames += s.nRenames;
+    nBytes += s.nBytes;
+}
@@ -1,5 +1,8 @@
 
 
+#include <algorithm>
+#include <functional>
+
 #include "bjit.h"
 
 #include "hash.h"
@@ -27,13 +30,15 @@ using namespace bjit;
 #define N2 ops[op.in[2]]
 
 // shortcut for NDOM
-#define NDOM(x) blocks[ops[x].block].dom.size()
+#define NDOM(x) blocks[ops[x].block].domDepth
 
 #define SORT_GT(a,b) (NDOM(a) > NDOM(b) || (NDOM(a) == NDOM(b) && a > b))
 #define SORT_LT(a,b) (NDOM(a) < NDOM(b) || (NDOM(a) == NDOM(b) && a < b))
 
 bool Proc::opt_reassoc(bool unsafeOpt)
 {
+    impl::PassTimer timer(stats, CompileStats::reassoc, passTimer);
+
     //debug();
 
     rebuild_dom();  // need this for intelligent reassoc
@@ -48,8 +53,8 @@ bool Proc::opt_reassoc(bool unsafeOpt)
         // we want strict dominance only
         if(op1 == op2) return false;
         
-        auto ndom1 = blocks[ops[op1].block].dom.size();
-        auto ndom2 = blocks[ops[op2].block].dom.size();
+        auto ndom1 = blocks[ops[op1].block].domDepth;
+        auto ndom2 = blocks[ops[op2].block].domDepth;
 
         if(ndom1 < ndom2) return true;
         if(ndom1 > ndom2) return false;
@@ -60,24 +65,114 @@ bool Proc::opt_reassoc(bool unsafeOpt)
         return ops[op1].pos < ops[op2].pos ? true : false;
     };
 
+    // The rules below only ever look at (and modify) an op, its inputs
+    // and the inputs of those. So after the first round, we only need to
+    // revisit ops where something in this neighbourhood has changed since
+    // the last time we looked at the op, which we find with use lists:
+    // when an op changes, we queue it, its users and the users of those.
+    //
+    // Ops are visited in the same order as a sweep over the live blocks
+    // would, ie. ops after the current one go to this round and the rest
+    // to the next one, so the result is exactly the same as revisiting
+    // everything (which we still do without setOptSparse()), but moving
+    // something through a long chain can take a lot of rounds.
+    auto & order = scratch.reassocOrder;    // position in the sweep
+    auto & atOrder = scratch.reassocOps;    // op at each position
+    auto & queued = scratch.reassocQueued;  // bit 1: this round, 2: next
+    auto & cur = scratch.reassocCur;        // min-heap of positions
+    auto & next = scratch.reassocNext;
+    auto & uses = scratch.reassocUses;
+
+    order.assign(ops.size(), ~0u);
+    queued.assign(ops.size(), 0);
+    atOrder.clear();
+    cur.clear();
+    next.clear();
+
+    if(optSparse) uses.enable(ops);
+
+    for(auto b : live)
+    {
+        for(auto c : blocks[b].code)
+        {
+            if(c == noVal) continue;
+            order[c] = atOrder.size();
+            next.push_back(atOrder.size());
+            atOrder.push_back(c);
+
+            if(!optSparse) continue;
+            for(int k = 0; k < ops[c].nInputs(); ++k)
+                uses.link(c, k, ops[c].in[k]);
+        }
+    }
+
+    auto queue = [&](uint16_t c, uint32_t pos)
+    {
+        if(order[c] == ~0u) return;
+
+        if(order[c] > pos)
+        {
+            if(queued[c] & 1) return;
+            queued[c] |= 1;
+            cur.push_back(order[c]);
+            std::push_heap(cur.begin(), cur.end(), std::greater<uint32_t>());
+        }
+        else if(!(queued[c] & 2))
+        {
+            queued[c] |= 2;
+            next.push_back(order[c]);
+        }
+    };
+
+    struct Saved { uint64_t u64; uint16_t nUse, opcode; };
+    uint16_t    near[1 + 3 + 9];
+    Saved       saved[1 + 3 + 9];
+
     bool progress = true, anyProgress = false;
-    while(progress)
+    while(next.size())
     {
         //debug();
         
         ++iter;
         progress = false;
-        for(auto b : live)
+
+        std::swap(cur, next);
+        next.clear();
+        std::make_heap(cur.begin(), cur.end(), std::greater<uint32_t>());
+        for(auto pos : cur) queued[atOrder[pos]] = 1;
+
+        while(cur.size())
         {
-            for(const auto & bc : blocks[b].code)
+            std::pop_heap(cur.begin(), cur.end(), std::greater<uint32_t>());
+            uint32_t pos = cur.back();
+            cur.pop_back();
+
+            auto bc = atOrder[pos];
+            queued[bc] &= ~1;
             {
-                if(bc == noVal) continue;
-                
                 auto & op = ops[bc];
 
                 if(op.opcode == ops::nop) { continue; }
                 if(!op.nUse) continue;  // might have simplified this away
 
+                // save the neighbourhood, so we can see what changed
+                int nNear = 0;
+                near[nNear++] = bc;
+                for(int k = 0; k < op.nInputs(); ++k)
+                {
+                    auto & in = ops[op.in[k]];
+                    near[nNear++] = op.in[k];
+                    for(int j = 0; j < in.nInputs(); ++j)
+                    {
+                        if(in.in[j] != noVal) near[nNear++] = in.in[j];
+                    }
+                }
+                for(int i = 0; i < nNear; ++i)
+                {
+                    auto & n = ops[near[i]];
+                    saved[i] = Saved{ n.u64, n.nUse, n.opcode };
+                }
+
             #if 1
                 auto debugReassoc =
                     [&](Op & op, int opcode, int opcodeI, int opSub) {};
@@ -569,14 +664,58 @@ bool Proc::opt_reassoc(bool unsafeOpt)
                     doReassoc(ops::dmul, noVal);
                 }
 
+                // queue everything that has a changed op in its
+                // neighbourhood, after fixing the use lists of the op
+                for(int i = 0; optSparse && i < nNear; ++i)
+                {
+                    auto c = near[i];
+                    auto & n = ops[c];
+                    if(saved[i].u64 == n.u64
+                    && saved[i].nUse == n.nUse
+                    && saved[i].opcode == n.opcode) continue;
+
+                    uses.relink(c);
+
+                    queue(c, pos);
+                    uses.forEach(c, [&](uint16_t u, unsigned)
+                    {
+                        queue(u, pos);
+                        uses.forEach(u, [&](uint16_t uu, unsigned)
+                            { queue(uu, pos); });
+                    });
+                }
             }
         }
-        
+
+        // without setOptSparse() look at everything again
+        if(!optSparse && progress) next.assign(atOrder.size(), 0);
+        for(int i = 0; !optSparse && i < next.size(); ++i) next[i] = i;
+
         if(progress) anyProgress = true;
     }
 
+    // check the use lists survived: every use walked is a real input (stale
+    // ones are dropped by forEach) so if the counts match, none are missing
+    if(optSparse)
+    {
+        unsigned nInputs = 0, nUses = 0;
+        for(auto b : live)
+        {
+            for(auto c : blocks[b].code)
+            {
+                if(c == noVal) continue;
+                nInputs += ops[c].nInputs();
+                uses.forEach(c, [&](uint16_t, unsigned) { ++nUses; });
+            }
+        }
+        BJIT_ASSERT_MORE(nUses == nInputs);
+    }
+
+    // nothing else keeps the use lists up to date
+    uses.disable();
+
     //debug();
-    BJIT_LOG(" Fold:%d", iter);
+    BJIT_TRACE(opt, info, "reassoc:%d", iter);
 
     return anyProgress;
 }
@@ -7,6 +7,8 @@ static const bool sink_debug = false;
 
 bool Proc::opt_sink(bool unsafeOpt)
 {
+    impl::PassTimer timer(stats, CompileStats::sink, passTimer);
+
     rebuild_livein();
 
     // livescan doesn't find phi-inputs, we need them here
@@ -18,11 +20,12 @@ bool Proc::opt_sink(bool unsafeOpt)
         }
     }
 
-    BJIT_LOG(" SINK");
+    BJIT_TRACE(opt, info, "sink");
 
     // collect moved ops into tmp (in reverse)
     // so that we can merge them all together
-    std::vector<uint16_t>   tmp0, tmp1;
+    auto & tmp0 = scratch.sinkTmp0;
+    auto & tmp1 = scratch.sinkTmp1;
 
     // one pass should be enough 'cos DFS
     bool progress = false;
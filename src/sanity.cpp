@@ -59,30 +59,13 @@ void Proc::sanity()
             // also check that non-locals are marked as livein
             for(int i = 0; i < op.nInputs(); ++i)
             {
-                bool inputDominates = false;
-                for(auto & d : blocks[b].dom)
-                {
-                    if(d == ops[op.in[i]].block)
-                    {
-                        inputDominates = true;
-                        break;
-                    }
-                }
+                BJIT_ASSERT(dominates(ops[op.in[i]].block, b));
                 
-                BJIT_ASSERT(inputDominates);
-                
-                bool liveIn = (ops[op.in[i]].block == b);
-                if(!liveIn)
-                {
-                    for(auto & in : blocks[b].livein)
-                    {
-                        if(in == op.in[i]) liveIn = true;
-                    }
-                }
-                BJIT_ASSERT(liveIn);
+                BJIT_ASSERT(ops[op.in[i]].block == b
+                    || isLiveIn(b, op.in[i]));
             }
         }
     }
 
-    BJIT_LOG(" SANE\n");
+    BJIT_TRACE(opt, debug, "sane");
 }
\ No newline at end of file
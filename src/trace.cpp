@@ -0,0 +1,71 @@
+
+#include <cstdio>
+#include <cstdarg>
+
+#include "bjit.h"
+
+using namespace bjit;
+
+std::atomic<unsigned> trace::filter(trace::all | (trace::error << 8));
+
+static std::mutex   traceMutex;
+static trace::Sink  traceSink = 0;
+static void         *traceUser = 0;
+
+void trace::setSink(Sink sink, void * user)
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceSink = sink;
+    traceUser = user;
+}
+
+void trace::setFilter(unsigned categories, unsigned level)
+{
+    filter = (categories & all) | (level << 8);
+}
+
+void trace::log(unsigned category, unsigned level, const char * fmt, ...)
+{
+    // format before taking the lock, long messages are just truncated
+    char msg[256];
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if(traceSink) traceSink(category, level, msg, traceUser);
+    else fprintf(stderr, "bjit: %s\n", msg);
+}
+
+void trace::Ring::sink(unsigned category, unsigned level,
+    const char * msg, void * user)
+{
+    auto & ring = *(Ring*) user;
+
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    if(!ring.events.size()) return;
+
+    // reuse the strings, so this won't allocate once they're large enough
+    auto & e = ring.events[ring.nTotal++ % ring.events.size()];
+    e.category = category;
+    e.level = level;
+    e.msg.assign(msg);
+}
+
+void trace::Ring::get(std::vector<Event> & out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    out.clear();
+    unsigned size = events.size();
+    unsigned first = nTotal > size ? nTotal - size : 0;
+    for(unsigned i = first; i < nTotal; ++i) out.push_back(events[i % size]);
+}
+
+void trace::Ring::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nTotal = 0;
+}
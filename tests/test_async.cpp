@@ -0,0 +1,118 @@
+
+#include "bjit.h"
+
+// calls go to the fallback until the background compile is installed
+static int nFallback = 0;
+
+static int fallback(int x, int y)
+{
+    ++nFallback;
+    return x - y;
+}
+
+int main()
+{
+    bjit::Module    module;
+
+    bjit::Proc      procSub(0, "ii");
+    procSub.iret(procSub.isub(procSub.env[0], procSub.env[1]));
+
+    int stub = module.compileAsync(procSub, (uintptr_t) &fallback);
+
+    // near call to the stub, should end up calling the proc directly
+    int caller;
+    {
+        bjit::Proc  proc(0, "ii");
+        proc.iret(proc.iadd(proc.icalln(stub, 2), proc.lci(1)));
+        caller = module.compile(proc);
+    }
+
+    // make sure we have space to patch the new code later
+    BJIT_ASSERT(module.load(0x10000));
+
+    auto callStub = module.getPointer<int(int,int)>(stub);
+    auto callCaller = module.getPointer<int(int,int)>(caller);
+
+    BJIT_ASSERT(callStub(7, 3) == 4);
+    BJIT_ASSERT(callCaller(7, 3) == 5);
+    BJIT_ASSERT(nFallback == 2);
+
+    BJIT_ASSERT(module.pendingAsync() == 1);
+    BJIT_ASSERT(module.updateAsync(true) == 1);
+    BJIT_ASSERT(module.pendingAsync() == 0);
+
+    // not active until patched
+    BJIT_ASSERT(callStub(7, 3) == 4);
+    BJIT_ASSERT(nFallback == 3);
+
+    BJIT_ASSERT(module.patch());
+
+    BJIT_ASSERT(callStub(7, 3) == 4);
+    BJIT_ASSERT(callCaller(7, 3) == 5);
+    BJIT_ASSERT(nFallback == 3);
+
+    // stub should still point to the compiled proc after reload
+    module.unload();
+    BJIT_ASSERT(module.load());
+
+    callStub = module.getPointer<int(int,int)>(stub);
+    callCaller = module.getPointer<int(int,int)>(caller);
+
+    BJIT_ASSERT(callStub(9, 4) == 5);
+    BJIT_ASSERT(callCaller(9, 4) == 6);
+    BJIT_ASSERT(nFallback == 3);
+
+    // lots of procs on a couple of threads just wait in the queue
+    {
+        const int nProcs = 64;
+
+        std::vector<bjit::Proc*> procs;
+        for(int i = 0; i < nProcs; ++i)
+        {
+            procs.push_back(new bjit::Proc(0, "ii"));
+            auto & pr = *procs.back();
+            pr.iret(pr.iadd(pr.isub(pr.env[0], pr.env[1]), pr.lci(i)));
+        }
+
+        {
+            bjit::Module    many;
+            many.setAsyncThreads(2);
+
+            int stubs[nProcs];
+            for(int i = 0; i < nProcs; ++i)
+            {
+                stubs[i] = many.compileAsync(*procs[i], (uintptr_t) &fallback);
+            }
+
+            BJIT_ASSERT(many.updateAsync(true) == nProcs);
+            BJIT_ASSERT(many.pendingAsync() == 0);
+
+            BJIT_ASSERT(many.load());
+            for(int i = 0; i < nProcs; ++i)
+            {
+                auto fn = many.getPointer<int(int,int)>(stubs[i]);
+                BJIT_ASSERT(fn(7, 3) == 4 + i);
+            }
+            BJIT_ASSERT(nFallback == 3);
+        }
+
+        // destroying a module with jobs still queued must be safe too
+        for(int i = 0; i < nProcs; ++i) procs[i]->reset(0, "ii");
+        {
+            bjit::Module    dropped;
+            dropped.setAsyncThreads(1);
+            for(int i = 0; i < nProcs; ++i)
+            {
+                auto & pr = *procs[i];
+                pr.iret(pr.imul(pr.env[0], pr.lci(i)));
+                dropped.compileAsync(pr, (uintptr_t) &fallback);
+            }
+        }
+
+        for(auto * pr : procs) delete pr;
+    }
+
+    printf("Async compile: %d calls went to fallback.\n", nFallback);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+
+#include "bjit.h"
+
+#include <chrono>
+
+// compile the same procs one at a time and in parallel batches with
+// different number of threads, the resulting code should be identical
+static const int nProcs = 64;
+static const int nDiamonds = 8;
+static const int nRepeat = 50;
+
+// proc k does some pointless work and then calls proc k-1 (near call)
+static void buildProc(bjit::Proc & pr, int first, int k)
+{
+    pr.env.push_back(pr.lci(k));
+
+    for(int i = 0; i < nDiamonds; ++i)
+    {
+        auto lt = pr.newLabel();
+        auto le = pr.newLabel();
+        auto lj = pr.newLabel();
+
+        pr.jz(pr.iand(pr.env[0], pr.lci(1 << i)), le, lt);
+
+        pr.emitLabel(lt);
+        for(int r = 0; r < nRepeat; ++r)
+            pr.env[2] = pr.iadd(pr.env[2],
+                pr.iadd(pr.iadd(pr.env[0], pr.lci(r)), pr.env[1]));
+        pr.jmp(lj);
+
+        pr.emitLabel(le);
+        for(int r = 0; r < nRepeat; ++r)
+            pr.env[2] = pr.ixor(pr.env[2], pr.isub(pr.env[1], pr.lci(i)));
+        pr.jmp(lj);
+
+        pr.emitLabel(lj);
+    }
+
+    if(!k) { pr.iret(pr.env[2]); return; }
+
+    auto acc = pr.env[2];
+    pr.env.pop_back();
+    pr.iret(pr.iadd(acc, pr.icalln(first + k - 1, 2)));
+}
+
+static int proc(int x, int y, int k)
+{
+    unsigned acc = k;
+
+    for(int i = 0; i < nDiamonds; ++i)
+    {
+        if(x & (1 << i))
+        {
+            for(int r = 0; r < nRepeat; ++r) acc = acc + (x + r + y);
+        }
+        else
+        {
+            for(int r = 0; r < nRepeat; ++r) acc = acc ^ (y - i);
+        }
+    }
+
+    if(k) acc += proc(x, y, k - 1);
+    return (int) acc;
+}
+
+static double compile(bjit::Module & module, int nThreads)
+{
+    std::vector<bjit::Proc> procs;
+    std::vector<bjit::Proc*> ptrs;
+
+    procs.reserve(nProcs);
+    for(int k = 0; k < nProcs; ++k)
+    {
+        procs.emplace_back(0, "ii");
+        buildProc(procs.back(), 0, k);
+        ptrs.push_back(&procs.back());
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    if(nThreads < 0)
+    {
+        for(auto & pr : procs) module.compile(pr);
+    }
+    else
+    {
+        BJIT_ASSERT(!module.compileBatch(ptrs.data(), nProcs, 2, nThreads));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main()
+{
+    bjit::Module    serial, batch1, batchN;
+
+    double tSerial = compile(serial, -1);
+    double tBatch1 = compile(batch1, 1);
+    double tBatchN = compile(batchN, 0);
+
+    printf("Compile time: %.1fms serial, %.1fms batch (1 thread), "
+        "%.1fms batch (all cores)\n", tSerial, tBatch1, tBatchN);
+
+    BJIT_ASSERT(serial.getBytes() == batch1.getBytes());
+    BJIT_ASSERT(serial.getBytes() == batchN.getBytes());
+
+    BJIT_ASSERT(batchN.load());
+
+    for(int i = 0; i < 16; ++i)
+    {
+        auto h = bjit::hash64(i+1);
+        int x = h&0xff;
+        int y = (h>>8)&0xff;
+        int k = (h>>16) % nProcs;
+        int z = proc(x,y,k);
+        int zjit = batchN.getPointer<int(int,int)>(k)(x,y);
+        printf("proc%d(%d,%d) = %d (jit says %d)\n", k, x, y, z, zjit);
+        BJIT_ASSERT(z == zjit);
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+
+#include "bjit.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+// host functions for the stubs, the resolver maps them by index
+static int hostAdd(int x, int y) { return x + y; }
+static int hostMul(int x, int y) { return x * y; }
+
+static uintptr_t resolve(unsigned index, uintptr_t address, void * user)
+{
+    auto * hosts = (std::vector<uintptr_t>*) user;
+    return index < hosts->size() ? (*hosts)[index] : 0;
+}
+
+static const uint64_t key = 0x1234;
+
+int main()
+{
+    std::vector<uintptr_t>  hosts;
+    std::vector<uint8_t>    cache;
+
+    // somewhere to test the file versions, removed at the end
+    char path[] = "/tmp/bjit-cache-XXXXXX";
+    int fd = mkstemp(path);
+    BJIT_ASSERT(fd >= 0);
+    close(fd);
+
+    {
+        bjit::Module    module;
+
+        // stub 0 -> hostAdd, stub 1 -> hostMul (patched)
+        hosts.push_back((uintptr_t) &hostAdd);
+        module.compileStub((uintptr_t) &hostMul);
+        hosts.push_back((uintptr_t) &hostMul);
+        module.compileStub(0);
+        module.patchStub(0, (uintptr_t) &hostAdd);
+        module.patchStub(1, (uintptr_t) &hostMul);
+
+        // proc 2: mul(add(x,y), y) through near calls to stubs
+        {
+            bjit::Proc  pr(0, "ii");
+            pr.env.push_back(pr.icalln(0, 2));
+            pr.env[0] = pr.env[2];
+            pr.env.pop_back();
+            pr.iret(pr.icalln(1, 2));
+            module.compile(pr);
+        }
+
+        // proc 3: calls proc 2 with (x, 2)
+        {
+            bjit::Proc  pr(0, "i");
+            pr.env.push_back(pr.lci(2));
+            pr.iret(pr.icalln(2, 2));
+            module.compile(pr);
+        }
+
+        BJIT_ASSERT(module.load());
+        BJIT_ASSERT(module.getPointer<int(int,int)>(2)(3, 4) == 28);
+        BJIT_ASSERT(module.getPointer<int(int)>(3)(5) == 14);
+
+        module.saveCache(cache, key);
+        BJIT_ASSERT(module.saveCache(path, key));
+    }
+
+    // load from memory and from file
+    for(int fromFile = 0; fromFile < 2; ++fromFile)
+    {
+        bjit::Module    module;
+        if(fromFile)
+        {
+            BJIT_ASSERT(module.loadCache(path, key, resolve, &hosts));
+        }
+        else
+        {
+            BJIT_ASSERT(module.loadCache(cache.data(), cache.size(),
+                key, resolve, &hosts));
+        }
+
+        BJIT_ASSERT(module.load());
+        BJIT_ASSERT(module.getPointer<int(int,int)>(2)(3, 4) == 28);
+        BJIT_ASSERT(module.getPointer<int(int)>(3)(5) == 14);
+
+        // resaving should give the same thing back
+        std::vector<uint8_t>    again;
+        module.saveCache(again, key);
+        BJIT_ASSERT(again == cache);
+    }
+
+    // resolver can redirect stubs
+    {
+        std::vector<uintptr_t>  swapped = { hosts[1], hosts[0] };
+
+        bjit::Module    module;
+        BJIT_ASSERT(module.loadCache(cache.data(), cache.size(),
+            key, resolve, &swapped));
+        BJIT_ASSERT(module.load());
+        BJIT_ASSERT(module.getPointer<int(int,int)>(2)(3, 4) == 16);
+    }
+
+    // invalid caches should be rejected without touching the module
+    {
+        bjit::Module    module;
+        module.compileStub((uintptr_t) &hostAdd);
+
+        std::vector<uintptr_t>  none;
+        BJIT_ASSERT(!module.loadCache(cache.data(), cache.size(), key + 1));
+        BJIT_ASSERT(!module.loadCache(cache.data(), cache.size() - 1, key));
+        BJIT_ASSERT(!module.loadCache(cache.data(), cache.size(),
+            key, resolve, &none));
+        BJIT_ASSERT(!module.loadCache("no-such-cache.bin", key));
+
+        auto broken = cache;
+        broken.back() ^= 1;
+        BJIT_ASSERT(!module.loadCache(broken.data(), broken.size(), key));
+
+        BJIT_ASSERT(module.load());
+        BJIT_ASSERT(module.getPointer<int(int,int)>(0)(3, 4) == 7);
+    }
+
+    unlink(path);
+
+    printf("Cache: %d bytes\n", (int) cache.size());
+
+    return 0;
+}
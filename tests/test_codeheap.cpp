@@ -0,0 +1,111 @@
+
+#include "bjit.h"
+
+#include <thread>
+
+// lots of tiny modules sharing one heap
+static const int nModules = 1000;
+
+int main()
+{
+    // use small regions, so we can see that it doesn't reserve too much
+    bjit::CodeHeap  heap(0x10000);
+
+    std::vector<bjit::Module>   modules(nModules);
+
+    // proc 0 in each module adds i, and calls it through a near call
+    auto compile = [&](int i)
+    {
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.iadd(pr.env[0], pr.lci(i)));
+        modules[i].compile(pr);
+
+        bjit::Proc  pc(0, "i");
+        pc.iret(pc.icalln(0, 1));
+        modules[i].compile(pc);
+    };
+
+    for(int i = 0; i < nModules; ++i) compile(i);
+
+    heap.beginBatch();
+    for(int i = 0; i < nModules; ++i) BJIT_ASSERT(modules[i].load(heap));
+    heap.endBatch();
+
+    for(int i = 0; i < nModules; ++i)
+    {
+        BJIT_ASSERT(modules[i].getPointer<int(int)>(0)(5) == 5 + i);
+        BJIT_ASSERT(modules[i].getPointer<int(int)>(1)(7) == 7 + i);
+    }
+
+    size_t reserved = heap.getStats().reserved;
+    size_t used = heap.getStats().used;
+    printf("%d modules: %d bytes used, %d bytes reserved\n",
+        nModules, (int) used, (int) reserved);
+
+    // should be a lot less than a page per module
+    BJIT_ASSERT(reserved < nModules * 128);
+
+    // unload every other module, the rest should keep working
+    for(int i = 0; i < nModules; i += 2) modules[i].unload();
+    BJIT_ASSERT(heap.getStats().used < used);
+
+    for(int i = 1; i < nModules; i += 2)
+    {
+        BJIT_ASSERT(modules[i].getPointer<int(int)>(1)(7) == 7 + i);
+    }
+
+    // reloading should reuse the freed chunks
+    for(int i = 0; i < nModules; i += 2) BJIT_ASSERT(modules[i].load(heap));
+    BJIT_ASSERT(heap.getStats().used == used);
+    BJIT_ASSERT(heap.getStats().reserved == reserved);
+
+    for(int i = 0; i < nModules; ++i)
+    {
+        BJIT_ASSERT(modules[i].getPointer<int(int)>(1)(7) == 7 + i);
+    }
+
+    // patching should work as long as there's space
+    {
+        bjit::Module    module;
+        int stub = module.compileStub((uintptr_t) modules[3].getPointer<void>(0));
+        BJIT_ASSERT(module.load(bjit::CodeHeap::shared(), 0x1000));
+        BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 8);
+
+        module.patchStub(stub, (uintptr_t) modules[4].getPointer<void>(0));
+
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.icalln(stub, 1));
+        int index = module.compile(pr);
+
+        BJIT_ASSERT(module.patch());
+        BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 9);
+        BJIT_ASSERT(module.getPointer<int(int)>(index)(5) == 9);
+    }
+
+    // a batch on this thread must not delay another thread's patch()
+    {
+        bjit::Module    module;
+        int stub = module.compileStub((uintptr_t) modules[3].getPointer<void>(0));
+        BJIT_ASSERT(module.load(heap, 0x1000));
+
+        heap.beginBatch();
+        BJIT_ASSERT(modules[0].unload());
+        BJIT_ASSERT(modules[0].load(heap));
+
+        std::thread thread([&]()
+        {
+            module.patchStub(stub, (uintptr_t) modules[4].getPointer<void>(0));
+            BJIT_ASSERT(module.patch());
+            BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 9);
+        });
+        thread.join();
+
+        heap.endBatch();
+        BJIT_ASSERT(modules[0].getPointer<int(int)>(1)(7) == 7);
+    }
+
+    for(auto & m : modules) m.unload();
+    BJIT_ASSERT(!heap.getStats().used);
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+
+#include "bjit.h"
+
+// builds (x+c)*y, optionally with some dead code and
+// with the blocks of a diamond created in a different order
+static void build(bjit::Proc & pr, int c, bool dead, bool swapLabels)
+{
+    auto x = pr.env[0];
+    auto y = pr.env[1];
+
+    if(dead) pr.imul(x, pr.lci(42));
+
+    auto la = swapLabels ? pr.newLabel() : bjit::Label();
+    auto lb = pr.newLabel();
+    if(!swapLabels) la = pr.newLabel();
+
+    pr.jz(pr.ilt(x, y), la, lb);
+
+    pr.emitLabel(la);
+    if(dead) pr.iadd(y, y);
+    pr.iret(pr.imul(pr.iadd(x, pr.lci(c)), y));
+
+    pr.emitLabel(lb);
+    pr.iret(pr.imul(pr.iadd(x, pr.lci(c)), y));
+}
+
+int main()
+{
+    bjit::Module    module;
+    std::vector<int>    index;
+
+    for(int c = 0; c < 3; ++c)
+    {
+        for(int v = 0; v < 4; ++v)
+        {
+            bjit::Proc  pr(0, "ii");
+            build(pr, c, v & 1, v & 2);
+            index.push_back(module.compileDedupe(pr));
+        }
+    }
+
+    // each variant should have matched the first one with the same c
+    for(int c = 0; c < 3; ++c)
+    {
+        for(int v = 1; v < 4; ++v)
+        {
+            BJIT_ASSERT(index[c*4 + v] == index[c*4]);
+        }
+        if(c) BJIT_ASSERT(index[c*4] != index[c*4 - 4]);
+    }
+
+    // different levelOpt shouldn't match
+    {
+        bjit::Proc  pr(0, "ii");
+        build(pr, 0, false, false);
+        BJIT_ASSERT(module.compileDedupe(pr, 0) != index[0]);
+    }
+
+    // hits are checked by key, which must match exactly when hashes do
+    {
+        std::vector<uint64_t>   keys[3];
+        for(int v = 0; v < 3; ++v)
+        {
+            bjit::Proc  pr(0, "ii");
+            build(pr, v >> 1, v & 1, v & 1);
+            uint64_t h = pr.hash(2, &keys[v]);
+            BJIT_ASSERT(h == pr.hash(2));
+        }
+        BJIT_ASSERT(keys[0] == keys[1]);
+        BJIT_ASSERT(keys[0] != keys[2]);
+    }
+
+    auto & stats = module.getDedupeStats();
+    printf("Dedupe: %d hits, %d misses\n", stats.nHits, stats.nMisses);
+    BJIT_ASSERT(stats.nHits == 9);
+    BJIT_ASSERT(stats.nMisses == 4);
+
+    BJIT_ASSERT(module.load());
+    for(int c = 0; c < 3; ++c)
+    {
+        auto fn = module.getPointer<int(int,int)>(index[c*4]);
+        BJIT_ASSERT(fn(2, 5) == (2 + c) * 5);
+        BJIT_ASSERT(fn(7, 3) == (7 + c) * 3);
+    }
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+
+#include "bjit.h"
+
+// long chain of if-else diamonds, so that dominator trees are deep
+// and every join block dominates everything that follows
+static const int nDiamonds = 40;
+
+int proc(int x, int y)
+{
+    int acc = 0;
+
+    for(int i = 0; i < nDiamonds; ++i)
+    {
+        if(x & (1 << (i & 15))) acc = acc + y;
+        else acc = acc ^ i;
+
+        // this is the case where we fold jieqI into jz
+        if(acc == 0) acc = i;
+
+        x = x + 1;
+    }
+
+    return acc;
+}
+
+int main()
+{
+    bjit::Module    module;
+    {
+        bjit::Proc  pr(0, "ii");
+
+        pr.env.push_back(pr.lci(0));
+
+        for(int i = 0; i < nDiamonds; ++i)
+        {
+            auto lt = pr.newLabel();
+            auto le = pr.newLabel();
+            auto lj = pr.newLabel();
+
+            pr.jz(pr.iand(pr.env[0], pr.lci(1 << (i & 15))), le, lt);
+
+            pr.emitLabel(lt);
+            pr.env[2] = pr.iadd(pr.env[2], pr.env[1]);
+            pr.jmp(lj);
+
+            pr.emitLabel(le);
+            pr.env[2] = pr.ixor(pr.env[2], pr.lci(i));
+            pr.jmp(lj);
+
+            pr.emitLabel(lj);
+
+            auto lz = pr.newLabel();
+            auto ln = pr.newLabel();
+
+            pr.jz(pr.ieq(pr.env[2], pr.lci(0)), ln, lz);
+
+            pr.emitLabel(lz);
+            pr.env[2] = pr.lci(i);
+            pr.jmp(ln);
+
+            pr.emitLabel(ln);
+            pr.env[0] = pr.iadd(pr.env[0], pr.lci(1));
+        }
+
+        pr.iret(pr.env[2]);
+
+        module.compile(pr);
+    }
+
+    BJIT_ASSERT(module.load());
+
+    for(int i = 0; i < 16; ++i)
+    {
+        auto h = bjit::hash64(i+1);
+        int x = h&0xffff;
+        int y = (h>>16)&0xff;
+        int z = proc(x,y);
+        int zjit = module.getPointer<int(int,int)>(0)(x,y);
+        printf("proc(%d,%d) = %d (jit says %d)\n", x, y, z, zjit);
+        BJIT_ASSERT(z == zjit);
+    }
+
+    return 0;
+}
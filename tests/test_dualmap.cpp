@@ -0,0 +1,91 @@
+
+#include "bjit.h"
+
+#include <thread>
+#include <atomic>
+
+// with dualMap, patch() never makes the module non-executable, so
+// another thread can keep running code in the module while we patch
+static int addOne(int x) { return x + 1; }
+static int addTwo(int x) { return x + 2; }
+
+int main()
+{
+    bjit::Module    module;
+
+    // proc 0: loops for a while, so the other thread spends most
+    // of the time executing code in the module
+    {
+        bjit::Proc  pr(0, "i");
+        pr.env.push_back(pr.lci(0));
+
+        auto ls = pr.newLabel();
+        auto lb = pr.newLabel();
+        auto le = pr.newLabel();
+
+        pr.jmp(ls);
+        pr.emitLabel(ls);
+        pr.jz(pr.ilt(pr.env[1], pr.env[0]), le, lb);
+        pr.emitLabel(lb);
+        pr.env[1] = pr.iadd(pr.env[1], pr.lci(1));
+        pr.jmp(ls);
+        pr.emitLabel(le);
+        pr.iret(pr.env[1]);
+
+        module.compile(pr);
+    }
+
+    int stub = module.compileStub((uintptr_t) &addOne);
+
+    if(!module.load(0x10000, true))
+    {
+        printf("Dual mapping not supported, skipping.\n");
+        return 0;
+    }
+
+    auto loop = module.getPointer<int(int)>(0);
+
+    std::atomic<bool>   stop(false);
+    std::atomic<int>    nCalls(0);
+    std::thread         runner([&]()
+    {
+        while(!stop)
+        {
+            BJIT_ASSERT(loop(10000) == 10000);
+            ++nCalls;
+        }
+    });
+
+    // keep adding procs and patching while the runner runs proc 0
+    int nPatch = 0;
+    for(int i = 0; i < 100; ++i)
+    {
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.iadd(pr.env[0], pr.lci(i)));
+        int index = module.compile(pr);
+
+        // this only touches the stub and new code
+        module.patchStub(stub, (uintptr_t) ((i&1) ? &addTwo : &addOne));
+
+        if(!module.patch()) break;
+        ++nPatch;
+
+        BJIT_ASSERT(module.getPointer<int(int)>(index)(5) == 5 + i);
+        BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 6 + (i&1));
+    }
+
+    stop = true;
+    runner.join();
+
+    printf("Patched %d times, %d calls from another thread.\n",
+        nPatch, (int) nCalls);
+    BJIT_ASSERT(nPatch == 100);
+
+    // should also survive reload
+    module.unload();
+    BJIT_ASSERT(module.load(0, true));
+    BJIT_ASSERT(module.getPointer<int(int)>(0)(123) == 123);
+    BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 7);
+
+    return 0;
+}
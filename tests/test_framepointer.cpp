@@ -0,0 +1,158 @@
+
+#include "bjit.h"
+
+#include <chrono>
+
+// Checks that Proc::setFramePointer() gives a frame chain through the
+// generated code, then compiles a few procs with and without it and
+// reports the cost in code size, spills and run time.
+
+struct Walk
+{
+    uintptr_t   begin, end;     // code of the module
+    int         nJit = 0;       // return addresses in the module
+};
+
+static Walk * walk = 0;
+
+// follows saved frame pointers as long as they return into the module,
+// both x64 and arm64 keep {previous frame, return address} at the frame
+static int __attribute__((noinline)) probe(int a, int b)
+{
+    auto fp = (uintptr_t*) __builtin_frame_address(0);
+    for(int depth = 0; fp && depth < 16; ++depth)
+    {
+        uintptr_t ip = fp[1];
+        if(ip <= walk->begin || ip > walk->end) break;
+
+        ++walk->nJit;
+        fp = (uintptr_t*) fp[0];
+    }
+    return a + b;
+}
+
+static void testChain()
+{
+    bjit::Module    module;
+
+    int inner;
+    {
+        bjit::Proc  pr(0, "ii");
+        pr.setFramePointer(true);
+        auto x = pr.imul(pr.env[0], pr.env[1]);
+        pr.env.push_back(x);
+        auto r = pr.icallp(pr.lci(uintptr_t(probe)), 2);
+        pr.iret(pr.iadd(r, x));
+        inner = module.compile(pr);
+    }
+
+    int outer;
+    {
+        bjit::Proc  pr(0, "ii");
+        pr.setFramePointer(true);
+        auto r = pr.icalln(inner, 2);
+        pr.iret(pr.iadd(r, pr.env[0]));
+        outer = module.compile(pr);
+    }
+
+    BJIT_ASSERT(module.load());
+
+    Walk w;
+    w.begin = (uintptr_t) module.getPointer<void>(0);
+    w.end = w.begin + module.getBytes().size();
+    walk = &w;
+
+    // 5*3 + 5*3+3 + 5
+    BJIT_ASSERT(module.getPointer<int(int,int)>(outer)(5, 3) == 15+18+5);
+
+    walk = 0;
+
+    printf("Frame chain: %d frames in JIT code\n", w.nJit);
+    BJIT_ASSERT(w.nJit == 2);
+}
+
+static const int nLive = 20;
+
+// more live values than there are registers, so one less register shows
+// up as spills; no loops, the benchmark calls this repeatedly instead
+static void buildPressure(bjit::Proc & pr)
+{
+    std::vector<bjit::Value>    v;
+    for(int i = 0; i < nLive; ++i)
+    {
+        v.push_back(pr.imul(pr.iadd(pr.env[0], pr.lci(i)),
+            pr.ixor(pr.env[1], pr.lci(7*i + 1))));
+    }
+
+    auto sum = v.back();
+    for(int i = nLive - 1; i--;)
+    {
+        sum = pr.ixor(pr.imul(sum, pr.lci(31)), v[i]);
+    }
+    pr.iret(sum);
+}
+
+// small leaf, where the frame is pure overhead
+static void buildLeaf(bjit::Proc & pr)
+{
+    pr.iret(pr.iadd(pr.imul(pr.env[0], pr.env[0]), pr.env[1]));
+}
+
+struct Result
+{
+    unsigned    nBytes;
+    unsigned    nSpills;
+    int64_t     value;
+    double      ms;
+};
+
+static Result bench(void (*build)(bjit::Proc &), bool framePointer,
+    int nCalls)
+{
+    bjit::Module    module;
+    bjit::Proc      pr(0, "ii");
+    pr.setFramePointer(framePointer);
+    build(pr);
+    module.compile(pr);
+    BJIT_ASSERT(module.load());
+
+    Result r;
+    r.nBytes = pr.getStats().nBytes;
+    r.nSpills = pr.getStats().nSpills + pr.getStats().nReloads;
+
+    auto fn = module.getPointer<int64_t(int64_t,int64_t)>(0);
+
+    auto t0 = std::chrono::steady_clock::now();
+    r.value = 0;
+    for(int i = 0; i < nCalls; ++i) r.value += fn(i, i >> 3);
+    auto t1 = std::chrono::steady_clock::now();
+    r.ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    return r;
+}
+
+int main()
+{
+    testChain();
+
+    struct { const char * name; void (*build)(bjit::Proc &); } procs[] =
+    {
+        { "pressure", buildPressure },
+        { "leaf", buildLeaf },
+    };
+
+    const int nCalls = 10000000;
+
+    printf("%-10s %18s %18s %18s\n", "", "bytes", "spills+reloads", "ms");
+    for(auto & p : procs)
+    {
+        Result r0 = bench(p.build, false, nCalls);
+        Result r1 = bench(p.build, true, nCalls);
+        BJIT_ASSERT(r0.value == r1.value);
+
+        printf("%-10s %8d -> %-7d %8d -> %-7d %8.2f -> %-7.2f\n", p.name,
+            r0.nBytes, r1.nBytes, r0.nSpills, r1.nSpills, r0.ms, r1.ms);
+    }
+
+    return 0;
+}
@@ -5,11 +5,9 @@
 // and enable dumping the code into a file
 //#define ONECASE 93495
 
-uintptr_t iFuzzSeed(uint64_t seed, int opt)
+// builds a random proc into proc, then picks the arguments
+void iFuzzBuild(bjit::Proc & proc, uint64_t seed, int64_t * args)
 {
-    bjit::Module    module;
-    bjit::Proc      proc(0, "iiii");
-
     auto random = [&]() -> uint64_t { return bjit::hash64(seed++); };
 
     for(int i = 0; i < 64; ++i)
@@ -40,6 +38,18 @@ uintptr_t iFuzzSeed(uint64_t seed, int opt)
     }
 
     proc.iret(proc.env[1 + (random() % (proc.env.size()-1))]);
+
+    for(int i = 0; i < 4; ++i) args[i] = (int) random();
+}
+
+uintptr_t iFuzzSeed(uint64_t seed, int opt)
+{
+    bjit::Module    module;
+    bjit::Proc      proc(0, "iiii");
+
+    int64_t args[4];
+    iFuzzBuild(proc, seed, args);
+
     module.compile(proc, opt);
 #ifdef ONECASE
     if(opt)
@@ -54,13 +64,22 @@ uintptr_t iFuzzSeed(uint64_t seed, int opt)
         printf(" - Wrote out.bin\n");
     }
     module.load();
-    auto ptr = module.getPointer<uintptr_t(int,int,int,int)>(0);
+    auto ptr = module.getPointer<uintptr_t(int64_t,int64_t,int64_t,int64_t)>(0);
+
+    return ptr(args[0], args[1], args[2], args[3]);
+}
+
+// same thing with the interpreter, which doesn't optimize anything
+uintptr_t iFuzzInterp(uint64_t seed)
+{
+    bjit::Interp    interp;
+    bjit::Proc      proc(0, "iiii");
+
+    int64_t args[4];
+    iFuzzBuild(proc, seed, args);
 
-    int p0 = random();
-    int p1 = random();
-    int p2 = random();
-    int p3 = random();
-    return ptr(p0, p1, p2, p3);
+    interp.add(proc);
+    return interp.call<uintptr_t>(0, args[0], args[1], args[2], args[3]);
 }
 
 int main()
@@ -72,12 +91,15 @@ int main()
 #endif
     {
         auto seed = bjit::hash64(i);
-        auto fuzz0 = iFuzzSeed(seed, 0);
-        auto fuzz2 = iFuzzSeed(seed, 2);
+        auto fuzzI = iFuzzInterp(seed);
         BJIT_LOG("\nTest iter %d\n", i);
-        if(fuzz0 != fuzz2)
-            BJIT_LOG(" %p != %p\n", (void*)fuzz0, (void*)fuzz2);
-        BJIT_ASSERT(fuzz0 == fuzz2);
+        for(int opt = 0; opt <= 2; ++opt)
+        {
+            auto fuzz = iFuzzSeed(seed, opt);
+            if(fuzz != fuzzI)
+                BJIT_LOG(" opt %d: %p != %p\n", opt, (void*)fuzz, (void*)fuzzI);
+            BJIT_ASSERT(fuzz == fuzzI);
+        }
 
         BJIT_LOG(" OK: %d\n", i);
     }
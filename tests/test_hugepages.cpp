@@ -0,0 +1,118 @@
+
+#include "bjit.h"
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+// thousands of tiny modules called round-robin, loaded into private
+// mappings (a page each), a CodeHeap and a CodeHeap with huge pages
+static const int nModules = 4000;
+static const int nRounds = 200;
+
+typedef int (*ProcPtr)(int);
+
+static double run(std::vector<ProcPtr> & ptrs)
+{
+    auto t0 = std::chrono::steady_clock::now();
+
+    int x = 0;
+    for(int r = 0; r < nRounds; ++r)
+    {
+        for(auto & p : ptrs) x = p(x);
+    }
+    BJIT_ASSERT(x == nRounds * (nModules * (nModules - 1) / 2));
+
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+static void printStats(const char * name, bjit::CodeHeap & heap, double ms)
+{
+    auto stats = heap.getStats();
+    printf("%-10s %8.2fms, %d pages, %d/%d regions huge (%d asked),"
+        " %d/%d bytes used\n", name, ms, stats.nPages, stats.nHugeRegions,
+        stats.nRegions, stats.nHugeAsked, (int) stats.used, (int) stats.reserved);
+
+    BJIT_ASSERT(stats.nHugeRegions <= stats.nHugeAsked);
+    BJIT_ASSERT(stats.nHugeAsked <= stats.nRegions);
+}
+
+// other modules in the heap must keep running while we load and patch,
+// which only works if the regions never stop being executable
+static void loadWhileRunning(bjit::CodeHeap & heap, std::vector<ProcPtr> & ptrs)
+{
+    std::atomic<bool>   stop(false);
+    std::thread         thread([&]()
+    {
+        int x = 0;
+        while(!stop) for(int i = 0; i < 100; ++i) x = ptrs[i](x);
+    });
+
+    for(int i = 0; i < 100; ++i)
+    {
+        bjit::Module    module;
+        int stub = module.compileStub((uintptr_t) ptrs[1]);
+        BJIT_ASSERT(module.load(heap, 0x100));
+        BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 6);
+
+        module.patchStub(stub, (uintptr_t) ptrs[2]);
+        BJIT_ASSERT(module.patch());
+        BJIT_ASSERT(module.getPointer<int(int)>(stub)(5) == 7);
+    }
+
+    stop = true;
+    thread.join();
+}
+
+int main()
+{
+    std::vector<bjit::Module>   modules(nModules);
+    std::vector<ProcPtr>        ptrs(nModules);
+
+    for(int i = 0; i < nModules; ++i)
+    {
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.iadd(pr.env[0], pr.lci(i)));
+        modules[i].compile(pr);
+    }
+
+    // one mapping per module
+    for(int i = 0; i < nModules; ++i)
+    {
+        BJIT_ASSERT(modules[i].load());
+        ptrs[i] = modules[i].getPointer<int(int)>(0);
+    }
+    printf("%-10s %8.2fms, %d pages\n", "private", run(ptrs), nModules);
+    for(auto & m : modules) m.unload();
+
+    // shared heap, normal pages and then huge pages
+    for(int huge = 0; huge < 2; ++huge)
+    {
+        bjit::CodeHeap  heap(1<<20, huge);
+
+        heap.beginBatch();
+        for(int i = 0; i < nModules; ++i)
+        {
+            BJIT_ASSERT(modules[i].load(heap));
+            ptrs[i] = modules[i].getPointer<int(int)>(0);
+        }
+        heap.endBatch();
+
+        printStats(huge ? "huge" : "heap", heap, run(ptrs));
+        BJIT_ASSERT(huge || !heap.getStats().nHugeAsked);
+        loadWhileRunning(heap, ptrs);
+
+        // free two chunks, then load near the module before the second
+        modules[10].unload();
+        modules[30].unload();
+        BJIT_ASSERT(modules[10].load(heap, 0, &modules[29]));
+        BJIT_ASSERT(modules[10].getPointer<int(int)>(0) == ptrs[30]);
+        BJIT_ASSERT(modules[30].load(heap));
+
+        for(auto & m : modules) m.unload();
+        BJIT_ASSERT(!heap.getStats().used);
+    }
+
+    return 0;
+}
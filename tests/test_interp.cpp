@@ -0,0 +1,168 @@
+
+#include "bjit.h"
+
+#include <chrono>
+
+// Runs the same procs with bjit::Interp and compiled, checks that they
+// agree and reports how much slower the interpreter is.
+
+static double scale(double x, int64_t k) { return x * double(k) + 0.5; }
+
+// fib(n) with near calls to itself
+static void buildFib(bjit::Proc & pr)
+{
+    auto lt = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jnz(pr.ile(pr.env[0], pr.lci(1)), lt, le);
+
+    pr.emitLabel(lt);
+    pr.iret(pr.lci(1));
+
+    pr.emitLabel(le);
+    pr.env.push_back(pr.isub(pr.env[0], pr.lci(1)));
+    auto a = pr.icalln(0, 1);
+    pr.env.pop_back();
+
+    pr.env.push_back(pr.isub(pr.env[0], pr.lci(2)));
+    auto b = pr.icalln(0, 1);
+    pr.env.pop_back();
+
+    pr.iret(pr.iadd(a, b));
+}
+
+// sum of scale(x, i) for i < n, through the stub at index 1
+static void buildSum(bjit::Proc & pr)
+{
+    pr.env.push_back(pr.lcd(0));    // env[2] = sum
+    pr.env.push_back(pr.lci(0));    // env[3] = i
+
+    auto ls = pr.newLabel();
+    auto lb = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jmp(ls);
+
+    pr.emitLabel(ls);
+    pr.jnz(pr.ilt(pr.env[3], pr.env[1]), lb, le);
+
+    pr.emitLabel(lb);
+    pr.env.push_back(pr.env[0]);
+    pr.env.push_back(pr.env[3]);
+    auto y = pr.dcalln(1, 2);
+    pr.env.pop_back();
+    pr.env.pop_back();
+    pr.env[2] = pr.dadd(pr.env[2], y);
+    pr.env[3] = pr.iadd(pr.env[3], pr.lci(1));
+    pr.jmp(ls);
+
+    pr.emitLabel(le);
+    pr.dret(pr.env[2]);
+}
+
+// fills the stack block and reads it back
+static void buildMemory(bjit::Proc & pr)
+{
+    auto base = bjit::Value{0};
+    for(int i = 0; i < 8; ++i)
+    {
+        auto v = pr.imul(pr.env[0], pr.lci(i + 1));
+        pr.si64(v, pr.iadd(base, pr.lci(8 * i)), 0);
+    }
+    pr.si32(pr.env[1], base, 64);
+    pr.sf32(pr.ci2f(pr.env[1]), base, 68);
+
+    auto f = pr.fmul(pr.lf32(base, 68), pr.lf32(base, 68));
+    auto r = pr.iadd(pr.li16(base, 64), pr.cf2i(f));
+
+    pr.env.push_back(r);            // env[2] = sum
+    pr.env.push_back(pr.lci(0));    // env[3] = i
+
+    auto ls = pr.newLabel();
+    auto lb = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jmp(ls);
+
+    pr.emitLabel(ls);
+    pr.jnz(pr.ilt(pr.env[3], pr.lci(8)), lb, le);
+
+    pr.emitLabel(lb);
+    auto v = pr.li64(pr.iadd(base, pr.ishl(pr.env[3], pr.lci(3))), 0);
+    pr.env[2] = pr.ixor(pr.imul(pr.env[2], pr.lci(31)), v);
+    pr.env[3] = pr.iadd(pr.env[3], pr.lci(1));
+    pr.jmp(ls);
+
+    pr.emitLabel(le);
+    pr.iret(pr.env[2]);
+}
+
+// tail call to fib
+static void buildTail(bjit::Proc & pr)
+{
+    pr.env[0] = pr.iadd(pr.env[0], pr.lci(1));
+    pr.tcalln(0, 1);
+}
+
+template <typename T>
+static void time(const char * name, T && fn, int n)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; ++i) fn();
+    auto t1 = std::chrono::steady_clock::now();
+    printf("%-12s %10.3f ms\n", name,
+        std::chrono::duration<double, std::milli>(t1 - t0).count() / n);
+}
+
+int main()
+{
+    bjit::Module    module;
+    bjit::Interp    interp;
+
+    struct { const char * args; unsigned bytes; void (*build)(bjit::Proc &); }
+    procs[] =
+    {
+        { "i", 0, buildFib },
+        { 0, 0, 0 },    // stub for scale()
+        { "di", 0, buildSum },
+        { "ii", 128, buildMemory },
+        { "i", 0, buildTail },
+    };
+
+    for(auto & p : procs)
+    {
+        if(!p.build)
+        {
+            BJIT_ASSERT(module.compileStub(uintptr_t(scale))
+                == interp.addStub(uintptr_t(scale)));
+            continue;
+        }
+
+        bjit::Proc  pr(p.bytes, p.args);
+        p.build(pr);
+        BJIT_ASSERT(interp.add(pr) == module.compile(pr));
+    }
+
+    BJIT_ASSERT(module.load());
+
+    auto fib = module.getPointer<int64_t(int64_t)>(0);
+    auto sum = module.getPointer<double(double, int64_t)>(2);
+    auto mem = module.getPointer<int64_t(int64_t, int64_t)>(3);
+    auto tail = module.getPointer<int64_t(int64_t)>(4);
+
+    for(int i = 0; i < 16; ++i)
+    {
+        BJIT_ASSERT(interp.call<int64_t>(0, i) == fib(i));
+        BJIT_ASSERT(interp.call<int64_t>(4, i) == tail(i));
+        BJIT_ASSERT(interp.call<double>(2, 1.5, i) == sum(1.5, i));
+
+        int64_t a = bjit::hash64(i), b = (int) bjit::hash64(a);
+        BJIT_ASSERT(interp.call<int64_t>(3, a, b) == mem(a, b));
+    }
+
+    printf("fib(20) = %d\n", (int) interp.call<int64_t>(0, 20));
+    time("interp", [&]() { interp.call<int64_t>(0, 20); }, 10);
+    time("native", [&]() { fib(20); }, 10);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+
+#include "bjit.h"
+
+// lots of values defined before a loop and used inside it,
+// so that everything is live across the back-edge
+static const int nValues = 24;
+
+int proc(int x, int n)
+{
+    int acc = 0;
+    while(0 < n)
+    {
+        for(int i = 0; i < nValues; ++i) acc = acc + x * (i + 3);
+        n = n - 1;
+    }
+    return acc;
+}
+
+int main()
+{
+    bjit::Module    module;
+    {
+        bjit::Proc  pr(0, "ii");
+
+        for(int i = 0; i < nValues; ++i)
+            pr.env.push_back(pr.imul(pr.env[0], pr.lci(i + 3)));
+
+        int _acc = pr.env.size();
+        pr.env.push_back(pr.lci(0));
+
+        auto ls = pr.newLabel();
+        auto lb = pr.newLabel();
+        auto le = pr.newLabel();
+
+        pr.jmp(ls);
+        pr.emitLabel(ls);
+        pr.jz(pr.ilt(pr.lci(0), pr.env[1]), le, lb);
+
+        pr.emitLabel(lb);
+        for(int i = 0; i < nValues; ++i)
+            pr.env[_acc] = pr.iadd(pr.env[_acc], pr.env[2 + i]);
+        pr.env[1] = pr.isub(pr.env[1], pr.lci(1));
+        pr.jmp(ls);
+
+        pr.emitLabel(le);
+        pr.iret(pr.env[_acc]);
+
+        module.compile(pr);
+    }
+
+    BJIT_ASSERT(module.load());
+
+    for(int i = 0; i < 16; ++i)
+    {
+        auto h = bjit::hash64(i+1);
+        int x = h&0xffff;
+        int n = (h>>16)&0xf;
+        int z = proc(x,n);
+        int zjit = module.getPointer<int(int,int)>(0)(x,n);
+        printf("proc(%d,%d) = %d (jit says %d)\n", x, n, z, zjit);
+        BJIT_ASSERT(z == zjit);
+    }
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+
+#include "bjit.h"
+
+#include <thread>
+#include <atomic>
+
+// threads keep calling through a stub and a near call,
+// while we keep patching both back and forth in the main thread
+static int targetA(int x) { return x + 1; }
+static int targetB(int x) { return x + 1000000; }
+
+static const int nThreads = 4;
+static const int nPatch = 1000;
+
+int main()
+{
+    bjit::Module    module;
+
+    int stubA = module.compileStub((uintptr_t) &targetA);
+    int stubB = module.compileStub((uintptr_t) &targetB);
+
+    // the one that gets patched
+    int stub = module.compileStub((uintptr_t) &targetA);
+
+    // near calls stubA, patched to call stubB and back
+    int caller;
+    {
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.icalln(stubA, 1));
+        caller = module.compile(pr);
+    }
+
+    if(!module.load(0x1000, true))
+    {
+        printf("Dual mapping not supported, skipping.\n");
+        return 0;
+    }
+
+    auto callStub = module.getPointer<int(int)>(stub);
+    auto callCaller = module.getPointer<int(int)>(caller);
+
+    std::atomic<bool>   stop(false);
+    std::atomic<int>    nCalls(0), nA(0), nB(0);
+
+    std::vector<std::thread>    threads;
+    for(int t = 0; t < nThreads; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            while(!stop)
+            {
+                for(int i = 0; i < 2; ++i)
+                {
+                    int r = (i ? callCaller : callStub)(5);
+                    if(r == 6) ++nA;
+                    else if(r == 1000005) ++nB;
+                    else BJIT_ASSERT(false);    // torn target?
+                }
+                ++nCalls;
+            }
+        });
+    }
+
+    for(int i = 0; i < nPatch; ++i)
+    {
+        module.patchStub(stub, (uintptr_t) ((i&1) ? &targetA : &targetB));
+        if(i&1) module.patchCalls(stubB, stubA);
+        else module.patchCalls(stubA, stubB);
+        BJIT_ASSERT(module.patch());
+
+        // let the others run with a single core too
+        std::this_thread::yield();
+    }
+
+    stop = true;
+    for(auto & t : threads) t.join();
+
+    printf("Patched %d times, %d calls (%d to A, %d to B)\n",
+        nPatch, (int) nCalls, (int) nA, (int) nB);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+
+#include "bjit.h"
+
+#include <string>
+#include <cstring>
+
+#if defined(__linux__)
+#  include <unistd.h>
+#endif
+
+// checks that procs end up in the perf map and the jitdump,
+// including new ones after patch() and moved ones after reload
+
+static int square(int x) { return x * x; }
+
+static std::string readFile(const char * path)
+{
+    std::string data;
+
+    FILE * f = fopen(path, "rb");
+    if(!f) return data;
+
+    char buf[0x1000];
+    while(size_t n = fread(buf, 1, sizeof(buf), f)) data.append(buf, n);
+    fclose(f);
+
+    return data;
+}
+
+// look for "<addr> <size> <name>" in the perf map
+static bool inMap(const std::string & map, void * addr, const char * name)
+{
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%lx ", (unsigned long) addr);
+
+    for(size_t pos = 0; (pos = map.find(prefix, pos)) != std::string::npos; ++pos)
+    {
+        if(pos && map[pos-1] != '\n') continue;
+
+        auto line = map.substr(pos, map.find('\n', pos) - pos);
+        auto nameAt = line.rfind(' ');
+        if(line.substr(nameAt + 1) == name) return true;
+    }
+    return false;
+}
+
+int main()
+{
+#if defined(__linux__)
+    bjit::Module    module;
+    module.setPerf(bjit::Module::perfMap | bjit::Module::perfJitDump);
+
+    int stub = module.compileStub((uintptr_t) &square);
+
+    int add;
+    {
+        bjit::Proc  pr(0, "ii");
+        pr.iret(pr.iadd(pr.env[0], pr.env[1]));
+        add = module.compile(pr);
+        module.setName(add, "test_add");
+    }
+
+    BJIT_ASSERT(module.load(0x1000));
+
+    // added after load, reported by patch()
+    int sq;
+    {
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.icalln(stub, 1));
+        sq = module.compile(pr);
+    }
+    BJIT_ASSERT(module.patch());
+
+    BJIT_ASSERT(module.getPointer<int(int,int)>(add)(2, 3) == 5);
+    BJIT_ASSERT(module.getPointer<int(int)>(sq)(7) == 49);
+
+    char mapPath[64], dumpPath[64];
+    snprintf(mapPath, sizeof(mapPath), "/tmp/perf-%d.map", (int) getpid());
+    snprintf(dumpPath, sizeof(dumpPath), "/tmp/jit-%d.dump", (int) getpid());
+
+    auto map = readFile(mapPath);
+    BJIT_ASSERT(inMap(map, module.getPointer<void>(stub), "bjit_stub_0"));
+    BJIT_ASSERT(inMap(map, module.getPointer<void>(add), "test_add"));
+    BJIT_ASSERT(inMap(map, module.getPointer<void>(sq), "bjit_2"));
+
+    // modules without setPerf() are not reported
+    bjit::Module    other;
+    other.compileStub((uintptr_t) &square);
+    BJIT_ASSERT(other.load());
+
+    map = readFile(mapPath);
+    BJIT_ASSERT(!inMap(map, other.getPointer<void>(0), "bjit_stub_0"));
+
+    // reload into a heap, should report everything again at the new address
+    module.unload();
+    bjit::CodeHeap  heap(0x10000);
+    BJIT_ASSERT(module.load(heap));
+
+    map = readFile(mapPath);
+    BJIT_ASSERT(inMap(map, module.getPointer<void>(add), "test_add"));
+
+    // header, then one record per proc with the code that was loaded
+    auto dump = readFile(dumpPath);
+    BJIT_ASSERT(dump.size() > 40 && !memcmp(dump.data(), "DTiJ", 4));
+
+    auto code = (const char*) module.getPointer<void>(add);
+    auto size = module.getBytes().size();
+    BJIT_ASSERT(std::string::npos != dump.find(std::string("test_add")
+        + '\0' + std::string(code, 4)));
+
+    printf("Perf map %d bytes, jitdump %d bytes (code %d bytes)\n",
+        (int) map.size(), (int) dump.size(), (int) size);
+
+    module.unload();
+    unlink(mapPath);
+    unlink(dumpPath);
+#else
+    printf("Perf support is Linux only, skipping.\n");
+#endif
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+
+#include "bjit.h"
+
+#include <chrono>
+
+// Compiles the same procs at levelOpt 0 (with Proc::allocRegsFast) and at
+// levelOpt 1 (with the full register allocator), checks that they agree and
+// reports compile time, register allocation time and how fast the code runs.
+
+static int64_t mix(int64_t a, int64_t b) { return a * 7 + (b >> 3); }
+
+// long straight-line code with lots of values live at the same time
+static void buildPressure(bjit::Proc & pr)
+{
+    std::vector<bjit::Value> vals = { pr.env[0], pr.env[1] };
+
+    uint64_t h = 0;
+    for(int i = 0; i < 500; ++i)
+    {
+        h = bjit::hash64(h + i);
+
+        unsigned window = vals.size() < 48 ? vals.size() : 48;
+        auto x = vals[vals.size() - 1 - (h % window)];
+        auto y = vals[vals.size() - 1 - ((h >> 8) % window)];
+
+        switch((h >> 16) % 6)
+        {
+            case 0: vals.push_back(pr.iadd(x, y)); break;
+            case 1: vals.push_back(pr.isub(x, y)); break;
+            case 2: vals.push_back(pr.imul(x, y)); break;
+            case 3: vals.push_back(pr.ixor(x, y)); break;
+            case 4: vals.push_back(pr.ushr(x, pr.lci(h >> 61))); break;
+            case 5: vals.push_back(pr.ior(x, pr.lci(h >> 40))); break;
+        }
+    }
+
+    auto r = vals.back();
+    for(int i = 0; i < vals.size(); i += 37) r = pr.iadd(r, vals[i]);
+    pr.iret(r);
+}
+
+// Fibonacci with a twist, so the loop swaps phis and has a branch
+static void buildLoop(bjit::Proc & pr)
+{
+    pr.env.push_back(pr.lci(0));    // env[1] = a
+    pr.env.push_back(pr.lci(1));    // env[2] = b
+    pr.env.push_back(pr.lci(0));    // env[3] = i
+
+    auto ls = pr.newLabel();
+    auto lb = pr.newLabel();
+    auto lo = pr.newLabel();
+    auto lj = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jmp(ls);
+
+    pr.emitLabel(ls);
+    pr.jnz(pr.ilt(pr.env[3], pr.env[0]), lb, le);
+
+    pr.emitLabel(lb);
+    auto t = pr.iadd(pr.env[1], pr.env[2]);
+    pr.env[1] = pr.env[2];
+    pr.env[2] = t;
+    pr.jz(pr.iand(pr.env[3], pr.lci(1)), lj, lo);
+
+    pr.emitLabel(lo);
+    pr.env[1] = pr.ixor(pr.env[1], pr.env[3]);
+    pr.jmp(lj);
+
+    pr.emitLabel(lj);
+    pr.env[3] = pr.iadd(pr.env[3], pr.lci(1));
+    pr.jmp(ls);
+
+    pr.emitLabel(le);
+    pr.iret(pr.env[1]);
+}
+
+// calls mix() through the stub at index 0 with values live across
+static void buildCalls(bjit::Proc & pr)
+{
+    pr.env.push_back(pr.lci(0));    // env[2] = sum
+    pr.env.push_back(pr.lci(0));    // env[3] = i
+
+    auto ls = pr.newLabel();
+    auto lb = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jmp(ls);
+
+    pr.emitLabel(ls);
+    pr.jnz(pr.ilt(pr.env[3], pr.env[0]), lb, le);
+
+    pr.emitLabel(lb);
+    auto k = pr.imul(pr.env[1], pr.env[3]);
+    pr.env.push_back(pr.env[3]);
+    pr.env.push_back(pr.env[1]);
+    auto y = pr.icalln(0, 2);
+    pr.env.pop_back();
+    pr.env.pop_back();
+    pr.env[2] = pr.ixor(pr.iadd(pr.env[2], y), k);
+    pr.env[3] = pr.iadd(pr.env[3], pr.lci(1));
+    pr.jmp(ls);
+
+    pr.emitLabel(le);
+    pr.iret(pr.env[2]);
+}
+
+// Horner-style sum in doubles
+static void buildFloat(bjit::Proc & pr)
+{
+    pr.env.push_back(pr.lcd(0));    // env[2] = acc
+    pr.env.push_back(pr.lci(0));    // env[3] = i
+
+    auto ls = pr.newLabel();
+    auto lb = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jmp(ls);
+
+    pr.emitLabel(ls);
+    pr.jnz(pr.ilt(pr.env[3], pr.env[0]), lb, le);
+
+    pr.emitLabel(lb);
+    pr.env[2] = pr.dadd(pr.dmul(pr.env[2], pr.env[1]), pr.ci2d(pr.env[3]));
+    pr.env[3] = pr.iadd(pr.env[3], pr.lci(1));
+    pr.jmp(ls);
+
+    pr.emitLabel(le);
+    pr.dret(pr.env[2]);
+}
+
+struct Result
+{
+    double      compileMs = 0;
+    double      raMs = 0;
+    unsigned    nBytes = 0;
+    unsigned    nSpills = 0;
+    double      runMs = 0;
+};
+
+// average over n compiles of the recorded IR
+static void timeCompile(Result & r, std::vector<uint8_t> const & ir,
+    unsigned levelOpt, int n)
+{
+    bjit::Proc  pr(0, 0);
+    std::vector<uint8_t> bytes;
+
+    for(int i = 0; i < n; ++i)
+    {
+        bool ok = pr.replay(ir.data(), ir.size());
+        BJIT_ASSERT(ok);
+
+        bytes.clear();
+        auto t0 = std::chrono::steady_clock::now();
+        pr.compile(bytes, levelOpt);
+        auto t1 = std::chrono::steady_clock::now();
+
+        auto & stats = pr.getStats();
+        r.compileMs += std::chrono::duration<double, std::milli>(t1 - t0).count() / n;
+        r.raMs += 1e3 * (stats.seconds[bjit::CompileStats::ra]
+            + stats.seconds[bjit::CompileStats::scc]) / n;
+        r.nBytes = stats.nBytes;
+        r.nSpills = stats.nSpills + stats.nReloads;
+    }
+}
+
+template <typename T>
+static double time(T && fn, int n)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; ++i) fn();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main()
+{
+    struct { const char * name; const char * args; void (*build)(bjit::Proc &); }
+    procs[] =
+    {
+        { "pressure", "ii", buildPressure },
+        { "loop", "i", buildLoop },
+        { "calls", "ii", buildCalls },
+        { "float", "id", buildFloat },
+    };
+    const int nProcs = sizeof(procs) / sizeof(*procs);
+
+    bjit::Module    modules[2];
+    Result          results[nProcs][2];
+
+    for(auto & m : modules) BJIT_ASSERT(m.compileStub(uintptr_t(mix)) == 0);
+
+    for(int i = 0; i < nProcs; ++i)
+    {
+        std::vector<uint8_t> ir;
+        {
+            bjit::Proc  pr(0, procs[i].args);
+            procs[i].build(pr);
+            pr.record(ir);
+        }
+
+        for(int l = 0; l < 2; ++l)
+        {
+            bjit::Proc  pr(0, 0);
+            bool ok = pr.replay(ir.data(), ir.size());
+            BJIT_ASSERT(ok);
+            BJIT_ASSERT(modules[l].compile(pr, l) == i + 1);
+
+            timeCompile(results[i][l], ir, l, 50);
+        }
+    }
+
+    for(auto & m : modules) BJIT_ASSERT(m.load());
+
+    for(int l = 0; l < 2; ++l)
+    {
+        auto & m = modules[l];
+        auto pressure = m.getPointer<int64_t(int64_t, int64_t)>(1);
+        auto loop = m.getPointer<int64_t(int64_t)>(2);
+        auto calls = m.getPointer<int64_t(int64_t, int64_t)>(3);
+        auto dsum = m.getPointer<double(int64_t, double)>(4);
+
+        int64_t x = 1;
+        results[0][l].runMs = time([&]() { x = pressure(x, x >> 7); }, 100000);
+        results[1][l].runMs = time([&]() { x += loop(1000); }, 1000);
+        results[2][l].runMs = time([&]() { x += calls(1000, x); }, 1000);
+        results[3][l].runMs = time([&]() { x += (int64_t) dsum(1000, .5); }, 1000);
+    }
+
+    // both levels must agree
+    auto & m0 = modules[0];
+    auto & m1 = modules[1];
+    for(int i = 0; i < 100; ++i)
+    {
+        int64_t a = bjit::hash64(i), b = bjit::hash64(a);
+
+        BJIT_ASSERT(m0.getPointer<int64_t(int64_t, int64_t)>(1)(a, b)
+            == m1.getPointer<int64_t(int64_t, int64_t)>(1)(a, b));
+        BJIT_ASSERT(m0.getPointer<int64_t(int64_t)>(2)(i)
+            == m1.getPointer<int64_t(int64_t)>(2)(i));
+        BJIT_ASSERT(m0.getPointer<int64_t(int64_t, int64_t)>(3)(i, a)
+            == m1.getPointer<int64_t(int64_t, int64_t)>(3)(i, a));
+        BJIT_ASSERT(m0.getPointer<double(int64_t, double)>(4)(i, 1.0 / (i + 1))
+            == m1.getPointer<double(int64_t, double)>(4)(i, 1.0 / (i + 1)));
+    }
+
+    printf("%-9s %17s %17s %13s %9s %17s\n", "levelOpt 0/1:",
+        "compile ms", "ra ms", "bytes", "spills", "run ms");
+    for(int i = 0; i < nProcs; ++i)
+    {
+        auto & r0 = results[i][0];
+        auto & r1 = results[i][1];
+        printf("%-13s %8.3f %8.3f %8.3f %8.3f %6d %6d %4d %4d %8.2f %8.2f\n",
+            procs[i].name, r0.compileMs, r1.compileMs, r0.raMs, r1.raMs,
+            r0.nBytes, r1.nBytes, r0.nSpills, r1.nSpills, r0.runMs, r1.runMs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+
+#include "bjit.h"
+
+#include <chrono>
+#include <vector>
+
+// lots of code that is already in canonical order, followed by one long
+// sum that is in reverse order, so reassoc needs a lot of rounds to sort
+// it out, while the rest of the proc doesn't change at all (every round
+// used to revisit everything and rebuild dominators several times)
+//
+// compares the optimizer time against Proc::setOptSparse(false), which
+// still does that, and checks that the code is the same, also for a
+// bunch of random procs
+static const int nDiamonds = 12;
+static const int nChain = 40;
+static const int nLong = 100;
+
+int proc(int x, int y)
+{
+    unsigned acc = 0;
+
+    for(int i = 0; i < nDiamonds; ++i)
+    {
+        unsigned w = acc + ((x & (1 << (i & 15))) ? x : y);
+        for(int k = 1; k < nChain; ++k) { w = w * (k + 2); acc = acc + w; }
+    }
+
+    unsigned w[nLong];
+    w[0] = acc;
+    for(int k = 1; k < nLong; ++k) w[k] = w[k-1] * 3;
+
+    // sum in reverse, so the oldest value goes last
+    acc = w[nLong-1];
+    for(int k = nLong-1; k--;) acc = acc + w[k];
+
+    return (int) acc;
+}
+
+static void build(bjit::Proc & pr)
+{
+    pr.env.push_back(pr.lci(0));    // acc
+    pr.env.push_back(pr.lci(0));    // phi for x or y
+
+    for(int i = 0; i < nDiamonds; ++i)
+    {
+        auto lt = pr.newLabel();
+        auto le = pr.newLabel();
+        auto lj = pr.newLabel();
+
+        pr.jz(pr.iand(pr.env[0], pr.lci(1 << (i & 15))), le, lt);
+
+        pr.emitLabel(lt);
+        pr.env[3] = pr.env[0];
+        pr.jmp(lj);
+
+        pr.emitLabel(le);
+        pr.env[3] = pr.env[1];
+        pr.jmp(lj);
+
+        pr.emitLabel(lj);
+
+        auto w = pr.iadd(pr.env[2], pr.env[3]);
+        for(int k = 1; k < nChain; ++k)
+        {
+            w = pr.imul(w, pr.lci(k + 2));
+            pr.env[2] = pr.iadd(pr.env[2], w);
+        }
+    }
+
+    std::vector<bjit::Value>    w;
+    w.push_back(pr.env[2]);
+    for(int k = 1; k < nLong; ++k)
+        w.push_back(pr.imul(w[k-1], pr.lci(3)));
+
+    auto acc = w[nLong-1];
+    for(int k = nLong-1; k--;) acc = pr.iadd(acc, w[k]);
+
+    pr.iret(acc);
+}
+
+// random arithmetic (with lots for reassoc to do) for comparing the code
+static void buildRandom(bjit::Proc & pr, uint64_t seed)
+{
+    auto random = [&]() -> uint64_t { return bjit::hash64(seed++); };
+
+    for(int i = 0; i < 64; ++i)
+    {
+        auto a = pr.env[1 + random() % (pr.env.size() - 1)];
+        auto b = pr.env[1 + random() % (pr.env.size() - 1)];
+        switch(random() % 6)
+        {
+        case 0: pr.env.push_back(pr.lci(random() % 100)); break;
+        case 1: pr.env.push_back(pr.iadd(a, b)); break;
+        case 2: pr.env.push_back(pr.isub(a, b)); break;
+        case 3: pr.env.push_back(pr.imul(a, b)); break;
+        case 4: pr.env.push_back(pr.ixor(a, b)); break;
+        case 5: pr.env.push_back(pr.iadd(a, pr.lci(random() % 100))); break;
+        }
+    }
+    pr.iret(pr.env.back());
+}
+
+// compile a record with and without Proc::setOptSparse(), the code must
+// be identical, returns the time spent in the optimizer for both
+static void compare(std::vector<uint8_t> const & ir, unsigned levelOpt,
+    int n, double * ms)
+{
+    std::vector<uint8_t>    code[2];
+
+    for(int sparse = 0; sparse < 2; ++sparse)
+    {
+        ms[sparse] = 0;
+        for(int i = 0; i < n; ++i)
+        {
+            bjit::Proc  pr(0, 0);
+            BJIT_ASSERT(pr.replay(ir.data(), ir.size()));
+            pr.setOptSparse(sparse);
+
+            code[sparse].clear();
+            pr.compile(code[sparse], levelOpt);
+
+            auto & stats = pr.getStats();
+            for(int p = bjit::CompileStats::dce;
+                p <= bjit::CompileStats::sink; ++p)
+            {
+                ms[sparse] += 1e3 * stats.seconds[p] / n;
+            }
+        }
+    }
+
+    BJIT_ASSERT(code[0] == code[1]);
+}
+
+int main()
+{
+    bjit::Module    module;
+
+    std::vector<uint8_t>    ir;
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        bjit::Proc  pr(0, "ii");
+        build(pr);
+        pr.record(ir);
+        module.compile(pr);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    printf("Compile time: %.1fms\n",
+        std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    // the old way of revisiting everything should give the same code
+    double ms[2];
+    compare(ir, 2, 5, ms);
+    printf("Optimizer: %.2fms, revisiting everything %.2fms\n", ms[1], ms[0]);
+
+    double total[2] = {};
+    for(int i = 0; i < 2000; ++i)
+    {
+        bjit::Proc  pr(0, "iiii");
+        buildRandom(pr, bjit::hash64(i));
+
+        ir.clear();
+        pr.record(ir);
+        for(int levelOpt = 1; levelOpt <= 2; ++levelOpt)
+        {
+            compare(ir, levelOpt, 1, ms);
+            total[0] += ms[0];
+            total[1] += ms[1];
+        }
+    }
+    printf("Random procs: %.2fms, revisiting everything %.2fms\n",
+        total[1], total[0]);
+
+    BJIT_ASSERT(module.load());
+
+    for(int i = 0; i < 16; ++i)
+    {
+        auto h = bjit::hash64(i+1);
+        int x = h&0xffff;
+        int y = (h>>16)&0xff;
+        int z = proc(x,y);
+        int zjit = module.getPointer<int(int,int)>(0)(x,y);
+        printf("proc(%d,%d) = %d (jit says %d)\n", x, y, z, zjit);
+        BJIT_ASSERT(z == zjit);
+    }
+
+    return 0;
+}
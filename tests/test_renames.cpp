@@ -0,0 +1,87 @@
+
+#include "bjit.h"
+
+#include <chrono>
+
+// lots of redundant expressions, so that fold and CSE end up with
+// thousands of renames in a single proc (this used to be quadratic)
+static const int nDiamonds = 12;
+static const int nRepeat = 250;
+
+int proc(int x, int y)
+{
+    unsigned acc = 0;
+
+    for(int i = 0; i < nDiamonds; ++i)
+    {
+        if(x & (1 << (i & 15)))
+        {
+            for(int k = 0; k < nRepeat; ++k) acc = acc + (x + y);
+        }
+        else
+        {
+            for(int k = 0; k < nRepeat; ++k) acc = acc ^ (y - i);
+        }
+    }
+
+    return (int) acc;
+}
+
+int main()
+{
+    bjit::Module    module;
+
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        bjit::Proc  pr(0, "ii");
+
+        pr.env.push_back(pr.lci(0));
+
+        for(int i = 0; i < nDiamonds; ++i)
+        {
+            auto lt = pr.newLabel();
+            auto le = pr.newLabel();
+            auto lj = pr.newLabel();
+
+            pr.jz(pr.iand(pr.env[0], pr.lci(1 << (i & 15))), le, lt);
+
+            // x + 0 folds to x, the rest is the same expression every time
+            pr.emitLabel(lt);
+            for(int k = 0; k < nRepeat; ++k)
+                pr.env[2] = pr.iadd(pr.env[2],
+                    pr.iadd(pr.iadd(pr.env[0], pr.lci(0)), pr.env[1]));
+            pr.jmp(lj);
+
+            pr.emitLabel(le);
+            for(int k = 0; k < nRepeat; ++k)
+                pr.env[2] = pr.ixor(pr.env[2],
+                    pr.isub(pr.env[1], pr.lci(i)));
+            pr.jmp(lj);
+
+            pr.emitLabel(lj);
+        }
+
+        pr.iret(pr.env[2]);
+
+        module.compile(pr);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    printf("Compile time: %.1fms\n",
+        std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    BJIT_ASSERT(module.load());
+
+    for(int i = 0; i < 16; ++i)
+    {
+        auto h = bjit::hash64(i+1);
+        int x = h&0xffff;
+        int y = (h>>16)&0xff;
+        int z = proc(x,y);
+        int zjit = module.getPointer<int(int,int)>(0)(x,y);
+        printf("proc(%d,%d) = %d (jit says %d)\n", x, y, z, zjit);
+        BJIT_ASSERT(z == zjit);
+    }
+
+    return 0;
+}
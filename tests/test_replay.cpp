@@ -0,0 +1,252 @@
+
+#include "bjit.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Records a small corpus of procs into a file and replays it, checking
+// that the code is identical to compiling the procs directly.
+//
+// Given files as arguments, replays those instead and reports timings
+// for each pass, eg. to benchmark the compiler with procs recorded by
+// some front-end.
+
+static const int nVariants = 8;
+
+// loop with a couple of exits
+static void buildLoop(bjit::Proc & pr, int v)
+{
+    pr.env.push_back(pr.lci(v));
+
+    auto la = pr.newLabel();
+    auto lb = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jmp(la);
+
+    pr.emitLabel(la);
+    pr.env[2] = pr.iadd(pr.env[2], pr.lci(v + 1));
+    pr.jnz(pr.ige(pr.env[2], pr.env[0]), le, lb);
+
+    pr.emitLabel(lb);
+    pr.env[2] = pr.imul(pr.env[2], pr.env[1]);
+    pr.jnz(pr.ige(pr.env[2], pr.env[1]), le, la);
+
+    pr.emitLabel(le);
+    pr.iret(pr.env[2]);
+}
+
+// chain of diamonds, with some redundant work for CSE
+static void buildDiamonds(bjit::Proc & pr, int v)
+{
+    pr.env.push_back(pr.lci(0));
+
+    for(int i = 0; i < 4 + v; ++i)
+    {
+        auto lt = pr.newLabel();
+        auto le = pr.newLabel();
+        auto lj = pr.newLabel();
+
+        pr.jz(pr.iand(pr.env[0], pr.lci(1 << i)), le, lt);
+
+        pr.emitLabel(lt);
+        pr.env[2] = pr.iadd(pr.env[2], pr.iadd(pr.env[0], pr.env[1]));
+        pr.jmp(lj);
+
+        pr.emitLabel(le);
+        pr.env[2] = pr.ixor(pr.env[2], pr.iadd(pr.env[1], pr.env[0]));
+        pr.jmp(lj);
+
+        pr.emitLabel(lj);
+    }
+    pr.iret(pr.env[2]);
+}
+
+// floating point and a near call to the previous proc
+static void buildFloat(bjit::Proc & pr, int v)
+{
+    auto x = pr.ci2d(pr.env[0]);
+    auto y = pr.ci2d(pr.env[1]);
+
+    auto s = pr.dadd(pr.dmul(x, x), pr.dmul(y, pr.lcd(v + .5)));
+    pr.env.push_back(pr.cd2i(s));
+    pr.env.push_back(pr.env[1]);
+    pr.iret(pr.iadd(pr.env[2], pr.icalln(v, 2)));
+}
+
+static void (*builders[])(bjit::Proc &, int) =
+    { buildLoop, buildDiamonds, buildFloat };
+
+// reads one record at a time, so the corpus can be any size
+static bool readRecord(FILE * f, std::vector<uint8_t> & buf)
+{
+    uint32_t size;
+    if(1 != fread(&size, sizeof(size), 1, f)) return false;
+    if(size < sizeof(size)) return false;
+
+    buf.resize(size);
+    memcpy(buf.data(), &size, sizeof(size));
+    return 1 == fread(buf.data() + sizeof(size), size - sizeof(size), 1, f);
+}
+
+static int replayFile(const char * path, std::vector<uint8_t> * bytesOut)
+{
+    FILE * f = fopen(path, "rb");
+    if(!f) { printf("Can't open %s\n", path); return -1; }
+
+    bjit::Module            module;
+    bjit::Proc              proc(0, "");
+    std::vector<uint8_t>    buf;
+
+    int nRecords = 0;
+    double totalMs = 0;
+
+    bjit::CompileStats      total;
+    while(readRecord(f, buf))
+    {
+        if(!proc.replay(buf.data(), buf.size()))
+        {
+            printf("%s: invalid record %d\n", path, nRecords);
+            fclose(f);
+            return -1;
+        }
+
+        auto size0 = module.getBytes().size();
+        auto t0 = std::chrono::steady_clock::now();
+
+        module.compile(proc);
+
+        auto t1 = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+        auto & stats = proc.getStats();
+        BJIT_ASSERT(stats.nBytes == module.getBytes().size() - size0);
+
+        printf("%s:%d: %d bytes of IR, %d bytes of code, %.3fms"
+            " (ops %d -> %d, %d opt iterations)\n", path, nRecords,
+            (int) buf.size(), stats.nBytes, ms,
+            stats.nOpsIn, stats.nOpsOut, stats.nOptIter);
+
+        total.add(stats);
+        totalMs += ms;
+        ++nRecords;
+    }
+    fclose(f);
+
+    printf("%s: %d procs, %d bytes of code, %.3fms total\n",
+        path, nRecords, (int) module.getBytes().size(), totalMs);
+
+    for(int i = 0; i < bjit::CompileStats::nPasses; ++i)
+    {
+        printf("  %-8s %5d runs %9.3fms\n", bjit::CompileStats::passName(i),
+            total.nRuns[i], total.seconds[i] * 1e3);
+    }
+    printf("  blocks %d -> %d, spills %d, reloads %d, renames %d\n",
+        total.nBlocksIn, total.nBlocksOut,
+        total.nSpills, total.nReloads, total.nRenames);
+
+    if(bytesOut) *bytesOut = module.getBytes();
+    return nRecords;
+}
+
+int main(int argc, char ** argv)
+{
+    if(argc > 1)
+    {
+        for(int i = 1; i < argc; ++i)
+        {
+            if(replayFile(argv[i], 0) < 0) return 1;
+        }
+        return 0;
+    }
+
+    // record while compiling the procs normally
+    bjit::Module            module;
+    std::vector<uint8_t>    corpus;
+
+    int nProcs = 0;
+    for(int v = 0; v < nVariants; ++v)
+    {
+        for(auto * build : builders)
+        {
+            bjit::Proc  pr(0, "ii");
+            build(pr, v);
+            // settings must come back with the record, or the code differs
+            pr.setFramePointer(nProcs & 1);
+            pr.setOptSparse(nProcs & 2);
+            pr.record(corpus);
+            module.compile(pr);
+            ++nProcs;
+        }
+    }
+
+    char path[] = "/tmp/bjit-replay-XXXXXX";
+    int fd = mkstemp(path);
+    BJIT_ASSERT(fd >= 0);
+
+    FILE * f = fdopen(fd, "wb");
+    BJIT_ASSERT(f);
+    BJIT_ASSERT(1 == fwrite(corpus.data(), corpus.size(), 1, f));
+    fclose(f);
+
+    std::vector<uint8_t>    bytes;
+    BJIT_ASSERT(replayFile(path, &bytes) == nProcs);
+    BJIT_ASSERT(bytes == module.getBytes());
+
+    unlink(path);
+
+    // garbage should be rejected
+    {
+        bjit::Proc  pr(0, "ii");
+        pr.iret(pr.env[0]);
+
+        std::vector<uint8_t>    rec;
+        pr.record(rec);
+
+        // wrong size
+        auto bad = rec;
+        bad.push_back(0);
+        BJIT_ASSERT(!pr.replay(bad.data(), bad.size()));
+
+        // same size, but fields out of range: header is 24 bytes, then
+        // 17 bytes for each op with u64 (in[0] first) and opcode at 14
+        uint16_t nOps;
+        memcpy(&nOps, rec.data() + 12, 2);
+        BJIT_ASSERT(nOps && rec.size() > 24 + 17 * nOps);
+
+        auto corrupt = [&](size_t offset, uint16_t v) -> bool
+        {
+            auto bad = rec;
+            memcpy(bad.data() + offset, &v, 2);
+            return pr.replay(bad.data(), bad.size());
+        };
+
+        size_t ret = 24 + 17 * (nOps - 1);  // iret is the last op
+        BJIT_ASSERT(!corrupt(ret + 14, 0xffff));    // opcode
+        BJIT_ASSERT(!corrupt(ret, 0xfff0));         // input
+        BJIT_ASSERT(!corrupt(ret + 12, 0xfff0));    // block
+        BJIT_ASSERT(!corrupt(12, nOps + 1));        // number of ops
+        BJIT_ASSERT(!corrupt(4, 0));                // magic
+        BJIT_ASSERT(!corrupt(24 + 17 * nOps + 1, 0xfff0)); // code size
+
+        bad = rec;
+        bad[23] = 0x80;     // unknown setting
+        BJIT_ASSERT(!pr.replay(bad.data(), bad.size()));
+
+        // any single byte might still be valid, but must not crash
+        for(size_t i = 0; i < rec.size(); ++i)
+        {
+            auto bad = rec;
+            bad[i] ^= 0xff;
+            pr.replay(bad.data(), bad.size());
+        }
+
+        BJIT_ASSERT(pr.replay(rec.data(), rec.size()));
+    }
+
+    printf("Replayed %d procs, %d bytes of IR.\n", nProcs, (int) corpus.size());
+
+    return 0;
+}
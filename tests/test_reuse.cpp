@@ -0,0 +1,187 @@
+#include "bjit.h"
+
+#include <new>
+#include <cstdlib>
+#include <chrono>
+
+// count heap allocations, so we can check that reset() recycles memory
+static unsigned nAllocs = 0;
+
+void * operator new(size_t size)
+{
+    ++nAllocs;
+    if(void * ptr = malloc(size ? size : 1)) return ptr;
+    abort();
+}
+void operator delete(void * ptr) noexcept { free(ptr); }
+void operator delete(void * ptr, size_t) noexcept { free(ptr); }
+
+// this is the same as test_sieve, but with a call to make RA work a bit
+static void buildSieve(bjit::Proc & pr)
+{
+    int _flags = 0;
+    int _size = 1;
+
+    int _i      = pr.env.size(); pr.env.push_back(pr.lci(0));
+    int _count  = pr.env.size(); pr.env.push_back(pr.lci(0));
+
+    auto ls0 = pr.newLabel();
+    auto lb0 = pr.newLabel();
+    auto le0 = pr.newLabel();
+
+    pr.jmp(ls0);
+    pr.emitLabel(ls0);
+    pr.jz(pr.ilt(pr.env[_i], pr.env[_size]), le0, lb0);
+    pr.emitLabel(lb0);
+        pr.si8(pr.lci(1), pr.iadd(pr.env[_flags], pr.env[_i]), 0);
+        pr.env[_i] = pr.iadd(pr.env[_i], pr.lci(1));
+        pr.jmp(ls0);
+    pr.emitLabel(le0);
+
+    pr.env[_i] = pr.lci(2);
+    auto ls1 = pr.newLabel();
+    auto lb1 = pr.newLabel();
+    auto le1 = pr.newLabel();
+
+    pr.jmp(ls1);
+    pr.emitLabel(ls1);
+    pr.jz(pr.ilt(pr.env[_i], pr.env[_size]), le1, lb1);
+    pr.emitLabel(lb1);
+
+        auto bt = pr.newLabel();
+        auto be = pr.newLabel();
+
+        pr.jnz(pr.li8(pr.iadd(pr.env[_flags], pr.env[_i]), 0), bt, be);
+        pr.emitLabel(bt);
+
+            int _prime  = pr.env.size();
+            pr.env.push_back(pr.iadd(pr.env[_i], pr.lci(1)));
+            int _k = pr.env.size();
+            pr.env.push_back(pr.iadd(pr.env[_i], pr.env[_prime]));
+
+            auto ls2 = pr.newLabel();
+            auto lb2 = pr.newLabel();
+            auto le2 = pr.newLabel();
+
+            pr.jmp(ls2);
+            pr.emitLabel(ls2);
+            pr.jnz(pr.ilt(pr.env[_k], pr.env[_size]), lb2, le2);
+            pr.emitLabel(lb2);
+                pr.si8(pr.lci(0), pr.iadd(pr.env[_flags], pr.env[_k]), 0);
+                pr.env[_k] = pr.iadd(pr.env[_k], pr.env[_prime]);
+                pr.jmp(ls2);
+            pr.emitLabel(le2);
+
+            pr.env.pop_back();
+            pr.env.pop_back();
+
+            // count = count + identity(1) through a near call
+            pr.env.push_back(pr.lci(1));
+            auto one = pr.icalln(1, 1);
+            pr.env.pop_back();
+            pr.env[_count] = pr.iadd(pr.env[_count], one);
+
+            pr.jmp(be);
+        pr.emitLabel(be);
+
+        pr.env[_i] = pr.iadd(pr.env[_i], pr.lci(1));
+        pr.jmp(ls1);
+
+    pr.emitLabel(le1);
+    pr.iret(pr.env[_count]);
+}
+
+static int sieve(char * flags, int size)
+{
+    int count = 0;
+
+    for (int i = 0; i < size; ++i) flags[i] = true;
+    for (int i = 2; i < size; ++i)
+    {
+        if (flags[i])
+        {
+            int prime = i + 1;
+            int k = i + prime;
+
+            while (k < size)
+            {
+                flags[k] = false;
+                k += prime;
+            }
+
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+static void buildIdentity(bjit::Proc & pr)
+{
+    pr.iret(pr.env[0]);
+}
+
+int main()
+{
+    const int nIter = 200;
+
+    std::vector<uint8_t>    fresh, reused;
+
+    // fresh Proc for every compile
+    unsigned allocsFresh = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for(int i = 0; i < nIter; ++i)
+    {
+        fresh.clear();
+        unsigned n0 = nAllocs;
+        bjit::Proc  pr(0, "ii");
+        buildSieve(pr);
+        pr.compile(fresh, 2);
+        allocsFresh = nAllocs - n0;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    // one Proc, reset() for every compile
+    unsigned allocsReused = 0;
+    bjit::Proc  pr(0, "ii");
+    for(int i = 0; i < nIter; ++i)
+    {
+        reused.clear();
+        unsigned n0 = nAllocs;
+        pr.reset(0, "ii");
+        buildSieve(pr);
+        pr.compile(reused, 2);
+        allocsReused = nAllocs - n0;
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    printf("Allocations per compile: %d fresh, %d with reset()\n",
+        allocsFresh, allocsReused);
+    printf("Time per compile: %.1fus fresh, %.1fus with reset()\n",
+        std::chrono::duration<double, std::micro>(t1 - t0).count() / nIter,
+        std::chrono::duration<double, std::micro>(t2 - t1).count() / nIter);
+
+    // once warm, we should not allocate at all
+    BJIT_ASSERT(!allocsReused);
+    BJIT_ASSERT(fresh == reused);
+
+    // check that the recycled Proc can build something different
+    // and that the result still works
+    bjit::Module    module;
+    pr.reset(0, "ii");
+    buildSieve(pr);
+    module.compile(pr);
+    pr.reset(0, "i");
+    buildIdentity(pr);
+    module.compile(pr);
+
+    BJIT_ASSERT(module.load());
+
+    static char data[8190];
+    auto proc = module.getPointer<int(char*,int)>(0);
+    int n = proc(data, sizeof(data));
+    printf("BJIT-sieve: %d primes\n", n);
+    BJIT_ASSERT(n == sieve(data, sizeof(data)));
+
+    return 0;
+}
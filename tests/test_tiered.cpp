@@ -0,0 +1,101 @@
+
+#include "bjit.h"
+
+#include <chrono>
+
+// Procs from compileTiered() start at levelOpt 0 and get recompiled
+// by updateTiered() once they have been called often enough.
+
+static void buildFib(bjit::Proc & pr, int self)
+{
+    auto lt = pr.newLabel();
+    auto le = pr.newLabel();
+
+    pr.jnz(pr.ile(pr.env[0], pr.lci(1)), lt, le);
+
+    pr.emitLabel(lt);
+    pr.iret(pr.lci(1));
+
+    pr.emitLabel(le);
+    pr.env.push_back(pr.isub(pr.env[0], pr.lci(1)));
+    auto a = pr.icalln(self, 1);
+    pr.env.pop_back();
+
+    pr.env.push_back(pr.isub(pr.env[0], pr.lci(2)));
+    auto b = pr.icalln(self, 1);
+    pr.env.pop_back();
+
+    pr.iret(pr.iadd(a, b));
+}
+
+static double timeFib(int (*fib)(int), int n)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    BJIT_ASSERT(fib(n) == 317811);
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main()
+{
+    bjit::Module    module;
+    module.setTierThreshold(100);
+
+    bjit::Proc      pr(0, "i");
+
+    // near calls go to the stub, so recursion gets upgraded too
+    buildFib(pr, 0);
+    int fib = module.compileTiered(pr);
+    BJIT_ASSERT(fib == 0);
+
+    // the IR was recorded, so the proc can be reused right away
+    pr.reset(0, "i");
+    buildFib(pr, fib + 2);  // stub + levelOpt 0 proc
+    int fib2 = module.compileTiered(pr);
+    BJIT_ASSERT(fib2 == fib + 2);
+
+    pr.reset(0, "i");
+    buildFib(pr, fib2 + 2);
+    int fibRef = module.compile(pr);    // plain levelOpt 2 for reference
+    BJIT_ASSERT(fibRef == fib2 + 2);
+
+    pr.reset(0, "i");
+    pr.iret(pr.iadd(pr.env[0], pr.lci(1)));
+    int inc = module.compileTiered(pr);
+
+    BJIT_ASSERT(module.load(0x10000));
+
+    auto callFib = module.getPointer<int(int)>(fib);
+    auto callInc = module.getPointer<int(int)>(inc);
+
+    // below the threshold nothing happens
+    for(int i = 0; i < 99; ++i) BJIT_ASSERT(callInc(i) == i + 1);
+    BJIT_ASSERT(module.updateTiered(true) == 0);
+    BJIT_ASSERT(module.pendingAsync() == 0);
+
+    double ms0 = timeFib(callFib, 27);
+
+    // fib and inc are hot now, fib2 was never called
+    BJIT_ASSERT(callInc(99) == 100);
+    BJIT_ASSERT(module.updateTiered(true) == 2);
+    BJIT_ASSERT(module.updateTiered(true) == 0);
+    BJIT_ASSERT(module.patch());
+
+    double ms2 = timeFib(callFib, 27);
+    double msRef = timeFib(module.getPointer<int(int)>(fibRef), 27);
+
+    BJIT_ASSERT(callInc(5) == 6);
+    BJIT_ASSERT(module.getPointer<int(int)>(fib2)(10) == 89);
+
+    // stubs keep pointing to the new code after reload
+    module.unload();
+    BJIT_ASSERT(module.load());
+
+    BJIT_ASSERT(module.getPointer<int(int)>(fib)(10) == 89);
+    BJIT_ASSERT(module.getPointer<int(int)>(inc)(1) == 2);
+
+    printf("fib(27): levelOpt 0 %.2fms, tiered up %.2fms, levelOpt 2 %.2fms\n",
+        ms0, ms2, msRef);
+
+    return 0;
+}
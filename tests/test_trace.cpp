@@ -0,0 +1,80 @@
+
+#include "bjit.h"
+
+#include <cstring>
+
+// collects trace events into a ring buffer and checks the filters
+
+static int countEvents(std::vector<bjit::trace::Ring::Event> & events,
+    unsigned category, const char * prefix)
+{
+    int n = 0;
+    for(auto & e : events)
+    {
+        if(e.category != category) continue;
+        if(!strncmp(e.msg.c_str(), prefix, strlen(prefix))) ++n;
+    }
+    return n;
+}
+
+static void compileSome(bjit::Module & module)
+{
+    bjit::Proc  pr(0, "ii");
+
+    auto la = pr.newLabel();
+    auto lb = pr.newLabel();
+
+    pr.jnz(pr.ilt(pr.env[0], pr.env[1]), la, lb);
+
+    pr.emitLabel(la);
+    pr.iret(pr.iadd(pr.env[0], pr.env[1]));
+
+    pr.emitLabel(lb);
+    pr.iret(pr.iadd(pr.env[1], pr.env[0]));
+
+    module.compile(pr);
+}
+
+int main()
+{
+    bjit::Module            module;
+    bjit::trace::Ring       ring(64);
+
+    std::vector<bjit::trace::Ring::Event>   events;
+
+    bjit::trace::setSink(bjit::trace::Ring::sink, &ring);
+
+    // nothing but errors by default
+    compileSome(module);
+    BJIT_ASSERT(!ring.getTotal());
+
+    // pass level events from the optimizer only
+    bjit::trace::setFilter(bjit::trace::opt, bjit::trace::info);
+    compileSome(module);
+    ring.get(events);
+
+    BJIT_ASSERT(events.size() && events.size() == ring.getTotal());
+    BJIT_ASSERT(countEvents(events, bjit::trace::opt, "cse") > 0);
+    BJIT_ASSERT(countEvents(events, bjit::trace::opt, "dce") > 0);
+    BJIT_ASSERT(countEvents(events, bjit::trace::ra, "") == 0);
+    for(auto & e : events) BJIT_ASSERT(e.level <= bjit::trace::info);
+
+    // everything, the small one should wrap around and keep the latest
+    bjit::trace::Ring       small(8);
+    bjit::trace::setSink(bjit::trace::Ring::sink, &small);
+    bjit::trace::setFilter(bjit::trace::all, bjit::trace::debug);
+    compileSome(module);
+    small.get(events);
+
+    BJIT_ASSERT(small.getTotal() > 8 && events.size() == 8);
+    BJIT_ASSERT(countEvents(events, bjit::trace::ra, "ra") > 0);
+
+    printf("Traced %d events, last: %s\n",
+        small.getTotal(), events.back().msg.c_str());
+
+    // back to the defaults
+    bjit::trace::setFilter(bjit::trace::all, bjit::trace::error);
+    bjit::trace::setSink(0);
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+
+#include "bjit.h"
+
+#include <unwind.h>
+
+#include <atomic>
+#include <thread>
+
+// calls back into C++ from a proc (called by another proc) and walks the
+// stack with the C++ runtime's unwinder, which needs the unwind tables from
+// Module::setUnwind() to get past the procs back to main()
+
+struct Trace
+{
+    uintptr_t   begin, end;     // code of the module
+    int         nFrames = 0;
+    int         nJit = 0;       // frames in the module
+    int         nAfter = 0;     // frames after the last one in the module
+};
+
+static thread_local Trace * trace = 0;
+
+static _Unwind_Reason_Code traceFrame(_Unwind_Context * ctx, void *)
+{
+    uintptr_t ip = _Unwind_GetIP(ctx);
+
+    ++trace->nFrames;
+    if(ip > trace->begin && ip <= trace->end)
+    {
+        ++trace->nJit;
+        trace->nAfter = 0;
+    }
+    else if(trace->nJit) ++trace->nAfter;
+
+    return _URC_NO_REASON;
+}
+
+static int probe(int a, int b)
+{
+    _Unwind_Backtrace(traceFrame, 0);
+    return a + b;
+}
+
+// compiles the procs and returns the index of the outer one
+static int compileProcs(bjit::Module & module)
+{
+    // needs a frame with callee saved registers and some stack
+    int inner;
+    {
+        bjit::Proc  pr(64, "ii");
+        auto x = pr.imul(pr.env[0], pr.env[1]);
+        auto y = pr.isub(pr.env[0], pr.env[1]);
+        pr.env.push_back(x);
+        pr.env.push_back(y);
+        auto r = pr.icallp(pr.lci(uintptr_t(probe)), 2);
+        pr.iret(pr.iadd(r, pr.iadd(x, y)));
+        inner = module.compile(pr);
+    }
+
+    int outer;
+    {
+        bjit::Proc  pr(0, "ii");
+        auto r = pr.icalln(inner, 2);
+        pr.iret(pr.iadd(r, pr.env[0]));
+        outer = module.compile(pr);
+    }
+
+    return outer;
+}
+
+static Trace run(bool unwind)
+{
+    bjit::Module    module;
+    module.setUnwind(unwind);
+
+    int outer = compileProcs(module);
+    BJIT_ASSERT(module.load());
+
+    Trace t;
+    t.begin = (uintptr_t) module.getPointer<void>(0);
+    t.end = t.begin + module.getBytes().size();
+    trace = &t;
+
+    // x*y + x-y twice, plus x
+    BJIT_ASSERT(module.getPointer<int(int,int)>(outer)(5, 3) == 2*(15+2) + 5);
+
+    trace = 0;
+    return t;
+}
+
+// patch() replaces the tables, but another thread unwinding through the
+// module at the same time must always find them
+static int unwindWhilePatching()
+{
+    bjit::Module    module;
+    module.setUnwind(true);
+
+    // dual-mapped, so that the code stays executable while patching
+    int outer = compileProcs(module);
+    BJIT_ASSERT(module.load(0x10000, true));
+
+    auto begin = (uintptr_t) module.getPointer<void>(0);
+    auto end = begin + module.getBytes().size();
+    auto * fn = module.getPointer<int(int,int)>(outer);
+
+    std::atomic<bool>   stop(false);
+    std::atomic<int>    nCalls(0);
+    std::thread         thread([&]()
+    {
+        while(!stop)
+        {
+            Trace t;
+            t.begin = begin;
+            t.end = end;
+            trace = &t;
+
+            BJIT_ASSERT(fn(5, 3) == 2*(15+2) + 5);
+            BJIT_ASSERT(t.nJit == 2);
+            BJIT_ASSERT(t.nAfter >= 2);
+
+            trace = 0;
+            ++nCalls;
+        }
+    });
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        bjit::Proc  pr(0, "i");
+        pr.iret(pr.iadd(pr.env[0], pr.lci(i)));
+        module.compile(pr);
+        BJIT_ASSERT(module.patch());
+    }
+
+    stop = true;
+    thread.join();
+
+    return nCalls;
+}
+
+int main()
+{
+    Trace t = run(true);
+    printf("With unwind tables: %d frames, %d in module, %d after\n",
+        t.nFrames, t.nJit, t.nAfter);
+
+    // both procs and at least run() and main() after them
+    BJIT_ASSERT(t.nJit == 2);
+    BJIT_ASSERT(t.nAfter >= 2);
+
+    // this depends on the runtime, so only report it
+    t = run(false);
+    printf("Without: %d frames, %d in module, %d after\n",
+        t.nFrames, t.nJit, t.nAfter);
+
+    // registering and unregistering repeatedly should be fine
+    for(int i = 0; i < 100; ++i) run(true);
+
+    printf("Unwound %d times while patching\n", unwindWhilePatching());
+
+    return 0;
+}